@@ -5,7 +5,7 @@
 // @version         1.0
 // @author          Justus
 // @include         explorer.exe
-// @compilerOptions -lole32 -ldwmapi -lgdi32 -luser32 -lwindowsapp -lshcore -lgdiplus
+// @compilerOptions -lole32 -ldwmapi -lgdi32 -luser32 -lwindowsapp -lshcore -lshlwapi -lgdiplus
 // ==/WindhawkMod==
 
 // ==WindhawkModReadme==
@@ -45,28 +45,77 @@ A modern Windows 11 taskbar music controller with native DWM styling, timeline s
   $name: Manual Text Color (Hex)
 - BgOpacity: 0
   $name: Acrylic Tint Opacity (0-255). Keep 0 for pure glass.
+- ArtCacheMB: 32
+  $name: Album Art Cache (MB)
+- PerPixelAlpha: false
+  $name: Per-Pixel Alpha (present with UpdateLayeredWindow)
+- SoftwareRenderer: false
+  $name: Software Renderer (rasterize without GDI+)
+- AdaptiveAccent: false
+  $name: Adaptive Accent (tint, progress bar and hovered controls follow the album art)
+- BlurredBackdrop: false
+  $name: Blurred Backdrop (the panel sits on a blurred, dimmed copy of the album art)
+- ScrubSeekMs: 120
+  $name: Live Scrub Interval (ms between seeks while dragging the timeline, 0 = seek on release)
+- PerfHud: false
+  $name: Performance HUD (frame and latency stats over the panel)
+- Benchmark: false
+  $name: Run GDI+ Paint Benchmark at Startup (results go to the mod log)
 */
 // ==/WindhawkModSettings==
 
+// With MUSIC_WIDGET_HEADLESS defined only the portable core is built (models, media
+// worker, scheduler, layout, scene, panel painting and the software renderer), for the
+// tests in tests/; text comes from whichever GlyphProvider the caller installs
+#ifdef MUSIC_WIDGET_HEADLESS
+#include "tests/headless.h"
+#else
 #include <windows.h>
 #include <shellapi.h>
 #include <dwmapi.h>
 #include <gdiplus.h>
 #include <shcore.h> 
+#include <shlwapi.h>
+#endif
 #include <string>
 #include <vector>
 #include <atomic>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <map>
+#include <tuple>
+#include <unordered_map>
+#include <memory>
+#include <chrono>
+#include <functional>
+#include <cstdint>
 #include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#if defined(__SSE2__) || defined(_M_X64)
+#define IMAGE_KERNELS_SIMD 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#define IMAGE_KERNELS_SIMD 0
+#endif
 
+#ifndef MUSIC_WIDGET_HEADLESS
 // WinRT
 #include <winrt/Windows.Foundation.h>
 #include <winrt/Windows.Media.Control.h>
 #include <winrt/Windows.Storage.Streams.h>
+#endif
 
 using namespace Gdiplus;
 using namespace std;
+#ifndef MUSIC_WIDGET_HEADLESS
 using namespace winrt;
 using namespace Windows::Media::Control;
 using namespace Windows::Storage::Streams;
@@ -137,6 +186,7 @@ typedef HWND(WINAPI* pCreateWindowInBand)(
 
 typedef BOOL(WINAPI* pSetWindowBand)(HWND hWnd, HWND hwndInsertAfter, DWORD dwBand);
 typedef BOOL(WINAPI* pGetWindowBand)(HWND hWnd, PDWORD pdwBand);
+#endif
 
 // --- Configurable State ---
 struct ModSettings {
@@ -146,10 +196,349 @@ struct ModSettings {
     int offsetX = 100;
     int offsetY = 100;
     bool autoTheme = true;
+    bool adaptiveAccent = false;
+    bool blurredBackdrop = false;
     DWORD manualTextColor = 0xFFFFFFFF; 
     int bgOpacity = 0;   
+    int artCacheMB = 32;
+    bool perPixelAlpha = false;
+    bool softwareRenderer = false;
+    int scrubSeekMs = 120;
+    bool perfHud = false;
+    bool benchmark = false;
 } g_Settings;
 
+// --- Clock ---
+// Monotonic time in milliseconds. Animation and timeline timestamps come from here, so a
+// VirtualClock can be swapped in to replay a schedule deterministically.
+class Clock {
+public:
+    virtual ~Clock() {}
+    virtual double Now() = 0;
+};
+
+class SystemClock : public Clock {
+public:
+    double Now() override {
+        LARGE_INTEGER counter, frequency;
+        QueryPerformanceCounter(&counter);
+        QueryPerformanceFrequency(&frequency);
+        return counter.QuadPart * 1000.0 / frequency.QuadPart;
+    }
+} g_SystemClock;
+
+class VirtualClock : public Clock {
+public:
+    double now = 0.0;
+    double Now() override { return now; }
+    void Advance(double ms) { now += ms; }
+};
+
+// --- Trace ---
+// Binary events in per-thread ring buffers. Writing one is a few stores and a release
+// increment with no formatting, locking or system call; text is produced only when the
+// rings are dumped (middle-click on the panel, or a crash). Events above TRACE_LEVEL_MAX
+// are compiled out; the per-frame DEBUG events only go in when it is raised for a build.
+#define TRACE_LEVEL_ERROR 1
+#define TRACE_LEVEL_INFO  2
+#define TRACE_LEVEL_DEBUG 3
+#ifndef TRACE_LEVEL_MAX
+#define TRACE_LEVEL_MAX TRACE_LEVEL_INFO
+#endif
+
+#define TRACE_RING_SIZE   1024  // Events per thread, a power of two
+#define TRACE_MAX_THREADS 8     // Threads tracing at once; any beyond this are dropped
+
+enum TraceCategory : uint8_t {
+    TRACE_CAT_MEDIA,
+    TRACE_CAT_ART,
+    TRACE_CAT_RENDER,
+    TRACE_CAT_COUNT
+};
+
+enum TraceEventId : uint16_t {
+    TRACE_POLL,         // Span: one batch of media changes
+    TRACE_DECODE,       // Span: a cover decoded from thumbnail bytes
+    TRACE_PAINT,        // Span: DrawMediaPanel
+    TRACE_TIMELINE,     // a = position, b = duration
+    TRACE_ART_CACHE,    // a = hits, b = misses
+    TRACE_ART_MISSING,  // The session has no thumbnail
+    TRACE_ART_ERROR,    // a = GDI+ status, or -1 if no stream or bitmap
+    TRACE_ROLLBACK,     // a = command, b = 0 if it timed out, 1 if the app rejected it
+    TRACE_EVENT_COUNT
+};
+
+enum TracePhase : uint8_t {
+    TRACE_INSTANT,
+    TRACE_BEGIN,
+    TRACE_END  // a = span length in ms
+};
+
+struct TraceEvent {
+    double time;  // SystemClock ms
+    double a;
+    double b;
+    DWORD threadId;
+    uint16_t id;
+    uint8_t level;
+    uint8_t category;
+    uint8_t phase;
+};
+
+// Single writer (the thread that owns it). Readers copy the slots out and then re-read
+// head, dropping any slot the writer may have reached meanwhile. A ring outlives its
+// owner: the next thread to claim it carries on after the events already in it.
+struct TraceRing {
+    atomic<bool> owned{false};
+    atomic<uint32_t> head{0};
+    TraceEvent events[TRACE_RING_SIZE];
+};
+
+TraceRing g_TraceRings[TRACE_MAX_THREADS];
+atomic<uint32_t> g_TraceDropped{0};  // Events from threads that found every ring owned
+
+// The calling thread's ring, given back when the thread exits so the WinRT callback
+// threads that come and go do not use them all up
+struct TraceRingClaim {
+    TraceRing* ring = nullptr;
+    DWORD threadId = 0;
+
+    TraceRing* Get() {
+        if (ring) return ring;
+        for (TraceRing& candidate : g_TraceRings) {
+            bool owned = false;
+            if (!candidate.owned.load(memory_order_relaxed) &&
+                candidate.owned.compare_exchange_strong(owned, true, memory_order_acquire)) {
+                ring = &candidate;
+                threadId = GetCurrentThreadId();
+                break;
+            }
+        }
+        return ring;
+    }
+
+    ~TraceRingClaim() {
+        if (ring) ring->owned.store(false, memory_order_release);
+    }
+};
+
+thread_local TraceRingClaim t_TraceRing;
+
+void TraceWrite(uint8_t level, uint8_t category, uint16_t id, uint8_t phase, double a, double b) {
+    TraceRing* ring = t_TraceRing.Get();
+    if (!ring) {
+        g_TraceDropped.fetch_add(1, memory_order_relaxed);
+        return;
+    }
+    uint32_t head = ring->head.load(memory_order_relaxed);
+    TraceEvent& e = ring->events[head & (TRACE_RING_SIZE - 1)];
+    e.time = g_SystemClock.Now();
+    e.a = a;
+    e.b = b;
+    e.threadId = t_TraceRing.threadId;
+    e.id = id;
+    e.level = level;
+    e.category = category;
+    e.phase = phase;
+    ring->head.store(head + 1, memory_order_release);
+}
+
+#define TRACE(level, category, id, a, b) \
+    do { if ((level) <= TRACE_LEVEL_MAX) TraceWrite((level), (category), (id), TRACE_INSTANT, (double)(a), (double)(b)); } while (0)
+
+// Brackets a scope with begin/end events
+class TraceSpan {
+public:
+    TraceSpan(uint8_t level, uint8_t category, uint16_t id) : m_level(level), m_category(category), m_id(id) {
+        if (m_level > TRACE_LEVEL_MAX) return;
+        m_start = g_SystemClock.Now();
+        TraceWrite(m_level, m_category, m_id, TRACE_BEGIN, 0.0, 0.0);
+    }
+
+    ~TraceSpan() {
+        if (m_level > TRACE_LEVEL_MAX) return;
+        TraceWrite(m_level, m_category, m_id, TRACE_END, g_SystemClock.Now() - m_start, 0.0);
+    }
+
+private:
+    uint8_t m_level;
+    uint8_t m_category;
+    uint16_t m_id;
+    double m_start = 0.0;
+};
+
+const wchar_t* const g_TraceEventNames[TRACE_EVENT_COUNT] = {
+    L"poll", L"decode", L"paint", L"timeline", L"art-cache", L"art-missing", L"art-error", L"rollback"
+};
+const wchar_t* const g_TraceCategoryNames[TRACE_CAT_COUNT] = { L"media", L"art", L"render" };
+
+// Copies every ring out, oldest event first. Safe while the owners keep writing: each
+// ring keeps only the events its owner cannot have overwritten during the copy, so at
+// most TRACE_RING_SIZE - 1 of them.
+vector<TraceEvent> CollectTrace() {
+    vector<TraceEvent> events;
+    vector<TraceEvent> copy(TRACE_RING_SIZE);
+    for (TraceRing& ring : g_TraceRings) {
+        uint32_t head = ring.head.load(memory_order_acquire);
+        memcpy(copy.data(), ring.events, sizeof(ring.events));
+        atomic_thread_fence(memory_order_acquire);
+        // The owner may have written slots head .. after meanwhile (and be writing 'after'),
+        // which reuse the slots of the oldest events copied; keep only the ones after those
+        uint32_t after = ring.head.load(memory_order_relaxed);
+        uint32_t first = head - (head < TRACE_RING_SIZE ? head : TRACE_RING_SIZE);
+        if ((int32_t)(after + 1 - TRACE_RING_SIZE - first) > 0) first = after + 1 - TRACE_RING_SIZE;
+        if ((int32_t)(head - first) <= 0) continue;
+        for (uint32_t i = first; i != head; i++) events.push_back(copy[i & (TRACE_RING_SIZE - 1)]);
+    }
+    // Stable, so events of one thread stamped the same keep the order they were written in
+    stable_sort(events.begin(), events.end(), [](const TraceEvent& x, const TraceEvent& y) {
+        return x.time < y.time;
+    });
+    return events;
+}
+
+// The rings as text, one event per line
+wstring FormatTrace() {
+    static const wchar_t* const levels[] = { L"?", L"E", L"I", L"D" };
+    static const wchar_t* const phases[] = { L"", L" begin", L" end" };
+    vector<TraceEvent> events = CollectTrace();
+    wstring text;
+    WCHAR line[160];
+    swprintf_s(line, L"[Trace] %u events, %u dropped\n", (unsigned)events.size(),
+               g_TraceDropped.load(memory_order_relaxed));
+    text += line;
+    for (const TraceEvent& e : events) {
+        if (e.id >= TRACE_EVENT_COUNT || e.category >= TRACE_CAT_COUNT || e.level > 3 || e.phase > TRACE_END) continue;
+        swprintf_s(line, L"[Trace] %.3f %5lu %ls %-6ls %ls%ls a=%g b=%g\n", e.time, (unsigned long)e.threadId,
+                   levels[e.level], g_TraceCategoryNames[e.category], g_TraceEventNames[e.id], phases[e.phase], e.a, e.b);
+        text += line;
+    }
+    return text;
+}
+
+#ifndef MUSIC_WIDGET_HEADLESS
+// Decodes every ring to the debugger output, a line per call
+void DumpTrace() {
+    wstring text = FormatTrace();
+    for (size_t start = 0; start < text.size();) {
+        size_t end = text.find(L'\n', start);
+        OutputDebugStringW(text.substr(start, end - start).c_str());
+        start = end + 1;
+    }
+}
+
+// Installed on init in front of whatever filter the process already had, which still
+// gets every crash after the dump
+LPTOP_LEVEL_EXCEPTION_FILTER g_PreviousCrashFilter = nullptr;
+atomic<bool> g_CrashDumped{false};
+
+LONG WINAPI TraceCrashFilter(EXCEPTION_POINTERS* info) {
+    // Once only, in case the dump itself faults
+    if (!g_CrashDumped.exchange(true)) DumpTrace();
+    return g_PreviousCrashFilter ? g_PreviousCrashFilter(info) : EXCEPTION_CONTINUE_SEARCH;
+}
+
+void InstallCrashFilter() {
+    g_PreviousCrashFilter = SetUnhandledExceptionFilter(TraceCrashFilter);
+}
+
+// Puts the previous filter back, unless another one was installed over ours since; that
+// one keeps its place rather than being dropped from the chain
+void RemoveCrashFilter() {
+    LPTOP_LEVEL_EXCEPTION_FILTER current = SetUnhandledExceptionFilter(g_PreviousCrashFilter);
+    if (current != TraceCrashFilter) SetUnhandledExceptionFilter(current);
+}
+#endif
+
+// --- Performance Stats ---
+// Latency histograms with fixed log-linear buckets: exact below 8 us, then 8 buckets per
+// power of two, so a percentile is within 12.5% of the true value. Recording is one
+// relaxed increment, safe from any thread; nothing allocates. Shown by the Performance
+// HUD setting.
+class LatencyHistogram {
+public:
+    void Record(double ms) {
+        double micros = ms * 1000.0;
+        uint64_t v = micros <= 0.0 ? 0 : micros >= (double)MAX_MICROS ? MAX_MICROS : (uint64_t)micros;
+        m_counts[BucketOf(v)].fetch_add(1, memory_order_relaxed);
+    }
+
+    uint64_t Count() const {
+        uint64_t total = 0;
+        for (const auto& count : m_counts) total += count.load(memory_order_relaxed);
+        return total;
+    }
+
+    // In ms, from the midpoint of the bucket holding the q-th sample; 0 when empty
+    double Percentile(double q) const {
+        uint64_t total = Count();
+        if (total == 0) return 0.0;
+        uint64_t rank = (uint64_t)ceil(q * total);
+        if (rank == 0) rank = 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; i++) {
+            seen += m_counts[i].load(memory_order_relaxed);
+            if (seen >= rank) return (BucketLow(i) + BucketLow(i + 1)) / 2.0 / 1000.0;
+        }
+        return MAX_MICROS / 1000.0;
+    }
+
+    void Reset() {
+        for (auto& count : m_counts) count.store(0, memory_order_relaxed);
+    }
+
+private:
+    static const int SUB_BITS = 3;
+    static const int SUB = 1 << SUB_BITS;
+    static const int MAX_MAGNITUDE = 29;  // Clamped at about nine minutes
+    static const uint64_t MAX_MICROS = (1ull << (MAX_MAGNITUDE + 1)) - 1;
+    static const int BUCKETS = (MAX_MAGNITUDE - SUB_BITS + 2) * SUB;
+
+    static int BucketOf(uint64_t v) {
+        if (v < SUB) return (int)v;
+        int magnitude = SUB_BITS;
+        while ((v >> (magnitude + 1)) != 0) magnitude++;
+        int shift = magnitude - SUB_BITS;
+        return (shift + 1) * SUB + (int)((v >> shift) - SUB);
+    }
+
+    static double BucketLow(int index) {
+        if (index < SUB) return index;
+        int shift = index / SUB - 1;
+        return (double)((uint64_t)(SUB + index % SUB) << shift);
+    }
+
+    atomic<uint64_t> m_counts[BUCKETS] = {};
+};
+
+// Records the lifetime of a scope
+class ScopedLatency {
+public:
+    explicit ScopedLatency(LatencyHistogram& histogram) : m_histogram(histogram), m_start(g_SystemClock.Now()) {}
+    ~ScopedLatency() { m_histogram.Record(g_SystemClock.Now() - m_start); }
+
+private:
+    LatencyHistogram& m_histogram;
+    double m_start;
+};
+
+LatencyHistogram g_PerfPaint;
+LatencyHistogram g_PerfProperties;  // TryGetMediaPropertiesAsync
+LatencyHistogram g_PerfTimeline;    // GetTimelineProperties
+LatencyHistogram g_PerfCommands;    // Transport commands
+LatencyHistogram g_PerfDecode;
+LatencyHistogram g_PerfClickToPaint;    // Transport click to the first paint showing it
+LatencyHistogram g_PerfCommandConfirm;  // Transport click to a snapshot confirming it
+LatencyHistogram g_PerfSeek;            // TryChangePlaybackPositionAsync
+atomic<uint64_t> g_PerfArtHits{0};  // Mirrors of the worker's ArtCache counters
+atomic<uint64_t> g_PerfArtMisses{0};
+uint64_t g_PerfFrames = 0;  // DrawMediaPanel calls, UI thread only
+uint64_t g_PerfPixels = 0;  // Pixels those calls cleared and redrew, UI thread only
+uint64_t g_PerfScrubSeeks = 0;    // Seeks sent while dragging, UI thread only
+uint64_t g_PerfScrubDropped = 0;  // Drag targets replaced before their seek was sent
+uint64_t g_PerfTextHits = 0;      // Text measurements answered from a cache, UI thread only
+uint64_t g_PerfTextMisses = 0;
+
 // --- Global State ---
 HWND g_hMediaWindow = NULL;
 bool g_Running = true; 
@@ -159,533 +548,4531 @@ int g_HoverState = 0;
 bool g_PanelOpen = true;
 int g_PanelOffsetX = 0;  // Current animation offset
 int g_PanelTargetOffsetX = 0;  // Target animation offset
-ULONGLONG g_HoverTimerStart = 0;  // When hover started
+double g_SlideFromX = 0.0;  // Offset the running slide started from
+double g_SlideStartTime = 0.0;
+double g_HoverTimerStart = 0.0;  // When hover started
 bool g_HoverTabZone = false;  // Currently hovering over tab zone
 float g_HoverBoldLevel = 0.0f;  // Visual bold effect (0.0 to 1.0)
-ULONGLONG g_HoverLastLeftTime = 0;  // When last left hover zone (for resume logic) 
+float g_HoverLeftBoldLevel = 0.0f;  // Bold level when the zone was left, fades from here
+double g_HoverLastLeftTime = 0.0;  // When last left hover zone (for resume logic)
 
 // Data Model
-struct MediaState {
+// Premultiplied 32bpp BGRA pixels, laid out like GDI+ PixelFormat32bppPARGB
+struct ArtImage {
+    int width = 0;
+    int height = 0;
+    vector<uint32_t> pixels;
+};
+
+// Dominant and accent colours of a cover, see ExtractArtPalette
+struct ArtPalette {
+    uint32_t dominant = 0;  // Opaque ARGB, 0 without a cover
+    uint32_t accent = 0;
+
+    bool operator==(const ArtPalette& other) const {
+        return dominant == other.dominant && accent == other.accent;
+    }
+};
+
+// Size and theme the blurred backdrop is built for; zero size means no backdrop
+struct BackdropSpec {
+    int width = 0;
+    int height = 0;
+    bool light = false;
+
+    bool operator==(const BackdropSpec& other) const {
+        return width == other.width && height == other.height && light == other.light;
+    }
+};
+
+// Built by the media worker and never modified once published
+struct MediaSnapshot {
+    uint64_t version = 0;  // Bumped on every publication
     wstring title = L"Waiting for media...";
     wstring artist = L"";
     bool isPlaying = false;
     bool hasMedia = false;
-    Bitmap* albumArt = nullptr;
+    shared_ptr<const ArtImage> albumArt;  // Already scaled to the display size
+    uint64_t artGeneration = 0;  // Changes whenever albumArt does; never reused
+    ArtPalette artPalette;
+    shared_ptr<const ArtImage> backdrop;  // Blurred cover at the panel size, BlurredBackdrop only
     bool isSpotify = false;
     double position = 0.0;
     double duration = 0.0;
-    double smoothPosition = 0.0; // For smooth animation
-    ULONGLONG lastUpdateTick = 0; // For time interpolation
-    mutex lock;
-} g_MediaState;
+    double positionStamp = 0.0;  // Clock time at which 'position' was current
+    bool positionEstimated = false;  // Set by the worker after a seek, until the app reports
+    double playbackRate = 1.0;
+    wstring sessionId;  // App id of the session shown
+    bool sessionPinned = false;
+    unsigned controls = 0xF;  // MediaControl flags
+};
+
+// Single-writer, single-reader triple buffer. The writer fills its private slot and swaps
+// it into the middle; the reader swaps the middle out only when it holds something newer.
+// Neither side ever waits, and once warmed up the slots are reused without allocating.
+template <typename T>
+class TripleBuffer {
+public:
+    // Writer thread only
+    void Publish(const T& value) {
+        m_slots[m_back] = value;
+        m_back = m_middle.exchange(m_back | FRESH, memory_order_acq_rel) & INDEX;
+    }
+
+    // Reader thread only; the reference stays valid until the next Acquire
+    const T& Acquire() {
+        if (m_middle.load(memory_order_relaxed) & FRESH) {
+            m_front = m_middle.exchange(m_front, memory_order_acq_rel) & INDEX;
+        }
+        return m_slots[m_front];
+    }
+
+    // Reader thread only; what the last Acquire returned, without looking for newer
+    const T& Current() const {
+        return m_slots[m_front];
+    }
+
+    // Only while neither side is running. Clears the fresh flag too, so the next Acquire
+    // cannot hand out a value published before the reset.
+    void Reset() {
+        for (auto& slot : m_slots) slot = T();
+        m_back = 0;
+        m_middle.store(1, memory_order_relaxed);
+        m_front = 2;
+    }
+
+private:
+    static const unsigned INDEX = 3;
+    static const unsigned FRESH = 4;
+    T m_slots[3];
+    unsigned m_back = 0;
+    atomic<unsigned> m_middle{1};
+    unsigned m_front = 2;
+};
+
+// Filled by g_MediaWorker
+TripleBuffer<MediaSnapshot> g_MediaSnapshots;
+
+// The buffer the UI thread reads; the benchmark points it at its own pipeline's
+TripleBuffer<MediaSnapshot>* g_UiSnapshots = &g_MediaSnapshots;
+
+// Window procedure calls in progress on the UI thread; more than one while a message is
+// sent from inside another message's handler
+int g_MessageDepth = 0;
+
+// UI thread only. Take one snapshot per message and pass it down, so a handler never
+// mixes fields from two different updates. A message nested inside another one gets the
+// outer message's snapshot: swapping now would hand the slot it is reading back to the
+// worker.
+const MediaSnapshot& AcquireMediaSnapshot() {
+    return g_MessageDepth > 1 ? g_UiSnapshots->Current() : g_UiSnapshots->Acquire();
+}
+
+// The snapshot the current message acquired, for code that cannot be handed it, like
+// the frame steps WM_TIMER runs
+const MediaSnapshot& CurrentMediaSnapshot() {
+    return g_UiSnapshots->Current();
+}
+
+// Art slot size and backdrop last handed to the media worker
+int g_ArtSizeRequested = 0;
+BackdropSpec g_BackdropRequested;
 
 // Animation
-int g_ScrollOffset = 0;
-int g_TextWidth = 0;
+float g_ScrollOffset = 0.0f;  // Derived from elapsed time, see MarqueeOffset
 bool g_IsScrolling = false;
-int g_ScrollWait = 60;
+double g_ScrollStartTime = 0.0;
+
+
+
+// Timeline seek state
+bool g_TimelineHover = false;
+bool g_TimelineDragging = false;
+float g_TimelineDragProgress = 0.0f;
+
+// --- Settings ---
+#ifndef MUSIC_WIDGET_HEADLESS
+void LoadSettings() {
+    g_Settings.width = Wh_GetIntSetting(L"PanelWidth");
+    g_Settings.height = Wh_GetIntSetting(L"PanelHeight");
+    g_Settings.fontSize = Wh_GetIntSetting(L"FontSize");
+    g_Settings.offsetX = Wh_GetIntSetting(L"OffsetX");
+    g_Settings.offsetY = Wh_GetIntSetting(L"OffsetY");
+    // Force visible defaults if settings are missing or invalid
+    if (g_Settings.width < 100) g_Settings.width = 400;
+    if (g_Settings.height < 24) g_Settings.height = 100;
+    if (g_Settings.offsetX < 0) g_Settings.offsetX = 100;
+    if (g_Settings.offsetY < 0) g_Settings.offsetY = 100;
+    g_Settings.autoTheme = Wh_GetIntSetting(L"AutoTheme") != 0;
+    g_Settings.adaptiveAccent = Wh_GetIntSetting(L"AdaptiveAccent") != 0;
+    g_Settings.blurredBackdrop = Wh_GetIntSetting(L"BlurredBackdrop") != 0;
+    
+    PCWSTR textHex = Wh_GetStringSetting(L"TextColor");
+    DWORD textRGB = 0xFFFFFF;
+    if (textHex) {
+        if (wcslen(textHex) > 0) textRGB = wcstoul(textHex, nullptr, 16);
+        Wh_FreeStringSetting(textHex);
+    }
+    g_Settings.manualTextColor = 0xFF000000 | textRGB;
+    
+    g_Settings.bgOpacity = Wh_GetIntSetting(L"BgOpacity");
+    if (g_Settings.bgOpacity < 0) g_Settings.bgOpacity = 0;
+    if (g_Settings.bgOpacity > 255) g_Settings.bgOpacity = 255;
+
+    g_Settings.perPixelAlpha = Wh_GetIntSetting(L"PerPixelAlpha") != 0;
+    g_Settings.softwareRenderer = Wh_GetIntSetting(L"SoftwareRenderer") != 0;
+    g_Settings.perfHud = Wh_GetIntSetting(L"PerfHud") != 0;
+
+    g_Settings.scrubSeekMs = Wh_GetIntSetting(L"ScrubSeekMs");
+    if (g_Settings.scrubSeekMs < 0) g_Settings.scrubSeekMs = 0;
+    if (g_Settings.scrubSeekMs > 2000) g_Settings.scrubSeekMs = 2000;
+    g_Settings.benchmark = Wh_GetIntSetting(L"Benchmark") != 0;
+
+    g_Settings.artCacheMB = Wh_GetIntSetting(L"ArtCacheMB");
+    if (g_Settings.artCacheMB < 1) g_Settings.artCacheMB = 1;
+    if (g_Settings.artCacheMB > 512) g_Settings.artCacheMB = 512;
+
+    if (g_Settings.width < 100) g_Settings.width = 300;
+    if (g_Settings.height < 24) g_Settings.height = 48;
+}
+#endif
+
+// --- Timeline Model ---
+// Pure position model: it reads no clock or global state, 'now' is always passed in (Clock
+// milliseconds), so it behaves the same when replayed against a recorded timeline.
+struct TimelineSample {
+    double position = 0.0;  // Seconds
+    double stamp = 0.0;     // Clock time at which 'position' was current
+    double duration = 0.0;
+    double rate = 1.0;
+    bool playing = false;
+};
+
+#define TIMELINE_SNAP_SECONDS 2.0    // Disagreements this large are seeks and jump straight there
+#define TIMELINE_SLEW_MS      300.0  // Smaller ones are eased out, over at least this long
+
+double ExtrapolatePosition(const TimelineSample& sample, double now) {
+    double position = sample.position;
+    if (sample.playing && now > sample.stamp) position += (now - sample.stamp) / 1000.0 * sample.rate;
+    if (position > sample.duration) position = sample.duration;
+    if (position < 0.0) position = 0.0;
+    return position;
+}
+
+// Displayed position following a stream of samples. A sample that disagrees slightly
+// with the extrapolation (event jitter, player rounding) is slewed in at no more than
+// half speed either way, so the bar never runs backwards while playing.
+class TimelineModel {
+public:
+    void Update(TimelineSample sample, double now) {
+        if (!m_valid) {
+            m_sample = m_input = sample;
+            m_slewOffset = 0.0;
+            m_valid = true;
+            return;
+        }
+        // Compared against the last input, not m_sample, which may have been rebased
+        bool sameTimeline = sample.position == m_input.position && sample.stamp == m_input.stamp;
+        if (sameTimeline && sample.playing == m_input.playing && sample.rate == m_input.rate &&
+            sample.duration == m_input.duration) {
+            return;
+        }
+        m_input = sample;
+
+        double shown = Position(now);
+        if (sameTimeline) {
+            // Play state or rate changed without a fresh timeline: carry on from the bar
+            sample.position = shown;
+            sample.stamp = now;
+        }
+        double error = shown - ExtrapolatePosition(sample, now);
+        m_sample = sample;
+        if (fabs(error) >= TIMELINE_SNAP_SECONDS) {
+            m_slewOffset = 0.0;
+        } else {
+            m_slewOffset = error;
+            m_slewStart = now;
+            m_slewMs = fabs(error) * 2000.0;
+            if (m_slewMs < TIMELINE_SLEW_MS) m_slewMs = TIMELINE_SLEW_MS;
+        }
+    }
+
+    double Position(double now) const {
+        if (!m_valid) return 0.0;
+        double position = ExtrapolatePosition(m_sample, now);
+        if (IsSlewing(now)) {
+            position += m_slewOffset * (1.0 - (now - m_slewStart) / m_slewMs);
+            if (position > m_sample.duration) position = m_sample.duration;
+            if (position < 0.0) position = 0.0;
+        }
+        return position;
+    }
+
+    bool IsSlewing(double now) const {
+        return m_slewOffset != 0.0 && now - m_slewStart < m_slewMs;
+    }
+
+    void Reset() { m_valid = false; }
+
+private:
+    TimelineSample m_sample;  // What is extrapolated from
+    TimelineSample m_input;   // Last sample as received
+    bool m_valid = false;
+    double m_slewOffset = 0.0;
+    double m_slewStart = 0.0;
+    double m_slewMs = TIMELINE_SLEW_MS;
+};
+
+// --- Media Source ---
+// The update logic only talks to this interface, so it does not care whether the
+// data comes from GSMTC or from anything else that can describe a session.
+enum MediaChange : unsigned {
+    MEDIA_CHANGE_SESSION    = 1 << 0,
+    MEDIA_CHANGE_PROPERTIES = 1 << 1,
+    MEDIA_CHANGE_PLAYBACK   = 1 << 2,
+    MEDIA_CHANGE_TIMELINE   = 1 << 3,
+    MEDIA_CHANGE_ALL        = 0xF
+};
+
+// What the session's app currently allows
+enum MediaControl : unsigned {
+    MEDIA_CONTROL_PREV       = 1 << 0,
+    MEDIA_CONTROL_PLAY_PAUSE = 1 << 1,
+    MEDIA_CONTROL_NEXT       = 1 << 2,
+    MEDIA_CONTROL_SEEK       = 1 << 3,
+    MEDIA_CONTROL_ALL        = 0xF
+};
+
+struct MediaReading {
+    bool hasSession = false;
+    wstring appId;
+    wstring title;
+    wstring artist;
+    bool isPlaying = false;
+    bool hasTimeline = false;
+    double position = 0.0;
+    double duration = 0.0;
+    double positionStamp = 0.0;
+    double playbackRate = 1.0;
+    unsigned controls = MEDIA_CONTROL_ALL;
+};
+
+// Sessions are identified by their app's SourceAppUserModelId
+class MediaSource {
+public:
+    virtual ~MediaSource() {}
+    // onChanged receives the session's app id and a MediaChange mask, and may be called
+    // from any thread. An empty app id means the session list or current session changed.
+    virtual bool Start(function<void(const wstring& appId, unsigned changes)> onChanged) = 0;
+    virtual void Stop() = 0;
+    // Every open session, and the one Windows considers current (empty if none)
+    virtual void ListSessions(vector<wstring>& appIds, wstring& current) = 0;
+    // Fills the parts of 'out' selected by 'changes'; returns false if the session is gone.
+    virtual bool Read(const wstring& appId, unsigned changes, MediaReading& out) = 0;
+    virtual bool ReadThumbnail(const wstring& appId, vector<uint8_t>& bytes) = 0;
+    // Returns whether the app accepted the command
+    virtual bool SendCommand(const wstring& appId, int cmd) = 0;
+    virtual bool Seek(const wstring& appId, double seconds) = 0;
+};
+
+// --- WinRT / GSMTC ---
+#ifndef MUSIC_WIDGET_HEADLESS
+// Always owned by a shared_ptr. Revoking a handler does not wait for a call already in
+// progress on a WinRT thread, so the handlers hold only a weak reference and keep the
+// source alive for as long as such a call runs; Stop() followed by dropping the owner's
+// reference is then safe at any moment.
+class GsmtcMediaSource : public MediaSource, public enable_shared_from_this<GsmtcMediaSource> {
+public:
+    bool Start(function<void(const wstring&, unsigned)> onChanged) override {
+        m_onChanged = onChanged;
+        try {
+            m_manager = GlobalSystemMediaTransportControlsSessionManager::RequestAsync().get();
+        } catch (...) {
+            m_manager = nullptr;
+        }
+        if (!m_manager) return false;
+
+        weak_ptr<GsmtcMediaSource> weak = weak_from_this();
+        m_currentChanged = m_manager.CurrentSessionChanged(auto_revoke, [weak](auto&&, auto&&) {
+            if (auto self = weak.lock()) self->Notify(L"", MEDIA_CHANGE_SESSION);
+        });
+        m_sessionsChanged = m_manager.SessionsChanged(auto_revoke, [weak](auto&&, auto&&) {
+            if (auto self = weak.lock()) {
+                self->Resubscribe();
+                self->Notify(L"", MEDIA_CHANGE_SESSION);
+            }
+        });
+        Resubscribe();
+        return true;
+    }
+
+    void Stop() override {
+        lock_guard<mutex> guard(m_lock);
+        m_currentChanged.revoke();
+        m_sessionsChanged.revoke();
+        m_sessions.clear();  // Revokes the per-session handlers
+        m_manager = nullptr;
+        m_onChanged = nullptr;
+    }
+
+    void ListSessions(vector<wstring>& appIds, wstring& current) override {
+        appIds.clear();
+        current.clear();
+        lock_guard<mutex> guard(m_lock);
+        for (auto& subscription : m_sessions) appIds.push_back(subscription->appId);
+        if (!m_manager) return;
+        auto session = m_manager.GetCurrentSession();
+        if (session) current = session.SourceAppUserModelId().c_str();
+    }
+
+    bool Read(const wstring& appId, unsigned changes, MediaReading& out) override {
+        auto session = FindSession(appId);
+        if (!session) {
+            out = MediaReading();
+            return false;
+        }
+        out.hasSession = true;
+        out.appId = appId;
+        if (changes & (MEDIA_CHANGE_SESSION | MEDIA_CHANGE_PROPERTIES)) {
+            ScopedLatency latency(g_PerfProperties);
+            auto props = session.TryGetMediaPropertiesAsync().get();
+            out.title = props.Title().c_str();
+            out.artist = props.Artist().c_str();
+        }
+        if (changes & (MEDIA_CHANGE_SESSION | MEDIA_CHANGE_PLAYBACK)) {
+            auto info = session.GetPlaybackInfo();
+            out.isPlaying = (info.PlaybackStatus() == GlobalSystemMediaTransportControlsSessionPlaybackStatus::Playing);
+            auto rate = info.PlaybackRate();
+            out.playbackRate = rate ? rate.Value() : 1.0;
+            auto controls = info.Controls();
+            out.controls = (controls.IsPreviousEnabled() ? MEDIA_CONTROL_PREV : 0) |
+                           (controls.IsPlayPauseToggleEnabled() ? MEDIA_CONTROL_PLAY_PAUSE : 0) |
+                           (controls.IsNextEnabled() ? MEDIA_CONTROL_NEXT : 0) |
+                           (controls.IsPlaybackPositionEnabled() ? MEDIA_CONTROL_SEEK : 0);
+        }
+        // Only Spotify reports a reliable timeline
+        out.hasTimeline = wcsstr(out.appId.c_str(), L"Spotify") != nullptr;
+        // A play/pause also re-reads the timeline so the model can rebase on it
+        if (out.hasTimeline && (changes & (MEDIA_CHANGE_SESSION | MEDIA_CHANGE_TIMELINE | MEDIA_CHANGE_PLAYBACK))) {
+            double start = g_SystemClock.Now();
+            auto timeline = session.GetTimelineProperties();
+            g_PerfTimeline.Record(g_SystemClock.Now() - start);
+            out.position = timeline.Position().count() / 10000000.0;
+            out.duration = timeline.EndTime().count() / 10000000.0;
+            // The position was current at LastUpdatedTime, which may be well before now
+            double ageMs = (winrt::clock::now() - timeline.LastUpdatedTime()).count() / 10000.0;
+            if (ageMs < 0.0 || ageMs > out.duration * 1000.0) ageMs = 0.0;  // Unset or bogus stamp
+            out.positionStamp = g_SystemClock.Now() - ageMs;
+        } else if (!out.hasTimeline) {
+            out.position = 0.0;
+            out.duration = 0.0;
+        }
+        return true;
+    }
+
+    bool ReadThumbnail(const wstring& appId, vector<uint8_t>& bytes) override {
+        bytes.clear();
+        auto session = FindSession(appId);
+        if (!session) return false;
+        auto thumbRef = session.TryGetMediaPropertiesAsync().get().Thumbnail();
+        if (!thumbRef) return false;
+        auto stream = thumbRef.OpenReadAsync().get();
+        uint32_t size = (uint32_t)stream.Size();
+        if (size == 0) return false;
+        DataReader reader(stream);
+        reader.LoadAsync(size).get();
+        bytes.resize(size);
+        reader.ReadBytes(bytes);
+        return true;
+    }
+
+    bool SendCommand(const wstring& appId, int cmd) override {
+        auto session = FindSession(appId);
+        if (!session) return false;
+        ScopedLatency latency(g_PerfCommands);
+        if (cmd == 1) return session.TrySkipPreviousAsync().get();
+        if (cmd == 2) return session.TryTogglePlayPauseAsync().get();
+        if (cmd == 3) return session.TrySkipNextAsync().get();
+        return false;
+    }
+
+    bool Seek(const wstring& appId, double seconds) override {
+        auto session = FindSession(appId);
+        if (!session) return false;
+        ScopedLatency latency(g_PerfSeek);
+        return session.TryChangePlaybackPositionAsync((LONGLONG)(seconds * 10000000)).get();
+    }
+
+private:
+    struct Subscription {
+        wstring appId;
+        GlobalSystemMediaTransportControlsSession session = nullptr;
+        GlobalSystemMediaTransportControlsSession::MediaPropertiesChanged_revoker propertiesChanged;
+        GlobalSystemMediaTransportControlsSession::PlaybackInfoChanged_revoker playbackChanged;
+        GlobalSystemMediaTransportControlsSession::TimelinePropertiesChanged_revoker timelineChanged;
+    };
+
+    GlobalSystemMediaTransportControlsSession FindSession(const wstring& appId) {
+        lock_guard<mutex> guard(m_lock);
+        for (auto& subscription : m_sessions) {
+            if (subscription->appId == appId) return subscription->session;
+        }
+        return nullptr;
+    }
+
+    void Notify(const wstring& appId, unsigned changes) {
+        function<void(const wstring&, unsigned)> onChanged;
+        {
+            lock_guard<mutex> guard(m_lock);
+            onChanged = m_onChanged;
+        }
+        if (onChanged) onChanged(appId, changes);
+    }
+
+    // Subscribes to every open session, one per app; sessions already followed keep
+    // their subscriptions
+    void Resubscribe() {
+        lock_guard<mutex> guard(m_lock);
+        if (!m_manager) return;
+        vector<unique_ptr<Subscription>> sessions;
+        try {
+            for (auto session : m_manager.GetSessions()) {
+                wstring appId = session.SourceAppUserModelId().c_str();
+                bool seen = appId.empty();
+                for (auto& subscription : sessions) seen = seen || subscription->appId == appId;
+                if (seen) continue;
+
+                unique_ptr<Subscription> subscription;
+                for (auto& existing : m_sessions) {
+                    if (existing && existing->appId == appId && existing->session == session) {
+                        subscription = move(existing);
+                        break;
+                    }
+                }
+                if (!subscription) {
+                    weak_ptr<GsmtcMediaSource> weak = weak_from_this();
+                    subscription.reset(new Subscription());
+                    subscription->appId = appId;
+                    subscription->session = session;
+                    subscription->propertiesChanged = session.MediaPropertiesChanged(auto_revoke, [weak, appId](auto&&, auto&&) {
+                        if (auto self = weak.lock()) self->Notify(appId, MEDIA_CHANGE_PROPERTIES);
+                    });
+                    subscription->playbackChanged = session.PlaybackInfoChanged(auto_revoke, [weak, appId](auto&&, auto&&) {
+                        if (auto self = weak.lock()) self->Notify(appId, MEDIA_CHANGE_PLAYBACK);
+                    });
+                    subscription->timelineChanged = session.TimelinePropertiesChanged(auto_revoke, [weak, appId](auto&&, auto&&) {
+                        if (auto self = weak.lock()) self->Notify(appId, MEDIA_CHANGE_TIMELINE);
+                    });
+                }
+                sessions.push_back(move(subscription));
+            }
+        } catch (...) {}
+        m_sessions.swap(sessions);  // Whatever is left in 'sessions' has closed
+    }
+
+    mutex m_lock;
+    function<void(const wstring&, unsigned)> m_onChanged;
+    GlobalSystemMediaTransportControlsSessionManager m_manager = nullptr;
+    vector<unique_ptr<Subscription>> m_sessions;
+    GlobalSystemMediaTransportControlsSessionManager::CurrentSessionChanged_revoker m_currentChanged;
+    GlobalSystemMediaTransportControlsSessionManager::SessionsChanged_revoker m_sessionsChanged;
+};
+
+// The source the media worker opens unless it is handed another
+shared_ptr<MediaSource> MakeSystemMediaSource() {
+    return make_shared<GsmtcMediaSource>();
+}
+
+Bitmap* BytesToBitmap(const vector<uint8_t>& bytes) {
+    if (bytes.empty()) {
+        TRACE(TRACE_LEVEL_INFO, TRACE_CAT_ART, TRACE_ART_MISSING, 0, 0);
+        return nullptr;
+    }
+
+    IStream* nativeStream = SHCreateMemStream(bytes.data(), (UINT)bytes.size());
+    if (!nativeStream) {
+        TRACE(TRACE_LEVEL_ERROR, TRACE_CAT_ART, TRACE_ART_ERROR, -1, 0);
+        return nullptr;
+    }
+
+    Bitmap* bmp = Bitmap::FromStream(nativeStream, TRUE);  // TRUE = useIcm for better color handling
+    nativeStream->Release();
+
+    if (!bmp) {
+        TRACE(TRACE_LEVEL_ERROR, TRACE_CAT_ART, TRACE_ART_ERROR, -1, 0);
+        return nullptr;
+    }
+
+    if (bmp->GetLastStatus() != Ok) {
+        TRACE(TRACE_LEVEL_ERROR, TRACE_CAT_ART, TRACE_ART_ERROR, bmp->GetLastStatus(), 0);
+        delete bmp;
+        return nullptr;
+    }
+    return bmp;
+}
+#else
+// No system source without Windows; tests hand the worker their own
+shared_ptr<MediaSource> MakeSystemMediaSource() {
+    return nullptr;
+}
+#endif
+
+// --- Image Kernels ---
+// The per-pixel loops behind the art pipeline and the software renderer, each written
+// as a scalar reference plus SSE2 and AVX2 versions. The widest one the CPU supports is
+// picked once at startup. The vector versions use the same integer rounding and the same
+// float operation order as the reference, so every level produces identical pixels; the
+// benchmark checks that on each run.
+#if defined(__GNUC__) || defined(__clang__)
+#define KERNEL_AVX2 __attribute__((target("avx2")))
+#else
+#define KERNEL_AVX2
+#endif
+
+enum SimdLevel { SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2, SIMD_LEVELS };
+
+SimdLevel DetectSimdLevel() {
+#if IMAGE_KERNELS_SIMD
+#if defined(__GNUC__) || defined(__clang__)
+    // Also checks that the OS saves the YMM registers
+    if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+#else
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] >= 7) {
+        __cpuid(info, 1);
+        bool osAvx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+        __cpuidex(info, 7, 0);
+        if (osAvx && (info[1] & (1 << 5))) return SIMD_AVX2;
+    }
+#endif
+    return SIMD_SSE2;
+#else
+    return SIMD_SCALAR;
+#endif
+}
+
+#define PALETTE_BINS 4096  // One extra bin past these collects transparent pixels
+
+// Box-filter weights for one axis: each destination pixel averages the source span it covers
+struct ResampleTaps {
+    vector<int> first;
+    vector<int> count;
+    vector<float> weights;  // 'count' weights per destination pixel, packed
+};
+
+ResampleTaps BuildResampleTaps(int srcSize, int dstSize) {
+    ResampleTaps taps;
+    float scale = (float)srcSize / (float)dstSize;
+    float span = scale > 1.0f ? scale : 1.0f;
+    for (int d = 0; d < dstSize; d++) {
+        float center = (d + 0.5f) * scale;
+        float x0 = center - span / 2.0f;
+        float x1 = center + span / 2.0f;
+        int first = (int)floor(x0);
+        int last = (int)ceil(x1);
+        if (first < 0) first = 0;
+        if (last > srcSize) last = srcSize;
+        taps.first.push_back(first);
+        taps.count.push_back(last - first);
+        float total = 0.0f;
+        size_t base = taps.weights.size();
+        for (int s = first; s < last; s++) {
+            float cover = min(x1, (float)(s + 1)) - max(x0, (float)s);
+            if (cover < 0.0f) cover = 0.0f;
+            taps.weights.push_back(cover);
+            total += cover;
+        }
+        for (size_t i = base; i < taps.weights.size(); i++) taps.weights[i] /= (total > 0.0f ? total : 1.0f);
+    }
+    return taps;
+}
+
+struct ImageKernels {
+    const wchar_t* name;
+    // Straight to premultiplied alpha and back, in place
+    void (*premultiply)(uint32_t* pixels, size_t count);
+    void (*unpremultiply)(uint32_t* pixels, size_t count);
+    // dst = src over dst, both premultiplied
+    void (*blendOver)(uint32_t* dst, const uint32_t* src, size_t count);
+    // Scales every channel by an 8-bit coverage, so a premultiplied image takes the mask's shape
+    void (*applyMask)(uint32_t* pixels, const uint8_t* mask, size_t count);
+    // Horizontal resample pass: 'rows' rows of 'srcWidth' pixels into 'width' pixels of
+    // four floats (B, G, R, A) each
+    void (*resampleRows)(const uint32_t* src, int srcWidth, int rows, const ResampleTaps& taps, float* out, int width);
+    // Vertical resample pass: one output row from 'count' consecutive rows of floats
+    void (*resampleColumn)(const float* rows, int width, int count, const float* weights, uint32_t* dst);
+    // Vertical box blur of every column, 1 <= radius <= 127, edge rows repeated. Sums stay
+    // within 16 bits and are divided by a 16-bit reciprocal rounded up, which keeps flat
+    // areas (opaque alpha in particular) exactly as they were.
+    void (*boxBlurColumns)(const uint32_t* src, uint32_t* dst, int width, int height, int radius);
+    // Adds a row to four interleaved histograms of PALETTE_BINS + 1 counts each, so runs
+    // of equal pixels don't serialize on one counter
+    void (*countPaletteBins)(const uint32_t* pixels, int count, uint32_t* bins);
+};
+
+// Scalar reference. Integer division by 255 rounds the way the vector versions'
+// multiply-high does: floor for premultiply, to nearest for blending and masking.
+inline uint32_t BlendOverPixel(uint32_t src, uint32_t dst) {
+    uint32_t inv = 255 - (src >> 24);
+    if (inv == 0) return src;
+    uint32_t out = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        uint32_t s = (src >> shift) & 0xFF;
+        uint32_t d = (dst >> shift) & 0xFF;
+        uint32_t c = s + (d * inv + 127) / 255;
+        out |= (c > 255 ? 255 : c) << shift;
+    }
+    return out;
+}
+
+void PremultiplyScalar(uint32_t* pixels, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        uint32_t p = pixels[i];
+        uint32_t a = p >> 24;
+        if (a == 255) continue;
+        uint32_t r = ((p >> 16) & 0xFF) * a / 255;
+        uint32_t g = ((p >> 8) & 0xFF) * a / 255;
+        uint32_t b = (p & 0xFF) * a / 255;
+        pixels[i] = (a << 24) | (r << 16) | (g << 8) | b;
+    }
+}
+
+void UnpremultiplyScalar(uint32_t* pixels, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        uint32_t p = pixels[i];
+        uint32_t a = p >> 24;
+        if (a == 255) continue;
+        if (a == 0) {
+            pixels[i] = 0;
+            continue;
+        }
+        float scale = 255.0f / (float)a;
+        uint32_t out = a << 24;
+        for (int shift = 0; shift < 24; shift += 8) {
+            float c = (float)((p >> shift) & 0xFF) * scale + 0.5f;
+            out |= (c >= 255.0f ? 255 : (uint32_t)c) << shift;
+        }
+        pixels[i] = out;
+    }
+}
+
+void BlendOverScalar(uint32_t* dst, const uint32_t* src, size_t count) {
+    for (size_t i = 0; i < count; i++) dst[i] = BlendOverPixel(src[i], dst[i]);
+}
+
+void ApplyMaskScalar(uint32_t* pixels, const uint8_t* mask, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        uint32_t m = mask[i];
+        if (m == 255) continue;
+        uint32_t p = pixels[i], out = 0;
+        for (int shift = 0; shift < 32; shift += 8) {
+            out |= (((p >> shift) & 0xFF) * m + 127) / 255 << shift;
+        }
+        pixels[i] = out;
+    }
+}
+
+void ResampleRowsScalar(const uint32_t* src, int srcWidth, int rows, const ResampleTaps& taps, float* out, int width) {
+    for (int y = 0; y < rows; y++) {
+        const uint32_t* srcRow = src + (size_t)y * srcWidth;
+        float* outRow = out + (size_t)y * width * 4;
+        size_t w = 0;
+        for (int x = 0; x < width; x++) {
+            float acc[4] = {0, 0, 0, 0};
+            for (int i = 0; i < taps.count[x]; i++) {
+                uint32_t p = srcRow[taps.first[x] + i];
+                float weight = taps.weights[w++];
+                for (int c = 0; c < 4; c++) acc[c] += (float)((p >> (c * 8)) & 0xFF) * weight;
+            }
+            memcpy(outRow + x * 4, acc, sizeof(acc));
+        }
+    }
+}
+
+void ResampleColumnScalar(const float* rows, int width, int count, const float* weights, uint32_t* dst) {
+    for (int x = 0; x < width; x++) {
+        float acc[4] = {0, 0, 0, 0};
+        for (int i = 0; i < count; i++) {
+            const float* in = rows + ((size_t)i * width + x) * 4;
+            for (int c = 0; c < 4; c++) acc[c] += in[c] * weights[i];
+        }
+        uint32_t channels[4];
+        for (int c = 0; c < 4; c++) {
+            float v = acc[c] + 0.5f;
+            channels[c] = v <= 0.0f ? 0 : (v >= 255.0f ? 255 : (uint32_t)v);
+        }
+        // Rounding must not leave a color channel above alpha in premultiplied data
+        for (int c = 0; c < 3; c++) if (channels[c] > channels[3]) channels[c] = channels[3];
+        dst[x] = (channels[3] << 24) | (channels[2] << 16) | (channels[1] << 8) | channels[0];
+    }
+}
+
+// Columns from 'x' on
+void BoxBlurColumnsFromScalar(const uint32_t* src, uint32_t* dst, int width, int height, int radius, int x) {
+    uint32_t mul = (65536 + 2 * radius) / (2 * radius + 1);
+    for (; x < width; x++) {
+        uint32_t sum[4] = {0, 0, 0, 0};
+        for (int i = -radius; i <= radius; i++) {
+            uint32_t p = src[(size_t)min(max(i, 0), height - 1) * width + x];
+            for (int c = 0; c < 4; c++) sum[c] += (p >> (c * 8)) & 0xFF;
+        }
+        for (int y = 0; y < height; y++) {
+            uint32_t out = 0;
+            for (int c = 0; c < 4; c++) out |= (sum[c] * mul >> 16) << (c * 8);
+            dst[(size_t)y * width + x] = out;
+            uint32_t in = src[(size_t)min(y + radius + 1, height - 1) * width + x];
+            uint32_t leaving = src[(size_t)max(y - radius, 0) * width + x];
+            for (int c = 0; c < 4; c++) sum[c] += ((in >> (c * 8)) & 0xFF) - ((leaving >> (c * 8)) & 0xFF);
+        }
+    }
+}
+
+void BoxBlurColumnsScalar(const uint32_t* src, uint32_t* dst, int width, int height, int radius) {
+    BoxBlurColumnsFromScalar(src, dst, width, height, radius, 0);
+}
+
+inline uint32_t PaletteBin(uint32_t p) {
+    uint32_t bin = ((p >> 12) & 0xF00) | ((p >> 8) & 0xF0) | ((p >> 4) & 0xF);
+    return (p >> 24) > 127 ? bin : PALETTE_BINS;
+}
+
+void CountPaletteBinsScalar(const uint32_t* pixels, int count, uint32_t* bins) {
+    const int stride = PALETTE_BINS + 1;
+    for (int i = 0; i < count; i++) bins[stride * (i & 3) + PaletteBin(pixels[i])]++;
+}
+
+#if IMAGE_KERNELS_SIMD
+// x / 255 rounded down, for 16-bit lanes holding at most 65152
+inline __m128i Div255Sse2(__m128i x) {
+    return _mm_mulhi_epu16(_mm_add_epi16(x, _mm_set1_epi16(1)), _mm_set1_epi16(257));
+}
+
+// Four pixels' alpha copied into every byte of their own lane
+inline __m128i SplatAlphaSse2(__m128i p) {
+    __m128i a = _mm_srli_epi32(p, 24);
+    a = _mm_or_si128(a, _mm_slli_epi32(a, 8));
+    return _mm_or_si128(a, _mm_slli_epi32(a, 16));
+}
+
+// Each channel times 'm' (a 16-bit lane per channel), divided by 255 rounded to nearest
+inline __m128i ScaleChannelsSse2(__m128i p16, __m128i m16) {
+    return Div255Sse2(_mm_add_epi16(_mm_mullo_epi16(p16, m16), _mm_set1_epi16(127)));
+}
+
+void PremultiplySse2(uint32_t* pixels, size_t count) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alphaMask = _mm_set1_epi32((int)0xFF000000);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i p = _mm_loadu_si128((const __m128i*)(pixels + i));
+        __m128i lo = _mm_unpacklo_epi8(p, zero);
+        __m128i hi = _mm_unpackhi_epi8(p, zero);
+        __m128i alo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+        __m128i ahi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+        lo = Div255Sse2(_mm_mullo_epi16(lo, alo));
+        hi = Div255Sse2(_mm_mullo_epi16(hi, ahi));
+        __m128i out = _mm_packus_epi16(lo, hi);
+        out = _mm_or_si128(_mm_andnot_si128(alphaMask, out), _mm_and_si128(alphaMask, p));
+        _mm_storeu_si128((__m128i*)(pixels + i), out);
+    }
+    PremultiplyScalar(pixels + i, count - i);
+}
+
+void UnpremultiplySse2(uint32_t* pixels, size_t count) {
+    const __m128i byteMask = _mm_set1_epi32(0xFF);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 maxChannel = _mm_set1_ps(255.0f);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i p = _mm_loadu_si128((const __m128i*)(pixels + i));
+        __m128i a = _mm_srli_epi32(p, 24);
+        // Zero alpha divides by zero; those lanes are masked to 0 below
+        __m128 scale = _mm_div_ps(maxChannel, _mm_cvtepi32_ps(a));
+        __m128i out = _mm_slli_epi32(a, 24);
+        for (int shift = 0; shift < 24; shift += 8) {
+            __m128 c = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(p, shift), byteMask));
+            c = _mm_min_ps(_mm_add_ps(_mm_mul_ps(c, scale), half), maxChannel);
+            out = _mm_or_si128(out, _mm_slli_epi32(_mm_cvttps_epi32(c), shift));
+        }
+        __m128i opaque = _mm_cmpeq_epi32(a, byteMask);
+        __m128i empty = _mm_cmpeq_epi32(a, _mm_setzero_si128());
+        out = _mm_or_si128(_mm_and_si128(opaque, p), _mm_andnot_si128(opaque, out));
+        out = _mm_andnot_si128(empty, out);
+        _mm_storeu_si128((__m128i*)(pixels + i), out);
+    }
+    UnpremultiplyScalar(pixels + i, count - i);
+}
+
+void BlendOverSse2(uint32_t* dst, const uint32_t* src, size_t count) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi8((char)0xFF);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        __m128i inv = _mm_xor_si128(SplatAlphaSse2(s), ones);
+        __m128i lo = ScaleChannelsSse2(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(inv, zero));
+        __m128i hi = ScaleChannelsSse2(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(inv, zero));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_adds_epu8(s, _mm_packus_epi16(lo, hi)));
+    }
+    BlendOverScalar(dst + i, src + i, count - i);
+}
+
+void ApplyMaskSse2(uint32_t* pixels, const uint8_t* mask, size_t count) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        uint32_t m4;
+        memcpy(&m4, mask + i, 4);
+        if (m4 == 0xFFFFFFFF) continue;
+        __m128i p = _mm_loadu_si128((const __m128i*)(pixels + i));
+        // Each coverage byte repeated across its pixel's four channels
+        __m128i m = _mm_cvtsi32_si128((int)m4);
+        m = _mm_unpacklo_epi8(m, m);
+        m = _mm_unpacklo_epi16(m, m);
+        __m128i lo = ScaleChannelsSse2(_mm_unpacklo_epi8(p, zero), _mm_unpacklo_epi8(m, zero));
+        __m128i hi = ScaleChannelsSse2(_mm_unpackhi_epi8(p, zero), _mm_unpackhi_epi8(m, zero));
+        _mm_storeu_si128((__m128i*)(pixels + i), _mm_packus_epi16(lo, hi));
+    }
+    ApplyMaskScalar(pixels + i, mask + i, count - i);
+}
+
+// One pixel's four channels as floats
+inline __m128 PixelToFloatsSse2(uint32_t p) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i v = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)p), zero);
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero));
+}
+
+void ResampleRowsSse2(const uint32_t* src, int srcWidth, int rows, const ResampleTaps& taps, float* out, int width) {
+    for (int y = 0; y < rows; y++) {
+        const uint32_t* srcRow = src + (size_t)y * srcWidth;
+        float* outRow = out + (size_t)y * width * 4;
+        size_t w = 0;
+        for (int x = 0; x < width; x++) {
+            __m128 acc = _mm_setzero_ps();
+            const uint32_t* p = srcRow + taps.first[x];
+            for (int i = 0; i < taps.count[x]; i++) {
+                acc = _mm_add_ps(acc, _mm_mul_ps(PixelToFloatsSse2(p[i]), _mm_set1_ps(taps.weights[w++])));
+            }
+            _mm_storeu_ps(outRow + x * 4, acc);
+        }
+    }
+}
+
+// Rounds, clamps and packs four pixels' worth of float channels, keeping colour <= alpha
+inline __m128i PackPixelsSse2(__m128 c0, __m128 c1, __m128 c2, __m128 c3) {
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 maxChannel = _mm_set1_ps(255.0f);
+    __m128i i0 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_add_ps(c0, half), zero), maxChannel));
+    __m128i i1 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_add_ps(c1, half), zero), maxChannel));
+    __m128i i2 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_add_ps(c2, half), zero), maxChannel));
+    __m128i i3 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_add_ps(c3, half), zero), maxChannel));
+    __m128i p = _mm_packus_epi16(_mm_packs_epi32(i0, i1), _mm_packs_epi32(i2, i3));
+    return _mm_min_epu8(p, SplatAlphaSse2(p));
+}
+
+// Output columns from 'x' on
+void ResampleColumnFromSse2(const float* rows, int width, int count, const float* weights, uint32_t* dst, int x) {
+    for (; x + 4 <= width; x += 4) {
+        __m128 acc[4] = { _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps() };
+        for (int i = 0; i < count; i++) {
+            const float* in = rows + ((size_t)i * width + x) * 4;
+            __m128 weight = _mm_set1_ps(weights[i]);
+            for (int k = 0; k < 4; k++) acc[k] = _mm_add_ps(acc[k], _mm_mul_ps(_mm_loadu_ps(in + k * 4), weight));
+        }
+        _mm_storeu_si128((__m128i*)(dst + x), PackPixelsSse2(acc[0], acc[1], acc[2], acc[3]));
+    }
+    // The rest one pixel at a time
+    for (; x < width; x++) {
+        __m128 acc = _mm_setzero_ps();
+        for (int i = 0; i < count; i++) {
+            acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(rows + ((size_t)i * width + x) * 4), _mm_set1_ps(weights[i])));
+        }
+        dst[x] = (uint32_t)_mm_cvtsi128_si32(PackPixelsSse2(acc, acc, acc, acc));
+    }
+}
+
+void ResampleColumnSse2(const float* rows, int width, int count, const float* weights, uint32_t* dst) {
+    ResampleColumnFromSse2(rows, width, count, weights, dst, 0);
+}
+
+// Four columns at a time, one 16-bit lane per channel; columns from 'x' on
+void BoxBlurColumnsFromSse2(const uint32_t* src, uint32_t* dst, int width, int height, int radius, int x) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mul = _mm_set1_epi16((short)((65536 + 2 * radius) / (2 * radius + 1)));
+    for (; x + 4 <= width; x += 4) {
+        __m128i sumLo = zero, sumHi = zero;
+        for (int i = -radius; i <= radius; i++) {
+            __m128i p = _mm_loadu_si128((const __m128i*)(src + (size_t)min(max(i, 0), height - 1) * width + x));
+            sumLo = _mm_add_epi16(sumLo, _mm_unpacklo_epi8(p, zero));
+            sumHi = _mm_add_epi16(sumHi, _mm_unpackhi_epi8(p, zero));
+        }
+        for (int y = 0; y < height; y++) {
+            __m128i out = _mm_packus_epi16(_mm_mulhi_epu16(sumLo, mul), _mm_mulhi_epu16(sumHi, mul));
+            _mm_storeu_si128((__m128i*)(dst + (size_t)y * width + x), out);
+            __m128i in = _mm_loadu_si128((const __m128i*)(src + (size_t)min(y + radius + 1, height - 1) * width + x));
+            __m128i leaving = _mm_loadu_si128((const __m128i*)(src + (size_t)max(y - radius, 0) * width + x));
+            sumLo = _mm_sub_epi16(_mm_add_epi16(sumLo, _mm_unpacklo_epi8(in, zero)), _mm_unpacklo_epi8(leaving, zero));
+            sumHi = _mm_sub_epi16(_mm_add_epi16(sumHi, _mm_unpackhi_epi8(in, zero)), _mm_unpackhi_epi8(leaving, zero));
+        }
+    }
+    BoxBlurColumnsFromScalar(src, dst, width, height, radius, x);
+}
+
+void BoxBlurColumnsSse2(const uint32_t* src, uint32_t* dst, int width, int height, int radius) {
+    BoxBlurColumnsFromSse2(src, dst, width, height, radius, 0);
+}
+
+// SSE2 computes four bin indices at once; the increments themselves stay scalar
+void CountPaletteBinsSse2(const uint32_t* pixels, int count, uint32_t* bins) {
+    const int stride = PALETTE_BINS + 1;
+    const __m128i maskR = _mm_set1_epi32(0xF00);
+    const __m128i maskG = _mm_set1_epi32(0xF0);
+    const __m128i maskB = _mm_set1_epi32(0xF);
+    const __m128i halfAlpha = _mm_set1_epi32(127);
+    const __m128i skipBin = _mm_set1_epi32(PALETTE_BINS);
+    alignas(16) uint32_t index[4];
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i p = _mm_loadu_si128((const __m128i*)(pixels + i));
+        __m128i bin = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(p, 12), maskR),
+                                                _mm_and_si128(_mm_srli_epi32(p, 8), maskG)),
+                                   _mm_and_si128(_mm_srli_epi32(p, 4), maskB));
+        __m128i opaque = _mm_cmpgt_epi32(_mm_srli_epi32(p, 24), halfAlpha);
+        bin = _mm_or_si128(_mm_and_si128(opaque, bin), _mm_andnot_si128(opaque, skipBin));
+        _mm_store_si128((__m128i*)index, bin);
+        bins[index[0]]++;
+        bins[stride + index[1]]++;
+        bins[stride * 2 + index[2]]++;
+        bins[stride * 3 + index[3]]++;
+    }
+    for (; i < count; i++) bins[stride * (i & 3) + PaletteBin(pixels[i])]++;
+}
+
+// AVX2 versions: the same steps eight pixels at a time. Byte and word unpacks work within
+// each 128-bit half, so pixel order survives the pack back.
+KERNEL_AVX2 inline __m256i Div255Avx2(__m256i x) {
+    return _mm256_mulhi_epu16(_mm256_add_epi16(x, _mm256_set1_epi16(1)), _mm256_set1_epi16(257));
+}
+
+KERNEL_AVX2 inline __m256i SplatAlphaAvx2(__m256i p) {
+    const __m256i spread = _mm256_setr_epi8(3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15,
+                                            3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15);
+    return _mm256_shuffle_epi8(p, spread);
+}
+
+KERNEL_AVX2 inline __m256i ScaleChannelsAvx2(__m256i p16, __m256i m16) {
+    return Div255Avx2(_mm256_add_epi16(_mm256_mullo_epi16(p16, m16), _mm256_set1_epi16(127)));
+}
+
+KERNEL_AVX2 void PremultiplyAvx2(uint32_t* pixels, size_t count) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i alphaMask = _mm256_set1_epi32((int)0xFF000000);
+    const __m256i spread = _mm256_setr_epi8(6, 7, 6, 7, 6, 7, 6, 7, 14, 15, 14, 15, 14, 15, 14, 15,
+                                            6, 7, 6, 7, 6, 7, 6, 7, 14, 15, 14, 15, 14, 15, 14, 15);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i p = _mm256_loadu_si256((const __m256i*)(pixels + i));
+        __m256i lo = _mm256_unpacklo_epi8(p, zero);
+        __m256i hi = _mm256_unpackhi_epi8(p, zero);
+        lo = Div255Avx2(_mm256_mullo_epi16(lo, _mm256_shuffle_epi8(lo, spread)));
+        hi = Div255Avx2(_mm256_mullo_epi16(hi, _mm256_shuffle_epi8(hi, spread)));
+        __m256i out = _mm256_packus_epi16(lo, hi);
+        out = _mm256_blendv_epi8(out, p, alphaMask);
+        _mm256_storeu_si256((__m256i*)(pixels + i), out);
+    }
+    PremultiplySse2(pixels + i, count - i);
+}
+
+KERNEL_AVX2 void UnpremultiplyAvx2(uint32_t* pixels, size_t count) {
+    const __m256i byteMask = _mm256_set1_epi32(0xFF);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 maxChannel = _mm256_set1_ps(255.0f);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i p = _mm256_loadu_si256((const __m256i*)(pixels + i));
+        __m256i a = _mm256_srli_epi32(p, 24);
+        __m256 scale = _mm256_div_ps(maxChannel, _mm256_cvtepi32_ps(a));
+        __m256i out = _mm256_slli_epi32(a, 24);
+        for (int shift = 0; shift < 24; shift += 8) {
+            __m256 c = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(p, shift), byteMask));
+            c = _mm256_min_ps(_mm256_add_ps(_mm256_mul_ps(c, scale), half), maxChannel);
+            out = _mm256_or_si256(out, _mm256_slli_epi32(_mm256_cvttps_epi32(c), shift));
+        }
+        out = _mm256_blendv_epi8(out, p, _mm256_cmpeq_epi32(a, byteMask));
+        out = _mm256_andnot_si256(_mm256_cmpeq_epi32(a, _mm256_setzero_si256()), out);
+        _mm256_storeu_si256((__m256i*)(pixels + i), out);
+    }
+    UnpremultiplySse2(pixels + i, count - i);
+}
+
+KERNEL_AVX2 void BlendOverAvx2(uint32_t* dst, const uint32_t* src, size_t count) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi8((char)0xFF);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+        __m256i inv = _mm256_xor_si256(SplatAlphaAvx2(s), ones);
+        __m256i lo = ScaleChannelsAvx2(_mm256_unpacklo_epi8(d, zero), _mm256_unpacklo_epi8(inv, zero));
+        __m256i hi = ScaleChannelsAvx2(_mm256_unpackhi_epi8(d, zero), _mm256_unpackhi_epi8(inv, zero));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_adds_epu8(s, _mm256_packus_epi16(lo, hi)));
+    }
+    BlendOverSse2(dst + i, src + i, count - i);
+}
+
+KERNEL_AVX2 void ApplyMaskAvx2(uint32_t* pixels, const uint8_t* mask, size_t count) {
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        uint64_t m8;
+        memcpy(&m8, mask + i, 8);
+        if (m8 == ~0ull) continue;
+        __m256i p = _mm256_loadu_si256((const __m256i*)(pixels + i));
+        __m256i m = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(mask + i)));
+        m = _mm256_or_si256(m, _mm256_slli_epi32(m, 8));
+        m = _mm256_or_si256(m, _mm256_slli_epi32(m, 16));
+        __m256i lo = ScaleChannelsAvx2(_mm256_unpacklo_epi8(p, zero), _mm256_unpacklo_epi8(m, zero));
+        __m256i hi = ScaleChannelsAvx2(_mm256_unpackhi_epi8(p, zero), _mm256_unpackhi_epi8(m, zero));
+        _mm256_storeu_si256((__m256i*)(pixels + i), _mm256_packus_epi16(lo, hi));
+    }
+    ApplyMaskSse2(pixels + i, mask + i, count - i);
+}
+
+// Two rows share the taps, so they are filtered together: one in each 128-bit half
+KERNEL_AVX2 void ResampleRowsAvx2(const uint32_t* src, int srcWidth, int rows, const ResampleTaps& taps, float* out, int width) {
+    int y = 0;
+    for (; y + 2 <= rows; y += 2) {
+        const uint32_t* row0 = src + (size_t)y * srcWidth;
+        const uint32_t* row1 = row0 + srcWidth;
+        float* out0 = out + (size_t)y * width * 4;
+        float* out1 = out0 + (size_t)width * 4;
+        size_t w = 0;
+        for (int x = 0; x < width; x++) {
+            __m256 acc = _mm256_setzero_ps();
+            int first = taps.first[x];
+            for (int i = 0; i < taps.count[x]; i++) {
+                __m128i pair = _mm_unpacklo_epi32(_mm_cvtsi32_si128((int)row0[first + i]), _mm_cvtsi32_si128((int)row1[first + i]));
+                __m256 v = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(pair));
+                acc = _mm256_add_ps(acc, _mm256_mul_ps(v, _mm256_set1_ps(taps.weights[w++])));
+            }
+            _mm_storeu_ps(out0 + x * 4, _mm256_castps256_ps128(acc));
+            _mm_storeu_ps(out1 + x * 4, _mm256_extractf128_ps(acc, 1));
+        }
+    }
+    if (y < rows) ResampleRowsSse2(src + (size_t)y * srcWidth, srcWidth, rows - y, taps, out + (size_t)y * width * 4, width);
+}
+
+KERNEL_AVX2 void ResampleColumnAvx2(const float* rows, int width, int count, const float* weights, uint32_t* dst) {
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m256 acc[4] = { _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps() };
+        for (int i = 0; i < count; i++) {
+            const float* in = rows + ((size_t)i * width + x) * 4;
+            __m256 weight = _mm256_set1_ps(weights[i]);
+            for (int k = 0; k < 4; k++) acc[k] = _mm256_add_ps(acc[k], _mm256_mul_ps(_mm256_loadu_ps(in + k * 8), weight));
+        }
+        // acc[k] holds pixels 2k and 2k+1; regroup them into two runs of four
+        _mm_storeu_si128((__m128i*)(dst + x),
+                         PackPixelsSse2(_mm256_castps256_ps128(acc[0]), _mm256_extractf128_ps(acc[0], 1),
+                                        _mm256_castps256_ps128(acc[1]), _mm256_extractf128_ps(acc[1], 1)));
+        _mm_storeu_si128((__m128i*)(dst + x + 4),
+                         PackPixelsSse2(_mm256_castps256_ps128(acc[2]), _mm256_extractf128_ps(acc[2], 1),
+                                        _mm256_castps256_ps128(acc[3]), _mm256_extractf128_ps(acc[3], 1)));
+    }
+    ResampleColumnFromSse2(rows, width, count, weights, dst, x);
+}
+
+KERNEL_AVX2 void BoxBlurColumnsAvx2(const uint32_t* src, uint32_t* dst, int width, int height, int radius) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i mul = _mm256_set1_epi16((short)((65536 + 2 * radius) / (2 * radius + 1)));
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m256i sumLo = zero, sumHi = zero;
+        for (int i = -radius; i <= radius; i++) {
+            __m256i p = _mm256_loadu_si256((const __m256i*)(src + (size_t)min(max(i, 0), height - 1) * width + x));
+            sumLo = _mm256_add_epi16(sumLo, _mm256_unpacklo_epi8(p, zero));
+            sumHi = _mm256_add_epi16(sumHi, _mm256_unpackhi_epi8(p, zero));
+        }
+        for (int y = 0; y < height; y++) {
+            __m256i out = _mm256_packus_epi16(_mm256_mulhi_epu16(sumLo, mul), _mm256_mulhi_epu16(sumHi, mul));
+            _mm256_storeu_si256((__m256i*)(dst + (size_t)y * width + x), out);
+            __m256i in = _mm256_loadu_si256((const __m256i*)(src + (size_t)min(y + radius + 1, height - 1) * width + x));
+            __m256i leaving = _mm256_loadu_si256((const __m256i*)(src + (size_t)max(y - radius, 0) * width + x));
+            sumLo = _mm256_sub_epi16(_mm256_add_epi16(sumLo, _mm256_unpacklo_epi8(in, zero)), _mm256_unpacklo_epi8(leaving, zero));
+            sumHi = _mm256_sub_epi16(_mm256_add_epi16(sumHi, _mm256_unpackhi_epi8(in, zero)), _mm256_unpackhi_epi8(leaving, zero));
+        }
+    }
+    BoxBlurColumnsFromSse2(src, dst, width, height, radius, x);
+}
+#endif
+
+const ImageKernels g_KernelTable[SIMD_LEVELS] = {
+    { L"scalar", PremultiplyScalar, UnpremultiplyScalar, BlendOverScalar, ApplyMaskScalar,
+      ResampleRowsScalar, ResampleColumnScalar, BoxBlurColumnsScalar, CountPaletteBinsScalar },
+#if IMAGE_KERNELS_SIMD
+    { L"sse2", PremultiplySse2, UnpremultiplySse2, BlendOverSse2, ApplyMaskSse2,
+      ResampleRowsSse2, ResampleColumnSse2, BoxBlurColumnsSse2, CountPaletteBinsSse2 },
+    // The histogram is bound by its scalar increments; wider index math measured no faster
+    { L"avx2", PremultiplyAvx2, UnpremultiplyAvx2, BlendOverAvx2, ApplyMaskAvx2,
+      ResampleRowsAvx2, ResampleColumnAvx2, BoxBlurColumnsAvx2, CountPaletteBinsSse2 },
+#endif
+};
+
+SimdLevel g_SimdLevel = SIMD_SCALAR;
+ImageKernels g_Kernels = g_KernelTable[SIMD_SCALAR];
+
+void InitImageKernels() {
+    g_SimdLevel = DetectSimdLevel();
+    g_Kernels = g_KernelTable[g_SimdLevel];
+}
+
+// --- Album Art ---
+// Covers are decoded and premultiplied once, then resampled once per display size on the
+// worker; painting only ever blits the result 1:1.
+#define ART_CORNER_RADIUS 4.0f  // Rounded like the window's own corners
+
+// Separable area resample of a premultiplied image
+ArtImage ResampleArt(const ArtImage& src, int width, int height, const ImageKernels& kernels = g_Kernels) {
+    ArtImage dst;
+    if (src.width <= 0 || src.height <= 0 || width <= 0 || height <= 0) return dst;
+    dst.width = width;
+    dst.height = height;
+    dst.pixels.resize((size_t)width * height);
+
+    ResampleTaps tapsX = BuildResampleTaps(src.width, width);
+    ResampleTaps tapsY = BuildResampleTaps(src.height, height);
+
+    // Horizontal pass into a float buffer, 4 channels per pixel
+    vector<float> rows((size_t)width * src.height * 4);
+    kernels.resampleRows(src.pixels.data(), src.width, src.height, tapsX, rows.data(), width);
+
+    // Vertical pass back to 8 bits per channel
+    size_t w = 0;
+    for (int y = 0; y < height; y++) {
+        kernels.resampleColumn(&rows[(size_t)tapsY.first[y] * width * 4], width, tapsY.count[y],
+                               &tapsY.weights[w], &dst.pixels[(size_t)y * width]);
+        w += tapsY.count[y];
+    }
+    return dst;
+}
+
+// Coverage of a width x height rectangle with rounded corners; 255 everywhere but the corners
+vector<uint8_t> BuildCornerMask(int width, int height, float radius) {
+    vector<uint8_t> mask((size_t)width * height, 255);
+    float halfW = width / 2.0f, halfH = height / 2.0f;
+    float r = min(radius, min(halfW, halfH));
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            float qx = fabsf(x + 0.5f - halfW) - (halfW - r);
+            float qy = fabsf(y + 0.5f - halfH) - (halfH - r);
+            if (qx <= 0.0f || qy <= 0.0f) continue;
+            // Signed distance from the pixel centre to the corner arc
+            float c = 0.5f - (sqrtf(qx * qx + qy * qy) - r);
+            c = c < 0.0f ? 0.0f : (c > 1.0f ? 1.0f : c);
+            mask[(size_t)y * width + x] = (uint8_t)(c * 255.0f + 0.5f);
+        }
+    }
+    return mask;
+}
+
+// The Blurred Backdrop: the cover cropped to the panel's shape, resampled to its size,
+// blurred with three box passes per axis (close to a gaussian), washed towards black or
+// white so the text stays readable, and cut to the window's rounded corners. Built once
+// per cover and panel size; painting it is a single blit.
+#define BACKDROP_BLUR_PASSES   3
+#define BACKDROP_WASH_ALPHA    0x99
+#define BACKDROP_CORNER_RADIUS 8.0f  // DWMWCP_ROUND
+
+void TransposePixels(const uint32_t* src, uint32_t* dst, int width, int height) {
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) dst[(size_t)x * height + y] = src[(size_t)y * width + x];
+    }
+}
+
+ArtImage BlurBackdrop(const ArtImage& cover, const BackdropSpec& spec, const ImageKernels& kernels = g_Kernels) {
+    int width = spec.width, height = spec.height;
+    if (cover.width <= 0 || cover.height <= 0 || width <= 0 || height <= 0) return ArtImage();
+
+    // Centre band of the cover with the panel's aspect ratio
+    int cropW = cover.width;
+    int cropH = max(1, (int)((int64_t)cover.width * height / width));
+    if (cropH > cover.height) {
+        cropH = cover.height;
+        cropW = max(1, min(cover.width, (int)((int64_t)cover.height * width / height)));
+    }
+    ArtImage crop;
+    crop.width = cropW;
+    crop.height = cropH;
+    crop.pixels.resize((size_t)cropW * cropH);
+    int left = (cover.width - cropW) / 2, top = (cover.height - cropH) / 2;
+    for (int y = 0; y < cropH; y++) {
+        memcpy(&crop.pixels[(size_t)y * cropW], &cover.pixels[(size_t)(top + y) * cover.width + left], (size_t)cropW * 4);
+    }
+    ArtImage out = ResampleArt(crop, width, height, kernels);
+
+    // Columns, then rows as the columns of the transposed image
+    int radius = min(max(height / 4, 1), 127);
+    size_t count = out.pixels.size();
+    vector<uint32_t> scratch(count), transposed(count);
+    for (int pass = 0; pass < BACKDROP_BLUR_PASSES; pass++) {
+        kernels.boxBlurColumns(out.pixels.data(), scratch.data(), width, height, radius);
+        out.pixels.swap(scratch);
+    }
+    TransposePixels(out.pixels.data(), transposed.data(), width, height);
+    for (int pass = 0; pass < BACKDROP_BLUR_PASSES; pass++) {
+        kernels.boxBlurColumns(transposed.data(), scratch.data(), height, width, radius);
+        transposed.swap(scratch);
+    }
+    TransposePixels(transposed.data(), out.pixels.data(), height, width);
+
+    // Premultiplied black or white laid over the blur
+    uint32_t wash = spec.light ? BACKDROP_WASH_ALPHA * 0x01010101u : (uint32_t)BACKDROP_WASH_ALPHA << 24;
+    fill(scratch.begin(), scratch.end(), wash);
+    kernels.blendOver(out.pixels.data(), scratch.data(), count);
+    kernels.applyMask(out.pixels.data(), BuildCornerMask(width, height, BACKDROP_CORNER_RADIUS).data(), count);
+    return out;
+}
+
+// Decodes a thumbnail into a full-resolution premultiplied image
+#ifdef MUSIC_WIDGET_HEADLESS
+bool DecodeArt(const vector<uint8_t>& bytes, ArtImage& out);  // Defined by the tests
+#else
+bool DecodeArt(const vector<uint8_t>& bytes, ArtImage& out) {
+    TraceSpan span(TRACE_LEVEL_INFO, TRACE_CAT_ART, TRACE_DECODE);
+    ScopedLatency latency(g_PerfDecode);
+    Bitmap* bmp = BytesToBitmap(bytes);
+    if (!bmp) return false;
+    int width = (int)bmp->GetWidth();
+    int height = (int)bmp->GetHeight();
+    Rect rect(0, 0, width, height);
+    BitmapData data;
+    bool ok = width > 0 && height > 0 &&
+              bmp->LockBits(&rect, ImageLockModeRead, PixelFormat32bppARGB, &data) == Ok;
+    if (ok) {
+        out.width = width;
+        out.height = height;
+        out.pixels.resize((size_t)width * height);
+        for (int y = 0; y < height; y++) {
+            memcpy(&out.pixels[(size_t)y * width], (BYTE*)data.Scan0 + (ptrdiff_t)y * data.Stride, (size_t)width * 4);
+        }
+        bmp->UnlockBits(&data);
+        g_Kernels.premultiply(out.pixels.data(), out.pixels.size());
+    }
+    delete bmp;
+    return ok;
+}
+#endif
+
+// Cover colours for the Adaptive Accent setting, computed once per decoded cover from a
+// 4-bit-per-channel histogram
+#define PALETTE_MAX_ROWS 256  // Rows sampled from taller covers
+
+uint32_t PaletteBinColor(int bin) {
+    uint32_t r = ((bin >> 8) << 4) | 8;
+    uint32_t g = (((bin >> 4) & 0xF) << 4) | 8;
+    uint32_t b = ((bin & 0xF) << 4) | 8;
+    return 0xFF000000 | (r << 16) | (g << 8) | b;
+}
+
+// Dominant: the fullest bin. Accent: the fullest bin weighted by saturation, skipping
+// near-black and grey ones; the dominant colour if the cover has no such bin.
+ArtPalette ExtractArtPalette(const ArtImage& image) {
+    ArtPalette palette;
+    if (image.width <= 0 || image.height <= 0) return palette;
+    const int stride = PALETTE_BINS + 1;
+    vector<uint32_t> bins((size_t)stride * 4);
+    vector<uint32_t> row(image.width);
+    int rowStep = (image.height + PALETTE_MAX_ROWS - 1) / PALETTE_MAX_ROWS;
+    for (int y = 0; y < image.height; y += rowStep) {
+        // Binned by straight colour, so translucent covers are not pulled towards black
+        memcpy(row.data(), &image.pixels[(size_t)y * image.width], row.size() * sizeof(uint32_t));
+        g_Kernels.unpremultiply(row.data(), row.size());
+        g_Kernels.countPaletteBins(row.data(), image.width, bins.data());
+    }
+
+    int dominant = -1;
+    int accent = -1;
+    uint32_t dominantCount = 0;
+    uint64_t accentScore = 0;
+    for (int bin = 0; bin < PALETTE_BINS; bin++) {
+        uint32_t count = bins[bin] + bins[stride + bin] + bins[stride * 2 + bin] + bins[stride * 3 + bin];
+        if (!count) continue;
+        if (count > dominantCount) {
+            dominantCount = count;
+            dominant = bin;
+        }
+        int r = bin >> 8, g = (bin >> 4) & 0xF, b = bin & 0xF;
+        int hi = max(r, max(g, b));
+        int saturation = hi - min(r, min(g, b));
+        if (hi < 4 || saturation < 3) continue;
+        uint64_t score = (uint64_t)count * saturation * saturation;
+        if (score > accentScore) {
+            accentScore = score;
+            accent = bin;
+        }
+    }
+    if (dominant < 0) return palette;
+    palette.dominant = PaletteBinColor(dominant);
+    palette.accent = PaletteBinColor(accent >= 0 ? accent : dominant);
+    return palette;
+}
+
+uint64_t HashArtBytes(const vector<uint8_t>& bytes) {
+    uint64_t hash = 14695981039346656037ull;  // FNV-1a
+    for (uint8_t b : bytes) {
+        hash ^= b;
+        hash *= 1099511628211ull;
+    }
+    return hash ? hash : 1;  // 0 means "no art"
+}
+
+// LRU of decoded covers keyed by a hash of the thumbnail bytes, so replaying a track or
+// flipping between sessions never decodes the same cover twice. A (session, title,
+// artist) key maps to the content hash and lets a hit skip reading the thumbnail at all.
+class ArtCache {
+public:
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+
+    void SetBudget(size_t bytes) {
+        m_budget = bytes;
+        Evict();
+    }
+
+    // Counts a hit or miss and marks the entry most recently used
+    bool Lookup(uint64_t hash) {
+        auto it = m_index.find(hash);
+        if (it == m_index.end()) {
+            misses++;
+            return false;
+        }
+        hits++;
+        m_entries.splice(m_entries.begin(), m_entries, it->second);
+        return true;
+    }
+
+    void Insert(uint64_t hash, shared_ptr<const ArtImage> source, const ArtPalette& palette) {
+        if (m_index.count(hash)) return;
+        m_entries.push_front({ hash, source, nullptr, palette, nullptr, BackdropSpec() });
+        m_index[hash] = m_entries.begin();
+        m_bytes += ImageBytes(source);
+        Evict();
+    }
+
+    // Display-sized copy of a cached cover with rounded corners, resampled on first use for
+    // each size
+    shared_ptr<const ArtImage> Scaled(uint64_t hash, int size) {
+        auto it = m_index.find(hash);
+        if (it == m_index.end()) return nullptr;
+        Entry& entry = *it->second;
+        if (!entry.scaled || entry.scaled->width != size) {
+            if (m_cornerMask.size() != (size_t)size * size) m_cornerMask = BuildCornerMask(size, size, ART_CORNER_RADIUS);
+            auto scaled = make_shared<ArtImage>(ResampleArt(*entry.source, size, size));
+            g_Kernels.applyMask(scaled->pixels.data(), m_cornerMask.data(), scaled->pixels.size());
+            m_bytes -= ImageBytes(entry.scaled);
+            entry.scaled = scaled;
+            m_bytes += ImageBytes(entry.scaled);
+        }
+        auto scaled = entry.scaled;
+        Evict();
+        return scaled;
+    }
+
+    // Blurred backdrop of a cached cover, rebuilt whenever the panel size or theme changes
+    shared_ptr<const ArtImage> Backdrop(uint64_t hash, const BackdropSpec& spec) {
+        if (spec.width <= 0 || spec.height <= 0) return nullptr;
+        auto it = m_index.find(hash);
+        if (it == m_index.end()) return nullptr;
+        Entry& entry = *it->second;
+        if (!entry.backdrop || !(entry.backdropSpec == spec)) {
+            auto backdrop = make_shared<ArtImage>(BlurBackdrop(*entry.source, spec));
+            m_bytes -= ImageBytes(entry.backdrop);
+            entry.backdrop = backdrop;
+            entry.backdropSpec = spec;
+            m_bytes += ImageBytes(entry.backdrop);
+        }
+        auto backdrop = entry.backdrop;
+        Evict();
+        return backdrop;
+    }
+
+    ArtPalette Palette(uint64_t hash) const {
+        auto it = m_index.find(hash);
+        return it == m_index.end() ? ArtPalette() : it->second->palette;
+    }
+
+    // Content hash last seen for a track, or 0 if unknown or evicted since
+    uint64_t FindTrack(const wstring& key) const {
+        auto it = m_tracks.find(key);
+        if (it == m_tracks.end() || !m_index.count(it->second)) return 0;
+        return it->second;
+    }
+
+    void RememberTrack(const wstring& key, uint64_t hash) {
+        if (m_tracks.size() >= 1024) m_tracks.clear();
+        m_tracks[key] = hash;
+    }
+
+    void Clear() {
+        m_entries.clear();
+        m_index.clear();
+        m_tracks.clear();
+        m_bytes = 0;
+    }
+
+private:
+    struct Entry {
+        uint64_t hash;
+        shared_ptr<const ArtImage> source;
+        shared_ptr<const ArtImage> scaled;
+        ArtPalette palette;
+        shared_ptr<const ArtImage> backdrop;
+        BackdropSpec backdropSpec;
+    };
+
+    static size_t ImageBytes(const shared_ptr<const ArtImage>& image) {
+        return image ? image->pixels.size() * sizeof(uint32_t) : 0;
+    }
+
+    // Drops least recently used covers, but always keeps the one in use
+    void Evict() {
+        while (m_bytes > m_budget && m_entries.size() > 1) {
+            Entry& victim = m_entries.back();
+            m_bytes -= ImageBytes(victim.source) + ImageBytes(victim.scaled) + ImageBytes(victim.backdrop);
+            m_index.erase(victim.hash);
+            m_entries.pop_back();
+        }
+    }
+
+    list<Entry> m_entries;  // Most recently used first
+    unordered_map<uint64_t, list<Entry>::iterator> m_index;
+    unordered_map<wstring, uint64_t> m_tracks;
+    vector<uint8_t> m_cornerMask;  // For the current display size
+    size_t m_budget = 32u << 20;
+    size_t m_bytes = 0;
+};
+
+// --- Session Table ---
+// Every open session keeps its own metadata, cover and timeline sample, refreshed by its
+// own events whether or not it is on screen, so switching sessions only picks another
+// entry. The panel follows the session Windows calls current unless one is pinned.
+struct SessionEntry {
+    MediaReading reading;
+    MediaSnapshot state;
+    uint64_t artHash = 0;  // Cache key of the cover in 'state'
+    bool artMaybeStale = false;
+    bool artMissing = false;  // The last attempt for this track found no cover
+    unsigned pending = MEDIA_CHANGE_ALL;  // Not read yet
+};
+
+class SessionTable {
+public:
+    // Adds new sessions and drops closed ones; returns true if the active session changed
+    bool Sync(const vector<wstring>& appIds, const wstring& systemCurrent) {
+        for (auto it = m_entries.begin(); it != m_entries.end();) {
+            if (find(appIds.begin(), appIds.end(), it->first) == appIds.end()) it = m_entries.erase(it);
+            else ++it;
+        }
+        for (const wstring& appId : appIds) {
+            if (!m_entries.count(appId)) m_entries[appId].state.sessionId = appId;
+        }
+        m_systemCurrent = systemCurrent;
+        if (!m_pinned.empty() && !m_entries.count(m_pinned)) m_pinned.clear();
+        return Resolve();
+    }
+
+    SessionEntry* Find(const wstring& appId) {
+        auto it = m_entries.find(appId);
+        return it == m_entries.end() ? nullptr : &it->second;
+    }
+
+    SessionEntry* Active() { return Find(m_active); }
+    const wstring& ActiveId() const { return m_active; }
+    bool IsPinned() const { return !m_pinned.empty(); }
+
+    // Pins the session after the active one; past the last, follows Windows again.
+    // Returns true if the active session changed.
+    bool Cycle() {
+        if (m_entries.empty()) return false;
+        auto it = m_entries.upper_bound(m_active);
+        if (it == m_entries.end()) {
+            // Wrapped: unpin, or start over from the first session if nothing was pinned
+            if (IsPinned()) m_pinned.clear();
+            else m_pinned = m_entries.begin()->first;
+        } else {
+            m_pinned = it->first;
+        }
+        return Resolve();
+    }
+
+    void MarkPending(const wstring& appId, unsigned changes) {
+        if (SessionEntry* entry = Find(appId)) entry->pending |= changes;
+    }
+
+    void MarkAllPending(unsigned changes) {
+        for (auto& entry : m_entries) entry.second.pending |= changes;
+    }
+
+    template <typename F>
+    void ForEach(F visit) {
+        for (auto& entry : m_entries) visit(entry.first, entry.second);
+    }
+
+    void Clear() {
+        m_entries.clear();
+        m_systemCurrent.clear();
+        m_pinned.clear();
+        m_active.clear();
+    }
+
+private:
+    bool Resolve() {
+        wstring active = m_pinned;
+        if (active.empty()) active = m_systemCurrent;
+        if (!m_entries.count(active)) active = m_entries.empty() ? wstring() : m_entries.begin()->first;
+        if (active == m_active) return false;
+        m_active = active;
+        return true;
+    }
+
+    map<wstring, SessionEntry> m_entries;  // Ordered, so cycling is stable
+    wstring m_systemCurrent;
+    wstring m_pinned;
+    wstring m_active;
+};
+
+// --- Command Queue ---
+// Transport commands and seeks run one at a time on the worker, in the order they were
+// given. Whatever piles up behind a slow round trip is merged into the last entry:
+// repeated skips in one direction run as at most COMMAND_MAX_SKIPS calls, toggles cancel
+// in pairs, and successive seeks keep only the last target. Plain standard C++ without
+// locking of its own; the owner guards it.
+#define COMMAND_SEEK              4  // Follows the HIT_PREV..HIT_NEXT command values
+#define COMMAND_MAX_SKIPS         5
+#define COMMAND_TOGGLE_TIMEOUT_MS 1500.0
+#define COMMAND_SKIP_TIMEOUT_MS   3000.0
+
+enum CommandStatus {
+    COMMAND_ACCEPTED,
+    COMMAND_REJECTED,
+    COMMAND_EXPIRED,    // Not started before its deadline
+    COMMAND_CANCELLED   // Cancelled, or toggled back before it ran
+};
+
+struct QueuedCommand {
+    int cmd = 0;
+    int count = 0;          // Commands merged into this entry
+    double seconds = 0.0;   // Seek target
+    double deadline = 0.0;  // Of the newest command merged in
+    vector<uint64_t> ids;
+    vector<function<void(CommandStatus)>> done;
+
+    // Source calls needed to carry out the whole entry
+    int Calls() const {
+        if (cmd == 2) return count % 2;
+        if (cmd == COMMAND_SEEK) return 1;
+        return min(count, COMMAND_MAX_SKIPS);
+    }
+
+    // Reports the outcome to every command merged in
+    void Complete(CommandStatus status) {
+        for (auto& callback : done) {
+            if (callback) callback(status);
+        }
+    }
+};
+
+class CommandQueue {
+public:
+    // Returns an id for Cancel()
+    uint64_t Push(int cmd, double seconds, double deadline, function<void(CommandStatus)> done) {
+        if (m_queue.empty() || m_queue.back().cmd != cmd) {
+            m_queue.push_back(QueuedCommand());
+            m_queue.back().cmd = cmd;
+        }
+        QueuedCommand& entry = m_queue.back();
+        entry.count++;
+        entry.seconds = seconds;
+        entry.deadline = deadline;
+        entry.ids.push_back(++m_lastId);
+        entry.done.push_back(move(done));
+        return m_lastId;
+    }
+
+    // The oldest entry; the caller runs and completes it. Anything pushed meanwhile
+    // starts a new entry.
+    bool Pop(QueuedCommand& out) {
+        if (m_queue.empty()) return false;
+        out = move(m_queue.front());
+        m_queue.pop_front();
+        return true;
+    }
+
+    // Takes out the entry holding 'id', together with everything merged into it
+    bool Cancel(uint64_t id, QueuedCommand& out) {
+        for (auto it = m_queue.begin(); it != m_queue.end(); ++it) {
+            if (find(it->ids.begin(), it->ids.end(), id) == it->ids.end()) continue;
+            out = move(*it);
+            m_queue.erase(it);
+            return true;
+        }
+        return false;
+    }
+
+    void TakeAll(deque<QueuedCommand>& out) {
+        out.swap(m_queue);
+        m_queue.clear();
+    }
+
+    bool Empty() const { return m_queue.empty(); }
+
+private:
+    deque<QueuedCommand> m_queue;
+    uint64_t m_lastId = 0;
+};
+
+// --- Media Worker ---
+// Owns the media source. Every WinRT call happens on this thread, so a slow or hung
+// player can only delay the next snapshot, never the window's message loop.
+class MediaWorker {
+public:
+    // Snapshots are published into 'output'
+    explicit MediaWorker(TripleBuffer<MediaSnapshot>& output) : m_output(output) {}
+
+    typedef function<shared_ptr<MediaSource>()> SourceFactory;
+
+    // publishedMsg follows every new snapshot; commandMsg carries (cmd, accepted) for
+    // each transport command once the app has answered. The worker never reads the
+    // settings itself: the art size and cache budget start here and change through Post.
+    // makeSource is called again, a second later, for as long as it fails to start.
+    void Start(HWND hwnd, UINT publishedMsg, UINT commandMsg, int artSize, size_t artBudget,
+               SourceFactory makeSource = MakeSystemMediaSource) {
+        m_makeSource = makeSource;
+        m_hwnd = hwnd;
+        m_publishedMsg = publishedMsg;
+        m_commandMsg = commandMsg;
+        m_stop = false;
+        m_listChanges = MEDIA_CHANGE_ALL;
+        m_artSize = artSize;
+        m_artCache.SetBudget(artBudget);
+        m_backdrop = BackdropSpec();
+        m_thread = thread(&MediaWorker::Run, this);
+    }
+
+    void Stop() {
+        {
+            lock_guard<mutex> guard(m_lock);
+            m_stop = true;
+        }
+        m_cv.notify_one();
+        if (m_thread.joinable()) m_thread.join();
+        m_tasks.clear();
+        m_commands = CommandQueue();
+    }
+
+    // Called from source event threads; bursts are coalesced into one read per session.
+    // An empty appId stands for the session list, and for every session at once.
+    void Notify(const wstring& appId, unsigned changes) {
+        {
+            lock_guard<mutex> guard(m_lock);
+            if (appId.empty()) m_listChanges |= changes;
+            else m_pending[appId] |= changes;
+        }
+        m_cv.notify_one();
+    }
+
+    void Post(function<void(MediaSource&)> task) {
+        {
+            lock_guard<mutex> guard(m_lock);
+            if (m_stop) return;
+            m_tasks.push_back(move(task));
+        }
+        m_cv.notify_one();
+    }
+
+    // Art is rescaled from the decoded source whenever the panel's art slot changes size
+    void SetArtSize(int size) {
+        Post([this, size](MediaSource&) {
+            if (size == m_artSize) return;
+            m_artSize = size;
+            m_sessions.ForEach([this](const wstring&, SessionEntry& entry) {
+                if (!entry.artHash) return;
+                entry.state.albumArt = m_artCache.Scaled(entry.artHash, m_artSize);
+                entry.state.artGeneration = ++m_artGeneration;
+            });
+            PublishActive();
+        });
+    }
+
+    // Follows the Art Cache setting; shrinking it evicts right away
+    void SetArtBudget(size_t bytes) {
+        Post([this, bytes](MediaSource&) { m_artCache.SetBudget(bytes); });
+    }
+
+    // Backdrops are rebuilt from the decoded source when the panel's size or theme changes;
+    // an empty spec drops them
+    void SetBackdrop(const BackdropSpec& spec) {
+        Post([this, spec](MediaSource&) {
+            if (spec == m_backdrop) return;
+            m_backdrop = spec;
+            m_sessions.ForEach([this](const wstring&, SessionEntry& entry) {
+                entry.state.backdrop = entry.artHash ? m_artCache.Backdrop(entry.artHash, m_backdrop) : nullptr;
+            });
+            PublishActive();
+        });
+    }
+
+    // Runs one update on the calling thread. Only for a worker that is never started;
+    // the benchmark drives the pipeline this way.
+    void Apply(MediaSource& source, unsigned changes, int artSize) {
+        m_artSize = artSize;
+        if (changes & MEDIA_CHANGE_SESSION) SyncSessions(source);
+        m_sessions.MarkAllPending(changes);
+        UpdatePending(source, changes & MEDIA_CHANGE_SESSION);
+    }
+
+    // Queues a transport command for the active session; the window gets commandMsg
+    // once it has run or been dropped. Returns an id for CancelCommand().
+    uint64_t Command(int cmd) {
+        double timeout = cmd == 2 ? COMMAND_TOGGLE_TIMEOUT_MS : COMMAND_SKIP_TIMEOUT_MS;
+        return Enqueue(cmd, 0.0, timeout, Reporter(cmd));
+    }
+
+    // Reported to the window as COMMAND_SEEK
+    uint64_t Seek(double seconds) {
+        return Enqueue(COMMAND_SEEK, seconds, COMMAND_SKIP_TIMEOUT_MS, Reporter(COMMAND_SEEK));
+    }
+
+    // Drops a command that has not started yet
+    void CancelCommand(uint64_t id) {
+        QueuedCommand command;
+        bool found;
+        {
+            lock_guard<mutex> guard(m_lock);
+            found = m_commands.Cancel(id, command);
+        }
+        if (found) command.Complete(COMMAND_CANCELLED);
+    }
+
+    // Pins the next session, or goes back to following Windows after the last one.
+    // Queued commands were meant for the old session and are dropped.
+    void CycleSession() {
+        deque<QueuedCommand> dropped;
+        {
+            lock_guard<mutex> guard(m_lock);
+            m_commands.TakeAll(dropped);
+        }
+        for (auto& command : dropped) command.Complete(COMMAND_CANCELLED);
+        Post([this](MediaSource&) {
+            if (m_sessions.Cycle()) PublishActive();
+        });
+    }
+
+private:
+    void Run() {
+        winrt::init_apartment();
+        shared_ptr<MediaSource> source;
+        bool attached = false;  // Publish the first pass even if no session is open
+        unique_lock<mutex> lock(m_lock);
+        while (!m_stop) {
+            if (!source) {
+                lock.unlock();
+                shared_ptr<MediaSource> candidate = m_makeSource();
+                if (candidate && candidate->Start([this](const wstring& appId, unsigned changes) { Notify(appId, changes); })) {
+                    source = move(candidate);
+                }
+                lock.lock();
+                if (!source) {
+                    // Source not available yet, retry shortly
+                    m_cv.wait_for(lock, chrono::seconds(1), [this] { return m_stop; });
+                    continue;
+                }
+                m_listChanges |= MEDIA_CHANGE_ALL;
+                attached = true;
+            }
+
+            m_cv.wait(lock, [this] {
+                return m_stop || m_listChanges != 0 || !m_pending.empty() || !m_tasks.empty() || !m_commands.Empty();
+            });
+            if (m_stop) break;
+            unsigned listChanges = m_listChanges;
+            m_listChanges = 0;
+            unordered_map<wstring, unsigned> pending;
+            pending.swap(m_pending);
+            deque<function<void(MediaSource&)>> tasks;
+            tasks.swap(m_tasks);
+            lock.unlock();
+
+            for (auto& task : tasks) {
+                try {
+                    task(*source);
+                } catch (...) {}
+            }
+            bool ranCommands = RunCommands(*source);
+            bool activeChanged = false;
+            if (listChanges) {
+                activeChanged = SyncSessions(*source);
+                m_sessions.MarkAllPending(listChanges & ~MEDIA_CHANGE_SESSION);
+            }
+            for (auto& entry : pending) m_sessions.MarkPending(entry.first, entry.second);
+            bool published = UpdatePending(*source, activeChanged || attached);
+            attached = false;
+            if (published || ranCommands || !tasks.empty()) PostMessage(m_hwnd, m_publishedMsg, 0, 0);
+
+            lock.lock();
+        }
+        lock.unlock();
+
+        if (source) {
+            // A handler still running keeps its own reference until it returns
+            source->Stop();
+            source.reset();
+        }
+        m_state = MediaSnapshot();
+        m_sessions.Clear();
+        m_artCache.Clear();
+        winrt::uninit_apartment();
+    }
+
+    function<void(CommandStatus)> Reporter(int cmd) {
+        return [this, cmd](CommandStatus status) {
+            if (m_hwnd) PostMessage(m_hwnd, m_commandMsg, (WPARAM)cmd, status == COMMAND_ACCEPTED);
+        };
+    }
+
+    uint64_t Enqueue(int cmd, double seconds, double timeout, function<void(CommandStatus)> done) {
+        uint64_t id;
+        {
+            lock_guard<mutex> guard(m_lock);
+            if (m_stop) return 0;
+            id = m_commands.Push(cmd, seconds, g_SystemClock.Now() + timeout, move(done));
+        }
+        m_cv.notify_one();
+        return id;
+    }
+
+    // Runs queued commands until none are left; those given meanwhile merge behind the
+    // one in flight. Returns true if any ran.
+    bool RunCommands(MediaSource& source) {
+        bool ran = false;
+        QueuedCommand command;
+        for (;;) {
+            {
+                lock_guard<mutex> guard(m_lock);
+                if (!m_commands.Pop(command)) break;
+            }
+            ran = true;
+            command.Complete(RunCommand(source, command));
+        }
+        return ran;
+    }
+
+    CommandStatus RunCommand(MediaSource& source, const QueuedCommand& command) {
+        if (g_SystemClock.Now() > command.deadline) return COMMAND_EXPIRED;
+        int calls = command.Calls();
+        if (calls == 0) return COMMAND_CANCELLED;
+        wstring appId = m_sessions.ActiveId();
+        SessionEntry* entry = m_sessions.Active();
+        if (!entry) return COMMAND_REJECTED;
+        bool accepted = true;
+        try {
+            if (command.cmd == COMMAND_SEEK) {
+                accepted = source.Seek(appId, command.seconds);
+            } else {
+                // Awaited one by one so the app sees them in order
+                for (int i = 0; i < calls && accepted; i++) accepted = source.SendCommand(appId, command.cmd);
+            }
+        } catch (...) {
+            accepted = false;
+        }
+        if (!accepted) return COMMAND_REJECTED;
+
+        if (command.cmd == COMMAND_SEEK) {
+            // Published right away, flagged as ours; only the app's timeline confirms it
+            entry->state.position = command.seconds;
+            entry->state.positionStamp = g_SystemClock.Now();
+            entry->state.positionEstimated = true;
+            PublishActive();
+        } else {
+            // Re-read in this same pass rather than waiting for the app's change events
+            entry->pending |= MEDIA_CHANGE_PROPERTIES | MEDIA_CHANGE_PLAYBACK | MEDIA_CHANGE_TIMELINE;
+        }
+        return COMMAND_ACCEPTED;
+    }
+
+    // Returns true if the active session changed
+    bool SyncSessions(MediaSource& source) {
+        vector<wstring> appIds;
+        wstring current;
+        try {
+            source.ListSessions(appIds, current);
+        } catch (...) {
+            appIds.clear();
+        }
+        return m_sessions.Sync(appIds, current);
+    }
+
+    // Reads every session with pending changes and publishes the active one if it changed.
+    // Returns true if something was published.
+    bool UpdatePending(MediaSource& source, bool activeChanged) {
+        TraceSpan span(TRACE_LEVEL_INFO, TRACE_CAT_MEDIA, TRACE_POLL);
+        bool activeUpdated = false;
+        // Switching to a session whose cover was missing gives it one more try, unless
+        // its properties are about to be read anyway
+        SessionEntry* active = m_sessions.Active();
+        if (activeChanged && active && active->artMissing && !(active->pending & MEDIA_CHANGE_PROPERTIES)) {
+            LoadArt(source, m_sessions.ActiveId(), *active, active->reading);
+        }
+        vector<wstring> closed;
+        m_sessions.ForEach([&](const wstring& appId, SessionEntry& entry) {
+            if (!entry.pending) return;
+            unsigned changes = entry.pending;
+            entry.pending = 0;
+            if (!UpdateSession(source, appId, entry, changes)) closed.push_back(appId);
+            if (appId == m_sessions.ActiveId()) activeUpdated = true;
+        });
+        // Gone before the list event arrived; resync so it drops out of the table
+        if (!closed.empty()) activeChanged |= SyncSessions(source);
+        if (!activeChanged && !activeUpdated) return false;
+        PublishActive();
+        return true;
+    }
+
+    // Applies one batch of change notifications to a session; only the parts named in
+    // 'changes' are re-read. Returns false if the session has gone away.
+    bool UpdateSession(MediaSource& source, const wstring& appId, SessionEntry& entry, unsigned changes) {
+        MediaSnapshot& state = entry.state;
+        try {
+            MediaReading reading = entry.reading;
+            if (!source.Read(appId, changes, reading)) return false;
+            entry.reading = reading;
+
+            // A new track loads its cover. A track without one, or with one that may be the
+            // previous track's, is looked at again only when its properties change, not on
+            // every playback or timeline event.
+            bool trackChanged = reading.title != state.title || reading.artist != state.artist;
+            bool retryArt = (changes & MEDIA_CHANGE_PROPERTIES) && (entry.artMaybeStale || entry.artMissing);
+            if (trackChanged || retryArt) LoadArt(source, appId, entry, reading);
+
+            state.title = reading.title;
+            state.artist = reading.artist;
+            state.isPlaying = reading.isPlaying;
+            state.hasMedia = true;
+            state.isSpotify = reading.hasTimeline;
+            state.controls = reading.controls;
+            state.duration = reading.duration;
+            // A seek's estimate stands until the app's timeline is read again
+            bool timelineRead = (changes & (MEDIA_CHANGE_SESSION | MEDIA_CHANGE_TIMELINE | MEDIA_CHANGE_PLAYBACK)) != 0;
+            if (timelineRead || !state.positionEstimated) {
+                state.position = reading.position;
+                // Timeline events are sparse; the UI's TimelineModel extrapolates from this sample
+                state.positionStamp = reading.positionStamp;
+                state.playbackRate = reading.playbackRate;
+                state.positionEstimated = false;
+            }
+        } catch (...) {
+            state.hasMedia = false;
+            state.isSpotify = false;
+            state.position = 0.0;
+            state.duration = 0.0;
+        }
+        return true;
+    }
+
+    // Looks up, or reads and decodes, the cover for the track in 'reading'
+    void LoadArt(MediaSource& source, const wstring& appId, SessionEntry& entry, const MediaReading& reading) {
+        MediaSnapshot& state = entry.state;
+        uint64_t previousHash = entry.artHash;
+        state.albumArt.reset();
+        state.artGeneration = ++m_artGeneration;
+        state.artPalette = ArtPalette();
+        state.backdrop.reset();
+        entry.artHash = 0;
+        entry.artMaybeStale = false;
+        entry.artMissing = true;
+        try {
+            wstring trackKey = appId + L"\n" + reading.title + L"\n" + reading.artist;
+            uint64_t hash = m_artCache.FindTrack(trackKey);
+            if (!hash || !m_artCache.Lookup(hash)) {
+                hash = 0;
+                vector<uint8_t> bytes;
+                if (source.ReadThumbnail(appId, bytes)) {
+                    hash = HashArtBytes(bytes);
+                    if (!m_artCache.Lookup(hash)) {
+                        auto decoded = make_shared<ArtImage>();
+                        if (DecodeArt(bytes, *decoded)) m_artCache.Insert(hash, decoded, ExtractArtPalette(*decoded));
+                        else hash = 0;
+                    }
+                    // Players can still report the previous cover right after a track
+                    // change; don't pin that one to the new track, and look again on
+                    // the next properties event
+                    if (hash && hash != previousHash) m_artCache.RememberTrack(trackKey, hash);
+                    else if (hash) entry.artMaybeStale = true;
+                } else {
+                    TRACE(TRACE_LEVEL_INFO, TRACE_CAT_ART, TRACE_ART_MISSING, 0, 0);
+                }
+            }
+            if (hash) {
+                entry.artHash = hash;
+                entry.artMissing = false;
+                state.albumArt = m_artCache.Scaled(hash, m_artSize);
+                state.artGeneration = ++m_artGeneration;
+                state.artPalette = m_artCache.Palette(hash);
+                state.backdrop = m_artCache.Backdrop(hash, m_backdrop);
+            }
+            TRACE(TRACE_LEVEL_DEBUG, TRACE_CAT_ART, TRACE_ART_CACHE, m_artCache.hits, m_artCache.misses);
+            g_PerfArtHits.store(m_artCache.hits, memory_order_relaxed);
+            g_PerfArtMisses.store(m_artCache.misses, memory_order_relaxed);
+        } catch (...) {
+            TRACE(TRACE_LEVEL_ERROR, TRACE_CAT_ART, TRACE_ART_ERROR, -1, 0);
+        }
+    }
+
+    // Publishes the active session's state as it stands; switching never re-reads anything
+    void PublishActive() {
+        uint64_t version = m_state.version;
+        if (SessionEntry* entry = m_sessions.Active()) {
+            m_state = entry->state;
+            m_state.sessionPinned = m_sessions.IsPinned();
+        } else {
+            m_state = MediaSnapshot();
+            m_state.title = L"No Media";
+        }
+        m_state.version = version + 1;
+        m_output.Publish(m_state);
+    }
+
+    TripleBuffer<MediaSnapshot>& m_output;
+    SourceFactory m_makeSource;
+    HWND m_hwnd = NULL;
+    UINT m_publishedMsg = 0;
+    UINT m_commandMsg = 0;
+    thread m_thread;
+    mutex m_lock;
+    condition_variable m_cv;
+    bool m_stop = false;
+    unsigned m_listChanges = 0;
+    unordered_map<wstring, unsigned> m_pending;
+    deque<function<void(MediaSource&)>> m_tasks;
+    CommandQueue m_commands;
+    // Worker-thread only
+    MediaSnapshot m_state;  // Last published
+    SessionTable m_sessions;
+    ArtCache m_artCache;
+    int m_artSize = 0;
+    uint64_t m_artGeneration = 0;
+    BackdropSpec m_backdrop;
+} g_MediaWorker(g_MediaSnapshots);
+
+size_t ArtCacheBudget() {
+    return (size_t)g_Settings.artCacheMB << 20;
+}
+
+uint64_t SendMediaCommand(int cmd) {
+    return g_MediaWorker.Command(cmd);
+}
+
+// --- Visuals ---
+// The theme is read from the registry once, then again only when it may have changed:
+// on WM_SETTINGCHANGE and when the watch on the Personalize key fires. Every colour the
+// panel draws with is derived from it into g_Palette at the same time, not per frame.
+#ifndef MUSIC_WIDGET_HEADLESS
+#define PERSONALIZE_KEY L"Software\\Microsoft\\Windows\\CurrentVersion\\Themes\\Personalize"
+
+bool ReadSystemLightMode() {
+    DWORD value = 0; DWORD size = sizeof(value);
+    if (RegGetValueW(HKEY_CURRENT_USER, PERSONALIZE_KEY, L"SystemUsesLightTheme", RRF_RT_DWORD, nullptr, &value, &size) == ERROR_SUCCESS) {
+        return value != 0;
+    }
+    return false;
+}
+#endif
+
+// ARGB colours for one theme and settings combination
+struct ThemePalette {
+    uint32_t text = 0xFFFFFFFF;  // Title and icons; also keys the scene
+    uint32_t textFaded;          // Title while a skip is outstanding
+    uint32_t hover;              // Hovered icon
+    uint32_t activeBg;           // Circle behind the hovered icon
+    uint32_t disabled;           // Icon of a control the app does not accept
+    uint32_t note;               // Music icon in the tab zone
+    uint32_t artPlaceholder;
+    uint32_t barBg, barFg, barBorder;
+    uint32_t thumb, thumbBorder;
+    uint32_t tint;          // Acrylic tint, ARGB like every other colour here
+    uint32_t acrylicTint;   // The same tint as AABBGGRR, the order ACCENT_POLICY.GradientColor takes
+    uint32_t layeredClear;  // Per-pixel mode background: the tint, never fully transparent
+
+    // Alpha follows the hover bold level
+    uint32_t Separator(float boldLevel) const {
+        return ((uint32_t)(60 + (int)(60 * boldLevel)) << 24) | (text & 0x00FFFFFF);
+    }
+};
+
+#ifndef MUSIC_WIDGET_HEADLESS
+class ThemeWatcher {
+public:
+    // Posts 'msg' to 'hwnd' whenever a value under the Personalize key is written
+    void Start(HWND hwnd, UINT msg) {
+        m_hwnd = hwnd;
+        m_msg = msg;
+        if (RegOpenKeyExW(HKEY_CURRENT_USER, PERSONALIZE_KEY, 0, KEY_NOTIFY, &m_key) != ERROR_SUCCESS) {
+            m_key = NULL;
+            return;
+        }
+        m_event = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+        if (!m_event || !Arm() ||
+            !RegisterWaitForSingleObject(&m_wait, m_event, OnSignaled, this, INFINITE, WT_EXECUTEDEFAULT)) {
+            m_wait = NULL;
+            Stop();
+        }
+    }
+
+    // A watch reports one change; the owner re-arms it before re-reading the theme.
+    // Must run on the window's thread: the watch ends with the thread that set it.
+    bool Arm() {
+        if (!m_key) return false;
+        return RegNotifyChangeKeyValue(m_key, FALSE, REG_NOTIFY_CHANGE_LAST_SET, m_event, TRUE) == ERROR_SUCCESS;
+    }
+
+    void Stop() {
+        // Waits for a callback in progress, so 'this' stays valid for it
+        if (m_wait) UnregisterWaitEx(m_wait, INVALID_HANDLE_VALUE);
+        if (m_key) RegCloseKey(m_key);
+        if (m_event) CloseHandle(m_event);
+        m_wait = NULL;
+        m_key = NULL;
+        m_event = NULL;
+    }
+
+private:
+    static VOID CALLBACK OnSignaled(PVOID context, BOOLEAN) {
+        ThemeWatcher* self = (ThemeWatcher*)context;
+        PostMessage(self->m_hwnd, self->m_msg, 0, 0);
+    }
+
+    HWND m_hwnd = NULL;
+    UINT m_msg = 0;
+    HKEY m_key = NULL;
+    HANDLE m_event = NULL;
+    HANDLE m_wait = NULL;
+} g_ThemeWatcher;
+#endif
+
+bool g_LightMode = false;
+ThemePalette g_Palette;
+
+uint32_t WithAlpha(uint32_t argb, int alpha) {
+    return ((uint32_t)alpha << 24) | (argb & 0x00FFFFFF);
+}
+
+#define ADAPTIVE_TINT_ALPHA 0x60
+
+// Cover colours the palette was last built with, UI thread only
+ArtPalette g_ArtAccent;
+
+void BuildPalette() {
+    ThemePalette p;
+    if (g_Settings.autoTheme) {
+        p.text = g_LightMode ? 0xFF000000 : 0xFFFFFFFF;
+        // Light: Slight white tint, Dark: Slight black tint
+        p.tint = g_LightMode ? 0x40FFFFFF : 0x40000000;
+    } else {
+        p.text = g_Settings.manualTextColor;
+        p.tint = WithAlpha(0xFFFFFF, g_Settings.bgOpacity);  // User tint
+    }
+    Color text(p.text);
+    p.textFaded = WithAlpha(p.text, text.GetA() * 3 / 5);
+    p.hover = WithAlpha(p.text, 255);
+    p.activeBg = WithAlpha(p.text, 40);
+    p.disabled = WithAlpha(p.text, 80);
+    p.note = Color(100, 100, 100).GetValue();  // Grey color
+    p.artPlaceholder = Color(40, 128, 128, 128).GetValue();
+    p.barBg = Color(32, 0, 0, 0).GetValue();  // subtle dark overlay
+    p.barFg = Color(text.GetRed(), text.GetGreen(), text.GetBlue(), 220).GetValue();  // main accent, slightly transparent
+    p.barBorder = Color(60, text.GetRed(), text.GetGreen(), text.GetBlue()).GetValue();
+    p.thumb = Color(text.GetRed(), text.GetGreen(), text.GetBlue(), 220).GetValue();
+    p.thumbBorder = Color(255, 255, 255, 255).GetValue();
+    if (g_Settings.adaptiveAccent && g_ArtAccent.dominant) {
+        // Dominant colour behind the glass, accent on the bar and the hovered controls;
+        // the text keeps the theme colour so it stays readable
+        p.tint = WithAlpha(g_ArtAccent.dominant, ADAPTIVE_TINT_ALPHA);
+        p.hover = g_ArtAccent.accent;
+        p.activeBg = WithAlpha(g_ArtAccent.accent, 48);
+        p.barFg = WithAlpha(g_ArtAccent.accent, 220);
+        p.thumb = WithAlpha(g_ArtAccent.accent, 220);
+    }
+    // Fully transparent pixels don't take mouse input in per-pixel mode, so keep a faint tint
+    Color tint(p.tint);
+    p.layeredClear = Color(max<int>(tint.GetA(), 1), tint.GetR(), tint.GetG(), tint.GetB()).GetValue();
+    // DWM reads the gradient colour as a COLORREF with alpha on top, so red and blue swap;
+    // the grey theme tints never showed it, the cover's dominant colour does
+    p.acrylicTint = (p.tint & 0xFF00FF00) | ((p.tint >> 16) & 0xFF) | ((p.tint & 0xFF) << 16);
+    g_Palette = p;
+}
+
+// Follows the cover on screen; returns true if the palette changed
+bool SetArtAccent(const ArtPalette& art) {
+    if (art == g_ArtAccent) return false;
+    g_ArtAccent = art;
+    if (!g_Settings.adaptiveAccent) return false;
+    BuildPalette();
+    return true;
+}
+
+// Whether the window is currently presented with UpdateLayeredWindow
+bool g_PresentPerPixel = false;
+
+#ifndef MUSIC_WIDGET_HEADLESS
+// Re-reads the theme and rebuilds the palette; call after a theme or settings change
+void RefreshTheme() {
+    g_LightMode = ReadSystemLightMode();
+    BuildPalette();
+}
+
+void UpdateAppearance(HWND hwnd) {
+    // 1. Native Windows 11 Rounding
+    DWM_WINDOW_CORNER_PREFERENCE preference = DWMWCP_ROUND;
+    DwmSetWindowAttribute(hwnd, DWMWA_WINDOW_CORNER_PREFERENCE, &preference, sizeof(preference));
+
+    // 2. Acrylic Blur
+    HMODULE hUser = GetModuleHandle(L"user32.dll");
+    if (hUser) {
+        auto SetComp = (pSetWindowCompositionAttribute)GetProcAddress(hUser, "SetWindowCompositionAttribute");
+        if (SetComp) {
+            ACCENT_POLICY policy = { ACCENT_ENABLE_ACRYLICBLURBEHIND, 0, g_Palette.acrylicTint, 0 };
+            WINDOWCOMPOSITIONATTRIBDATA data = { WCA_ACCENT_POLICY, &policy, sizeof(ACCENT_POLICY) };
+            SetComp(hwnd, &data);
+        }
+    }
+}
+
+// --- Back Buffer ---
+// Top-down 32bpp DIB that lives as long as the window. GDI+ draws into it through a
+// PARGB Bitmap over the same pixels, so the alpha channel is valid for per-pixel
+// presentation. Only a resize or DPI change reallocates it.
+struct BackBuffer {
+    HDC dc = NULL;
+    HBITMAP bitmap = NULL;
+    HGDIOBJ oldBitmap = NULL;
+    uint32_t* bits = nullptr;
+    Bitmap* surface = nullptr;
+    int width = 0;
+    int height = 0;
+    bool fresh = false;  // Reallocated; contents must be redrawn from scratch
+
+    // 'reference' may be NULL for the screen
+    bool Ensure(HDC reference, int w, int h) {
+        if (dc && w == width && h == height) return true;
+        fresh = true;
+        Release();
+        if (w <= 0 || h <= 0) return false;
+
+        BITMAPINFO bmi = {};
+        bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+        bmi.bmiHeader.biWidth = w;
+        bmi.bmiHeader.biHeight = -h;  // Top-down
+        bmi.bmiHeader.biPlanes = 1;
+        bmi.bmiHeader.biBitCount = 32;
+        bmi.bmiHeader.biCompression = BI_RGB;
+
+        void* pixels = nullptr;
+        dc = CreateCompatibleDC(reference);
+        bitmap = dc ? CreateDIBSection(reference, &bmi, DIB_RGB_COLORS, &pixels, NULL, 0) : NULL;
+        if (!bitmap || !pixels) {
+            Release();
+            return false;
+        }
+        oldBitmap = SelectObject(dc, bitmap);
+        bits = (uint32_t*)pixels;
+        surface = new Bitmap(w, h, w * 4, PixelFormat32bppPARGB, (BYTE*)bits);
+        width = w;
+        height = h;
+        return true;
+    }
+
+    void Release() {
+        delete surface;
+        surface = nullptr;
+        if (dc && oldBitmap) SelectObject(dc, oldBitmap);
+        if (bitmap) DeleteObject(bitmap);
+        if (dc) DeleteDC(dc);
+        dc = NULL;
+        bitmap = NULL;
+        oldBitmap = NULL;
+        bits = nullptr;
+        width = height = 0;
+    }
+} g_BackBuffer;
+
+// Switches between constant-alpha and per-pixel-alpha layering; the two modes can't be mixed
+void ApplyPresentMode(HWND hwnd) {
+    g_PresentPerPixel = g_Settings.perPixelAlpha;
+    LONG_PTR exStyle = GetWindowLongPtr(hwnd, GWL_EXSTYLE);
+    SetWindowLongPtr(hwnd, GWL_EXSTYLE, exStyle & ~WS_EX_LAYERED);
+    SetWindowLongPtr(hwnd, GWL_EXSTYLE, exStyle | WS_EX_LAYERED);
+    if (!g_PresentPerPixel) SetLayeredWindowAttributes(hwnd, 0, 255, LWA_ALPHA);
+}
+
+void PresentBackBuffer(HWND hwnd, HDC hdc) {
+    if (g_PresentPerPixel) {
+        SIZE size = { g_BackBuffer.width, g_BackBuffer.height };
+        POINT src = { 0, 0 };
+        BLENDFUNCTION blend = { AC_SRC_OVER, 0, 255, AC_SRC_ALPHA };
+        UpdateLayeredWindow(hwnd, NULL, NULL, &size, g_BackBuffer.dc, &src, 0, &blend, ULW_ALPHA);
+    } else {
+        BitBlt(hdc, 0, 0, g_BackBuffer.width, g_BackBuffer.height, g_BackBuffer.dc, 0, 0, SRCCOPY);
+    }
+}
+#endif
+
+// --- Renderer ---
+// Everything DrawMediaPanel paints goes through this interface. GdiplusRenderer draws with
+// GDI+; SoftwareRenderer rasterizes into any premultiplied BGRA buffer and needs nothing
+// from Windows, so the panel can also be rendered headlessly. Colours are ARGB.
+class Renderer {
+public:
+    virtual ~Renderer() {}
+    // Limits drawing to the union of 'rects' (count 0 lifts the clip)
+    virtual void SetClip(const Rect* rects, int count) = 0;
+    // Narrows the current clip to 'rect' until the next SetClip
+    virtual void IntersectClip(const Rect& rect) = 0;
+    // Replaces every pixel inside the clip
+    virtual void Clear(uint32_t argb) = 0;
+    virtual void FillRect(float x, float y, float w, float h, uint32_t argb) = 0;
+    virtual void FillRoundRect(float x, float y, float w, float h, float radius, uint32_t argb) = 0;
+    virtual void DrawRoundRect(float x, float y, float w, float h, float radius, uint32_t argb, float penWidth) = 0;
+    virtual void FillEllipse(float x, float y, float w, float h, uint32_t argb) = 0;
+    virtual void DrawEllipse(float x, float y, float w, float h, uint32_t argb, float penWidth) = 0;
+    // 'xy' holds 'count' x,y pairs of a convex polygon
+    virtual void FillPolygon(const float* xy, int count, uint32_t argb) = 0;
+    virtual void DrawLine(float x0, float y0, float x1, float y1, uint32_t argb, float penWidth) = 0;
+    // 'smooth' picks bilinear over nearest-neighbour sampling
+    virtual void DrawImage(const ArtImage& image, float x, float y, float w, float h, bool smooth) = 0;
+};
+
+#ifndef MUSIC_WIDGET_HEADLESS
+// GDI+ views of image pixels. Wrapping a buffer in a Bitmap, and a Graphics to draw text
+// into it, is done once per image instead of once per call. Views are keyed by buffer
+// address and size: an image whose pixels moved gets a new view, and a view whose image
+// is gone is never matched again and ages out. UI thread only.
+#define GDIPLUS_VIEWS 16
+
+class GdiplusViewCache {
+public:
+    Bitmap* BitmapFor(const ArtImage& image) {
+        return Find(image).bitmap.get();
+    }
+
+    // For drawing into 'image'; text is anti-aliased
+    Graphics* GraphicsFor(ArtImage& image) {
+        View& view = Find(image);
+        if (!view.graphics) {
+            view.graphics.reset(new Graphics(view.bitmap.get()));
+            view.graphics->SetTextRenderingHint(TextRenderingHintAntiAlias);
+        }
+        return view.graphics.get();
+    }
+
+    // Before GDI+ shuts down
+    void Clear() {
+        for (View& view : m_views) view = View();
+    }
+
+private:
+    struct View {
+        const uint32_t* pixels = nullptr;
+        int width = 0;
+        int height = 0;
+        uint64_t lastUse = 0;
+        unique_ptr<Bitmap> bitmap;
+        unique_ptr<Graphics> graphics;  // Declared after bitmap so it is destroyed first
+    };
+
+    View& Find(const ArtImage& image) {
+        m_uses++;
+        View* oldest = &m_views[0];
+        for (View& view : m_views) {
+            if (view.bitmap && view.pixels == image.pixels.data() && view.width == image.width &&
+                view.height == image.height) {
+                view.lastUse = m_uses;
+                return view;
+            }
+            if (view.lastUse < oldest->lastUse) oldest = &view;
+        }
+        View& view = *oldest;
+        view = View();
+        view.pixels = image.pixels.data();
+        view.width = image.width;
+        view.height = image.height;
+        view.lastUse = m_uses;
+        view.bitmap.reset(new Bitmap(image.width, image.height, image.width * 4, PixelFormat32bppPARGB,
+                                     (BYTE*)image.pixels.data()));
+        return view;
+    }
+
+    View m_views[GDIPLUS_VIEWS];
+    uint64_t m_uses = 0;
+} g_GdiplusViews;
+
+class GdiplusRenderer : public Renderer {
+public:
+    explicit GdiplusRenderer(Graphics& graphics) : m_graphics(graphics), m_brush(Color()), m_pen(Color()) {
+        m_graphics.SetSmoothingMode(SmoothingModeAntiAlias);
+    }
+
+    void SetClip(const Rect* rects, int count) override {
+        if (count == 0) {
+            m_graphics.ResetClip();
+            return;
+        }
+        Region region;
+        region.MakeEmpty();
+        for (int i = 0; i < count; i++) region.Union(rects[i]);
+        m_graphics.SetClip(&region, CombineModeReplace);
+    }
+
+    void IntersectClip(const Rect& rect) override {
+        m_graphics.SetClip(rect, CombineModeIntersect);
+    }
+
+    void Clear(uint32_t argb) override {
+        m_graphics.Clear(Color(argb));
+    }
+
+    void FillRect(float x, float y, float w, float h, uint32_t argb) override {
+        m_graphics.FillRectangle(BrushFor(argb), RectF(x, y, w, h));
+    }
+
+    void FillRoundRect(float x, float y, float w, float h, float radius, uint32_t argb) override {
+        GraphicsPath path;
+        AddRoundRect(path, x, y, w, h, radius);
+        m_graphics.FillPath(BrushFor(argb), &path);
+    }
+
+    void DrawRoundRect(float x, float y, float w, float h, float radius, uint32_t argb, float penWidth) override {
+        GraphicsPath path;
+        AddRoundRect(path, x, y, w, h, radius);
+        m_graphics.DrawPath(PenFor(argb, penWidth), &path);
+    }
+
+    void FillEllipse(float x, float y, float w, float h, uint32_t argb) override {
+        m_graphics.FillEllipse(BrushFor(argb), RectF(x, y, w, h));
+    }
+
+    void DrawEllipse(float x, float y, float w, float h, uint32_t argb, float penWidth) override {
+        m_graphics.DrawEllipse(PenFor(argb, penWidth), RectF(x, y, w, h));
+    }
+
+    void FillPolygon(const float* xy, int count, uint32_t argb) override {
+        vector<PointF> points(count);
+        for (int i = 0; i < count; i++) points[i] = PointF(xy[i * 2], xy[i * 2 + 1]);
+        m_graphics.FillPolygon(BrushFor(argb), points.data(), count);
+    }
+
+    void DrawLine(float x0, float y0, float x1, float y1, uint32_t argb, float penWidth) override {
+        m_graphics.DrawLine(PenFor(argb, penWidth), x0, y0, x1, y1);
+    }
+
+    void DrawImage(const ArtImage& image, float x, float y, float w, float h, bool smooth) override {
+        if (image.width <= 0 || image.height <= 0) return;
+        // Wraps the pixels without copying them, made on the image's first draw
+        Bitmap* bitmap = g_GdiplusViews.BitmapFor(image);
+        m_graphics.SetInterpolationMode(smooth ? InterpolationModeBilinear : InterpolationModeNearestNeighbor);
+        m_graphics.SetPixelOffsetMode(PixelOffsetModeHalf);
+        m_graphics.DrawImage(bitmap, RectF(x, y, w, h), 0, 0, (REAL)image.width, (REAL)image.height, UnitPixel);
+        m_graphics.SetPixelOffsetMode(PixelOffsetModeNone);
+    }
+
+private:
+    // One brush and one pen per paint, recoloured per call rather than created per call
+    SolidBrush* BrushFor(uint32_t argb) {
+        m_brush.SetColor(Color(argb));
+        return &m_brush;
+    }
+
+    Pen* PenFor(uint32_t argb, float width) {
+        m_pen.SetColor(Color(argb));
+        m_pen.SetWidth(width);
+        return &m_pen;
+    }
+
+    static void AddRoundRect(GraphicsPath& path, float x, float y, float w, float h, float radius) {
+        float d = radius * 2.0f;
+        if (d > w) d = w;
+        if (d > h) d = h;
+        if (d <= 0.0f) {
+            path.AddRectangle(RectF(x, y, w, h));
+            return;
+        }
+        path.AddArc(x, y, d, d, 180, 90);
+        path.AddArc(x + w - d, y, d, d, 270, 90);
+        path.AddArc(x + w - d, y + h - d, d, d, 0, 90);
+        path.AddArc(x, y + h - d, d, d, 90, 90);
+        path.CloseFigure();
+    }
+
+    Graphics& m_graphics;
+    SolidBrush m_brush;
+    Pen m_pen;
+};
+#endif
+
+// Shapes are anti-aliased from signed distances: a pixel's coverage is how far its centre
+// lies inside the edge, clamped to one pixel. Like GDI+'s default pixel offset mode,
+// shape coordinates put pixel centres on integers; images use half-pixel centres, as the
+// GDI+ backend asks for with PixelOffsetModeHalf.
+class SoftwareRenderer : public Renderer {
+public:
+    // 'pixels' is top-down premultiplied BGRA, 'stride' pixels per row
+    SoftwareRenderer(uint32_t* pixels, int width, int height, int stride)
+        : m_pixels(pixels), m_width(width), m_height(height), m_stride(stride) {
+        SetClip(nullptr, 0);
+    }
+
+    void SetClip(const Rect* rects, int count) override {
+        m_clip.assign(rects, rects + count);
+        m_clipBounds = Rect(0, 0, m_width, m_height);
+        if (count > 0) {
+            Rect bounds = rects[0];
+            for (int i = 1; i < count; i++) Rect::Union(bounds, bounds, rects[i]);
+            Rect::Intersect(m_clipBounds, m_clipBounds, bounds);
+        }
+        m_intersect = m_clipBounds;
+    }
+
+    void IntersectClip(const Rect& rect) override {
+        Rect::Intersect(m_intersect, m_intersect, rect);
+    }
+
+    void Clear(uint32_t argb) override {
+        uint32_t color = Premultiply(argb, 1.0f);
+        ForEachPixel(0.0f, 0.0f, (float)m_width, (float)m_height, [&](int x, int y, uint32_t& dst) {
+            dst = color;
+        });
+    }
+
+    void FillRect(float x, float y, float w, float h, uint32_t argb) override {
+        FillRoundRect(x, y, w, h, 0.0f, argb);
+    }
+
+    void FillRoundRect(float x, float y, float w, float h, float radius, uint32_t argb) override {
+        float hw = w / 2.0f, hh = h / 2.0f;
+        float r = ClampRadius(radius, hw, hh);
+        float cx = x + hw, cy = y + hh;
+        FillCoverage(x - 1, y - 1, x + w + 1, y + h + 1, argb, [=](float px, float py) {
+            return Saturate(0.5f - RoundRectDistance(px - cx, py - cy, hw, hh, r));
+        });
+    }
+
+    void DrawRoundRect(float x, float y, float w, float h, float radius, uint32_t argb, float penWidth) override {
+        float hw = w / 2.0f, hh = h / 2.0f;
+        float r = ClampRadius(radius, hw, hh);
+        float cx = x + hw, cy = y + hh;
+        float half = penWidth / 2.0f;
+        FillCoverage(x - half - 1, y - half - 1, x + w + half + 1, y + h + half + 1, argb, [=](float px, float py) {
+            return Saturate(0.5f - (fabsf(RoundRectDistance(px - cx, py - cy, hw, hh, r)) - half));
+        });
+    }
+
+    void FillEllipse(float x, float y, float w, float h, uint32_t argb) override {
+        float rx = w / 2.0f, ry = h / 2.0f;
+        float cx = x + rx, cy = y + ry;
+        FillCoverage(x - 1, y - 1, x + w + 1, y + h + 1, argb, [=](float px, float py) {
+            return Saturate(0.5f - EllipseDistance(px - cx, py - cy, rx, ry));
+        });
+    }
+
+    void DrawEllipse(float x, float y, float w, float h, uint32_t argb, float penWidth) override {
+        float rx = w / 2.0f, ry = h / 2.0f;
+        float cx = x + rx, cy = y + ry;
+        float half = penWidth / 2.0f;
+        FillCoverage(x - half - 1, y - half - 1, x + w + half + 1, y + h + half + 1, argb, [=](float px, float py) {
+            return Saturate(0.5f - (fabsf(EllipseDistance(px - cx, py - cy, rx, ry)) - half));
+        });
+    }
+
+    void FillPolygon(const float* xy, int count, uint32_t argb) override {
+        if (count < 3) return;
+        // Outward edge normals; the winding decides which side is out
+        float area = 0.0f;
+        for (int i = 0; i < count; i++) {
+            int j = (i + 1) % count;
+            area += xy[i * 2] * xy[j * 2 + 1] - xy[j * 2] * xy[i * 2 + 1];
+        }
+        float sign = area < 0.0f ? -1.0f : 1.0f;
+        vector<float> edges;  // nx, ny, offset per edge
+        float x0 = xy[0], y0 = xy[1], x1 = xy[0], y1 = xy[1];
+        for (int i = 0; i < count; i++) {
+            int j = (i + 1) % count;
+            float ex = xy[j * 2] - xy[i * 2], ey = xy[j * 2 + 1] - xy[i * 2 + 1];
+            float len = sqrtf(ex * ex + ey * ey);
+            if (len <= 0.0f) continue;
+            float nx = sign * ey / len, ny = -sign * ex / len;
+            edges.push_back(nx);
+            edges.push_back(ny);
+            edges.push_back(nx * xy[i * 2] + ny * xy[i * 2 + 1]);
+            if (xy[i * 2] < x0) x0 = xy[i * 2];
+            if (xy[i * 2] > x1) x1 = xy[i * 2];
+            if (xy[i * 2 + 1] < y0) y0 = xy[i * 2 + 1];
+            if (xy[i * 2 + 1] > y1) y1 = xy[i * 2 + 1];
+        }
+        FillCoverage(x0 - 1, y0 - 1, x1 + 1, y1 + 1, argb, [&](float px, float py) {
+            float d = -1e9f;
+            for (size_t e = 0; e < edges.size(); e += 3) {
+                float edgeDistance = edges[e] * px + edges[e + 1] * py - edges[e + 2];
+                if (edgeDistance > d) d = edgeDistance;
+            }
+            return Saturate(0.5f - d);
+        });
+    }
+
+    void DrawLine(float x0, float y0, float x1, float y1, uint32_t argb, float penWidth) override {
+        float dx = x1 - x0, dy = y1 - y0;
+        float len = sqrtf(dx * dx + dy * dy);
+        if (len <= 0.0f) return;
+        // Flat caps: a box along the segment
+        float ux = dx / len, uy = dy / len;
+        float mx = (x0 + x1) / 2.0f, my = (y0 + y1) / 2.0f;
+        float halfLen = len / 2.0f, half = penWidth / 2.0f;
+        float pad = half + 1.0f;
+        FillCoverage(min(x0, x1) - pad, min(y0, y1) - pad, max(x0, x1) + pad, max(y0, y1) + pad, argb,
+                     [=](float px, float py) {
+            float along = fabsf((px - mx) * ux + (py - my) * uy) - halfLen;
+            float across = fabsf((px - mx) * -uy + (py - my) * ux) - half;
+            return Saturate(0.5f - (along > across ? along : across));
+        });
+    }
+
+    void DrawImage(const ArtImage& image, float x, float y, float w, float h, bool smooth) override {
+        if (image.width <= 0 || image.height <= 0 || w <= 0.0f || h <= 0.0f) return;
+        if (!smooth && BlitImage(image, x, y, w, h)) return;
+        float scaleX = image.width / w, scaleY = image.height / h;
+        ForEachPixel(x, y, x + w, y + h, [&](int px, int py, uint32_t& dst) {
+            float u = (px + 0.5f - x) * scaleX;
+            float v = (py + 0.5f - y) * scaleY;
+            uint32_t src;
+            if (smooth) {
+                src = SampleBilinear(image, u - 0.5f, v - 0.5f);
+            } else {
+                int sx = (int)floorf(u), sy = (int)floorf(v);
+                if (sx < 0 || sy < 0 || sx >= image.width || sy >= image.height) return;
+                src = image.pixels[(size_t)sy * image.width + sx];
+            }
+            dst = BlendOverPixel(src, dst);
+        });
+    }
+
+private:
+    static float Saturate(float v) { return v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v); }
+
+    static float ClampRadius(float radius, float hw, float hh) {
+        float r = radius < 0.0f ? 0.0f : radius;
+        if (r > hw) r = hw;
+        if (r > hh) r = hh;
+        return r;
+    }
+
+    // Signed distance from a point (relative to the centre) to a rounded box
+    static float RoundRectDistance(float px, float py, float hw, float hh, float r) {
+        float qx = fabsf(px) - (hw - r), qy = fabsf(py) - (hh - r);
+        float ox = qx > 0.0f ? qx : 0.0f, oy = qy > 0.0f ? qy : 0.0f;
+        float inside = qx > qy ? qx : qy;
+        if (inside > 0.0f) inside = 0.0f;
+        return sqrtf(ox * ox + oy * oy) + inside - r;
+    }
+
+    // Exact for circles, a close approximation for the mildly oval note heads
+    static float EllipseDistance(float px, float py, float rx, float ry) {
+        if (rx <= 0.0f || ry <= 0.0f) return 1e9f;
+        float nx = px / rx, ny = py / ry;
+        return (sqrtf(nx * nx + ny * ny) - 1.0f) * (rx < ry ? rx : ry);
+    }
+
+    static uint32_t Premultiply(uint32_t argb, float coverage) {
+        float a = ((argb >> 24) & 0xFF) * coverage;
+        float scale = a / 255.0f;
+        uint32_t r = (uint32_t)(((argb >> 16) & 0xFF) * scale + 0.5f);
+        uint32_t g = (uint32_t)(((argb >> 8) & 0xFF) * scale + 0.5f);
+        uint32_t b = (uint32_t)((argb & 0xFF) * scale + 0.5f);
+        return ((uint32_t)(a + 0.5f) << 24) | (r << 16) | (g << 8) | b;
+    }
+
+    // Texels outside the image are transparent, so edges fade out like GDI+'s
+    static uint32_t SampleBilinear(const ArtImage& image, float u, float v) {
+        int x0 = (int)floorf(u), y0 = (int)floorf(v);
+        float fx = u - x0, fy = v - y0;
+        float weights[4] = { (1 - fx) * (1 - fy), fx * (1 - fy), (1 - fx) * fy, fx * fy };
+        float sum[4] = {};
+        for (int i = 0; i < 4; i++) {
+            int sx = x0 + (i & 1), sy = y0 + (i >> 1);
+            if (sx < 0 || sy < 0 || sx >= image.width || sy >= image.height || weights[i] <= 0.0f) continue;
+            uint32_t texel = image.pixels[(size_t)sy * image.width + sx];
+            for (int c = 0; c < 4; c++) sum[c] += ((texel >> (c * 8)) & 0xFF) * weights[i];
+        }
+        uint32_t out = 0;
+        for (int c = 0; c < 4; c++) out |= (uint32_t)(sum[c] + 0.5f) << (c * 8);
+        return out;
+    }
+
+    // 1:1 copies at whole-pixel positions inside a rectangular clip blend a row at a time
+    bool BlitImage(const ArtImage& image, float x, float y, float w, float h) {
+        int left = (int)x, top = (int)y;
+        if ((float)left != x || (float)top != y || w != (float)image.width || h != (float)image.height) return false;
+        if (m_clip.size() > 1) return false;
+        int x0 = max(left, m_intersect.X), y0 = max(top, m_intersect.Y);
+        int x1 = min(left + image.width, m_intersect.X + m_intersect.Width);
+        int y1 = min(top + image.height, m_intersect.Y + m_intersect.Height);
+        if (x1 <= x0) return true;
+        for (int py = y0; py < y1; py++) {
+            g_Kernels.blendOver(m_pixels + (size_t)py * m_stride + x0,
+                                &image.pixels[(size_t)(py - top) * image.width + (x0 - left)], x1 - x0);
+        }
+        return true;
+    }
+
+    bool InClip(int x, int y) const {
+        if (m_clip.empty()) return true;
+        for (const Rect& r : m_clip) {
+            if (x >= r.X && y >= r.Y && x < r.X + r.Width && y < r.Y + r.Height) return true;
+        }
+        return false;
+    }
+
+    // Visits every clipped pixel whose area overlaps [x0, x1) x [y0, y1)
+    template <typename F>
+    void ForEachPixel(float x0, float y0, float x1, float y1, F visit) {
+        int left = (int)floorf(x0), top = (int)floorf(y0);
+        int right = (int)ceilf(x1), bottom = (int)ceilf(y1);
+        if (left < m_intersect.X) left = m_intersect.X;
+        if (top < m_intersect.Y) top = m_intersect.Y;
+        if (right > m_intersect.X + m_intersect.Width) right = m_intersect.X + m_intersect.Width;
+        if (bottom > m_intersect.Y + m_intersect.Height) bottom = m_intersect.Y + m_intersect.Height;
+        for (int y = top; y < bottom; y++) {
+            uint32_t* row = m_pixels + (size_t)y * m_stride;
+            for (int x = left; x < right; x++) {
+                if (InClip(x, y)) visit(x, y, row[x]);
+            }
+        }
+    }
+
+    template <typename F>
+    void FillCoverage(float x0, float y0, float x1, float y1, uint32_t argb, F coverage) {
+        ForEachPixel(x0, y0, x1, y1, [&](int x, int y, uint32_t& dst) {
+            float c = coverage((float)x, (float)y);
+            if (c > 0.0f) dst = BlendOverPixel(Premultiply(argb, c), dst);
+        });
+    }
+
+    uint32_t* m_pixels;
+    int m_width;
+    int m_height;
+    int m_stride;
+    vector<Rect> m_clip;
+    Rect m_clipBounds;
+    Rect m_intersect;  // Clip bounds narrowed by IntersectClip
+};
+
+// --- Frame Scheduler ---
+// Returned by an animation step once it has settled
+#define FRAME_DONE -1.0
+
+enum AnimationId {
+    ANIM_MARQUEE,
+    ANIM_SLIDE,
+    ANIM_HOVER,
+    ANIM_PROGRESS,
+    ANIM_HUD,
+    ANIM_COMMAND,
+    ANIM_SCRUB,
+    ANIM_TRANSITION,
+    ANIM_COUNT
+};
+
+// One timer for every animation. Each registered step is called with the current time
+// and returns when it next wants to run: 'now' for the next display frame, a later time
+// to sleep until then, or FRAME_DONE. The timer is armed for the earliest deadline and
+// killed outright when nothing is registered, so an idle panel gets no wakeups. Each id
+// has a fixed slot and a step runs where it is stored, so a tick never copies a step or
+// allocates; a step replaced or stopped while it runs is swapped out once it returns.
+class FrameScheduler {
+public:
+    typedef function<double(double now)> Animation;
+
+    // Without a window nothing is armed; Tick() can then be driven by hand
+    void Attach(HWND hwnd, UINT_PTR timerId) {
+        m_hwnd = hwnd;
+        m_timerId = timerId;
+        UpdateFrameInterval();
+        Reschedule();
+    }
+
+    void Detach() {
+        if (m_hwnd && m_armedDelay) KillTimer(m_hwnd, m_timerId);
+        m_armedDelay = 0;
+        m_hwnd = NULL;
+        for (Entry& entry : m_entries) entry = Entry();
+    }
+
+    void SetClock(Clock* clock) { m_clock = clock ? clock : &g_SystemClock; }
+    double Now() { return m_clock->Now(); }
+    UINT FrameInterval() const { return m_frameInterval; }
+    UINT ArmedDelay() const { return m_armedDelay; }  // 0 while idle
+
+    // Follows the refresh rate of the primary display
+    void UpdateFrameInterval() {
+        DEVMODEW mode = {};
+        mode.dmSize = sizeof(mode);
+        DWORD hz = 60;
+        if (EnumDisplaySettingsW(NULL, ENUM_CURRENT_SETTINGS, &mode) && mode.dmDisplayFrequency > 1) {
+            hz = mode.dmDisplayFrequency;
+        }
+        m_frameInterval = 1000 / hz;
+        if (m_frameInterval < USER_TIMER_MINIMUM) m_frameInterval = USER_TIMER_MINIMUM;
+    }
+
+    // Registers 'step' under 'id', replacing any previous one; it runs on the next frame
+    void Start(int id, Animation step) {
+        Entry& entry = m_entries[id];
+        if (id == m_running) {
+            entry.replacement = move(step);
+            entry.replaced = true;
+        } else {
+            entry.step = move(step);
+        }
+        entry.running = true;
+        entry.due = Now();
+        entry.generation++;
+        Reschedule();
+    }
+
+    void Stop(int id) {
+        Entry& entry = m_entries[id];
+        if (!entry.running) return;
+        if (id == m_running) {
+            entry.replacement = nullptr;
+            entry.replaced = true;
+        } else {
+            entry.step = nullptr;
+        }
+        entry.running = false;
+        entry.generation++;
+        Reschedule();
+    }
+
+    bool IsRunning(int id) const { return m_entries[id].running; }
+
+    // Runs every step that is due. Steps may Start or Stop animations, themselves included.
+    void Tick() {
+        double now = Now();
+        for (int id = 0; id < ANIM_COUNT; id++) {
+            Entry& entry = m_entries[id];
+            if (!entry.running || entry.due > now) continue;
+            unsigned generation = entry.generation;
+            m_running = id;
+            double next = entry.step(now);
+            m_running = -1;
+            if (entry.replaced) {
+                entry.step = move(entry.replacement);
+                entry.replacement = nullptr;
+                entry.replaced = false;
+            }
+            if (entry.generation != generation) continue;  // Restarted or stopped meanwhile
+            if (next < 0.0) {
+                entry.step = nullptr;
+                entry.running = false;
+            } else {
+                entry.due = next;
+            }
+        }
+        Reschedule();
+    }
+
+    // Earliest deadline, or FRAME_DONE when idle
+    double NextDue() const {
+        double due = FRAME_DONE;
+        for (const Entry& entry : m_entries) {
+            if (entry.running && (due < 0.0 || entry.due < due)) due = entry.due;
+        }
+        return due;
+    }
+
+private:
+    struct Entry {
+        Animation step;
+        Animation replacement;  // Start or Stop from inside the running step, applied after it
+        bool replaced = false;
+        bool running = false;
+        double due = 0.0;
+        unsigned generation = 0;
+    };
+
+    void Reschedule() {
+        if (!m_hwnd) return;
+        double due = NextDue();
+        if (due < 0.0) {
+            if (m_armedDelay) KillTimer(m_hwnd, m_timerId);
+            m_armedDelay = 0;
+            return;
+        }
+        double wait = due - Now();
+        UINT delay = wait <= m_frameInterval ? m_frameInterval : (UINT)ceil(wait);
+        // Re-arming restarts the countdown, so leave a matching timer alone
+        if (delay != m_armedDelay) {
+            SetTimer(m_hwnd, m_timerId, delay, NULL);
+            m_armedDelay = delay;
+        }
+    }
+
+    HWND m_hwnd = NULL;
+    UINT_PTR m_timerId = 0;
+    UINT m_armedDelay = 0;  // 0 while no timer is armed
+    UINT m_frameInterval = 16;
+    Clock* m_clock = &g_SystemClock;
+    Entry m_entries[ANIM_COUNT];
+    int m_running = -1;  // Id whose step is executing, or -1
+} g_Frames;
+
+// --- Optimistic Commands ---
+// A transport click is drawn as done right away and reconciled with what the app reports
+// later. Play/pause is confirmed once isPlaying flips, next once the title changes,
+// previous once the title changes or the track restarts, and a seek once the position
+// lands near its target. Until then the panel shows the expected state; a rejected or
+// timed-out command rolls back to the last real snapshot.
+#define COMMAND_RESTART_SECONDS   3.0  // A restarted track reports a position below this
+#define COMMAND_SEEK_TOLERANCE    1.5  // Seconds between a confirmed seek and its target
+
+class CommandOverlay {
+public:
+    enum Outcome { PENDING, CONFIRMED, DROPPED };
+
+    // Replaces any outstanding command; 'state' is the last real snapshot
+    void Issue(int cmd, const MediaSnapshot& state, double now, double seconds = 0.0) {
+        bool playing = IsPlaying(state);
+        m_cmd = cmd;
+        m_seconds = seconds;
+        m_issuedAt = now;
+        m_deadline = now + (cmd == 2 ? COMMAND_TOGGLE_TIMEOUT_MS : COMMAND_SKIP_TIMEOUT_MS);
+        m_expectPlaying = cmd == 2 ? !playing : playing;
+        m_title = state.title;
+        m_sessionId = state.sessionId;
+        m_painted = false;
+        m_queueId = 0;
+    }
+
+    void SetQueueId(uint64_t id) { m_queueId = id; }
+    uint64_t QueueId() const { return m_queueId; }
+    void Clear() { m_cmd = 0; }
+    bool Active() const { return m_cmd != 0; }
+    int Command() const { return m_cmd; }
+    double IssuedAt() const { return m_issuedAt; }
+    double Deadline() const { return m_deadline; }
+    bool Skipping() const { return m_cmd == 1 || m_cmd == 3; }
+
+    // Play state to draw: the expected one while a play/pause is outstanding
+    bool IsPlaying(const MediaSnapshot& state) const {
+        return m_cmd == 2 ? m_expectPlaying : state.isPlaying;
+    }
+
+    Outcome Reconcile(const MediaSnapshot& state) const {
+        if (!m_cmd) return PENDING;
+        // The command went to another session
+        if (state.sessionId != m_sessionId) return DROPPED;
+        if (m_cmd == 2) return state.isPlaying == m_expectPlaying ? CONFIRMED : PENDING;
+        if (m_cmd == COMMAND_SEEK) {
+            // The worker's own estimate says nothing about where the app is
+            if (state.positionEstimated || state.positionStamp < m_issuedAt) return PENDING;
+            double expected = m_seconds;
+            if (state.isPlaying) expected += (state.positionStamp - m_issuedAt) / 1000.0 * state.playbackRate;
+            return fabs(state.position - expected) < COMMAND_SEEK_TOLERANCE ? CONFIRMED : PENDING;
+        }
+        if (state.title != m_title) return CONFIRMED;
+        bool restarted = m_cmd == 1 && state.isSpotify && state.positionStamp >= m_issuedAt &&
+                         state.position < COMMAND_RESTART_SECONDS;
+        return restarted ? CONFIRMED : PENDING;
+    }
+
+    // Called after each paint; the first one after a click completes the visual update
+    void MarkPainted(double now) {
+        if (!m_cmd || m_cmd == COMMAND_SEEK || m_painted) return;
+        m_painted = true;
+        g_PerfClickToPaint.Record(now - m_issuedAt);
+    }
+
+private:
+    int m_cmd = 0;  // 0 when nothing is outstanding
+    double m_issuedAt = 0.0;
+    double m_deadline = 0.0;
+    double m_seconds = 0.0;  // Seek target
+    bool m_expectPlaying = false;
+    bool m_painted = false;
+    uint64_t m_queueId = 0;  // In the worker's command queue
+    wstring m_title;
+    wstring m_sessionId;
+} g_Commands;
+
+// --- Scene ---
+// The panel is retained: each element knows its bounds and a key summarizing everything
+// that affects its pixels. Only elements whose key changed are invalidated and redrawn
+// over the persistent back buffer; everything else stays as it was.
+enum PanelElement {
+    ELEMENT_ART,
+    ELEMENT_PREV,
+    ELEMENT_PLAY,
+    ELEMENT_NEXT,
+    ELEMENT_SEPARATOR,
+    ELEMENT_TEXT,
+    ELEMENT_TIMELINE,
+    ELEMENT_SCRUB_TIP,  // Over the text while dragging the timeline
+    ELEMENT_HUD,  // Drawn last, over whatever it covers
+    ELEMENT_COUNT
+};
+
+struct PanelGeometry {
+    int artX, artY, artSize;
+    int controlY, prevX, playX, nextX;
+    int separatorX;
+    int textX, textMaxW;
+    float textY;
+    bool hasTimeline;
+    int barX, barY, barW;  // barY is the top edge at rest and on hover
+};
+
+struct PanelScene {
+    Rect bounds[ELEMENT_COUNT];
+    uint64_t keys[ELEMENT_COUNT] = {};
+    Rect drawnBounds[ELEMENT_COUNT];
+    uint64_t drawnKeys[ELEMENT_COUNT] = {};
+    bool drawn[ELEMENT_COUNT] = {};
+    bool fullRedraw = true;  // Also clears the background between elements
+    uint64_t pixelsTouched = 0;  // Pixels cleared and redrawn by the last paint
+    // Sampled with the keys, so paint draws exactly what they describe
+    double position = 0.0;
+    int progressWidth = 0;
+    // Under every element; held so a new one can never reuse the old one's address
+    shared_ptr<const ArtImage> backdrop;
+
+    void InvalidateAll() {
+        for (bool& d : drawn) d = false;
+        fullRedraw = true;
+    }
+
+    bool IsDirty(int i) const {
+        return !drawn[i] || keys[i] != drawnKeys[i] || !RectEquals(bounds[i], drawnBounds[i]);
+    }
+
+    // Area to clear for a dirty element: where it is now and where it was last drawn
+    Rect DirtyRect(int i) const {
+        if (!drawn[i] || drawnBounds[i].IsEmptyArea()) return bounds[i];
+        if (bounds[i].IsEmptyArea()) return drawnBounds[i];
+        Rect out;
+        Rect::Union(out, bounds[i], drawnBounds[i]);
+        return out;
+    }
+
+    static bool RectEquals(const Rect& a, const Rect& b) {
+        return a.X == b.X && a.Y == b.Y && a.Width == b.Width && a.Height == b.Height;
+    }
+} g_Scene;
+
+// Line height of the title font, from the last paint
+float g_TextLineHeight = 0.0f;
+
+bool HasTimeline(const MediaSnapshot& state) {
+    return state.isSpotify && state.duration > 0.0;
+}
+
+// Whether the session's app accepts the command behind a HIT_PREV..HIT_NEXT target
+bool ControlEnabled(const MediaSnapshot& state, int hit) {
+    static const unsigned flags[3] = { MEDIA_CONTROL_PREV, MEDIA_CONTROL_PLAY_PAUSE, MEDIA_CONTROL_NEXT };
+    return (state.controls & flags[hit - 1]) != 0;
+}
+
+// UI-thread timeline, fed once per published snapshot
+TimelineModel g_Timeline;
+uint64_t g_TimelineVersion = 0;
+wstring g_TimelineSession;
+
+// Position extrapolated from the last timeline event while playing. Snapshots are held
+// back while a command is outstanding, so its optimistic sample stays in charge.
+double CurrentPosition(const MediaSnapshot& state) {
+    double now = g_Frames.Now();
+    if (state.version != g_TimelineVersion && !g_Commands.Active()) {
+        g_TimelineVersion = state.version;
+        if (state.sessionId != g_TimelineSession) {
+            // Another session's timeline: jump to it rather than slewing
+            g_TimelineSession = state.sessionId;
+            g_Timeline.Reset();
+        }
+        TimelineSample sample;
+        sample.position = state.position;
+        sample.stamp = state.positionStamp;
+        sample.duration = state.duration;
+        sample.rate = state.playbackRate;
+        sample.playing = state.isPlaying;
+        g_Timeline.Update(sample, now);
+    }
+    return g_Timeline.Position(now);
+}
+
+PanelGeometry CalcPanelGeometry(int width, int height, float lineHeight, bool hasTimeline) {
+    PanelGeometry g;
+    g.artSize = height - 12;
+    g.artX = 6;
+    g.artY = 6;
+    int startControlX = g.artX + g.artSize + 12;
+    g.controlY = height / 2;
+    g.prevX = startControlX;
+    g.playX = startControlX + 28;
+    g.nextX = startControlX + 56;
+    g.separatorX = width - 20;
+    int contentMaxX = g.separatorX - 10;  // 10px margin to left of separator
+    g.textX = g.nextX + 20;
+    g.textMaxW = contentMaxX - g.textX;
+    if (g.textMaxW < 50) g.textMaxW = 50;  // Minimum width
+    if (lineHeight <= 0.0f) lineHeight = g_Settings.fontSize * 1.33f;
+    // Text vertical position: leave space for timeline if Spotify
+    float timelineHeight = hasTimeline ? 10.0f : 0.0f;
+    g.textY = ((float)height - lineHeight - timelineHeight) / 2.0f;
+    g.hasTimeline = hasTimeline;
+    g.barX = g.textX;
+    // Unlike the text, which is clipped, the bar never runs under the separator
+    g.barW = contentMaxX - g.textX;
+    if (g.barW < 0) g.barW = 0;
+    g.barY = (int)(g.textY + lineHeight + 4);
+    return g;
+}
+
+// --- Layout ---
+// One layout pass per size, font or timeline change produces the geometry, the area each
+// element may paint and a per-pixel hit map. Painting and every mouse handler read from
+// here, so what is drawn and what is clickable cannot drift apart.
+enum HitTarget : uint8_t {
+    HIT_NONE,
+    HIT_PREV,  // PREV..NEXT double as g_HoverState and SendMediaCommand values
+    HIT_PLAY,
+    HIT_NEXT,
+    HIT_TIMELINE,
+    HIT_TAB,
+    HIT_COUNT
+};
+
+#define BAR_HEIGHT        5
+#define BAR_HOVER_HEIGHT  8
+#define THUMB_HIT_RADIUS  11  // Grabbing the thumb keeps its position instead of jumping
+#define HUD_LINE_HEIGHT   10
+#define HUD_LINES         4
+#define HUD_WIDTH         296
+
+struct PanelLayout {
+    // Inputs of the last pass
+    int width = 0;
+    int height = 0;
+    float lineHeight = 0.0f;
+    int fontSize = 0;
+    bool hasTimeline = false;
+    bool hud = false;
+    bool valid = false;
+
+    PanelGeometry geometry = {};
+    Rect elements[ELEMENT_COUNT];  // Largest area each element can paint
+    Rect hitRects[HIT_COUNT];
+    vector<uint8_t> hitMap;        // width * height HitTarget values, later targets on top
+
+    // Re-runs the pass only if an input changed; returns true if it did
+    bool Update(int w, int h, float newLineHeight, bool timeline) {
+        if (valid && w == width && h == height && newLineHeight == lineHeight &&
+            g_Settings.fontSize == fontSize && timeline == hasTimeline && g_Settings.perfHud == hud) {
+            return false;
+        }
+        width = w;
+        height = h;
+        lineHeight = newLineHeight;
+        fontSize = g_Settings.fontSize;
+        hasTimeline = timeline;
+        hud = g_Settings.perfHud;
+        Build();
+        valid = true;
+        return true;
+    }
+
+    HitTarget HitTest(int x, int y) const {
+        if (!valid || x < 0 || y < 0 || x >= width || y >= height) return HIT_NONE;
+        return (HitTarget)hitMap[(size_t)y * width + x];
+    }
+
+    // Bar fraction under x, clamped to 0..1
+    float TimelineFraction(int x) const {
+        if (geometry.barW <= 0) return 0.0f;
+        float rel = (float)(x - geometry.barX) / (float)geometry.barW;
+        if (rel < 0.0f) rel = 0.0f;
+        if (rel > 1.0f) rel = 1.0f;
+        return rel;
+    }
+
+    bool ThumbHit(float progress, int x, int y) const {
+        if (!valid || !geometry.hasTimeline) return false;
+        int dx = x - (geometry.barX + (int)(geometry.barW * progress));
+        int dy = y - (geometry.barY + BAR_HEIGHT / 2);
+        return dx * dx + dy * dy <= THUMB_HIT_RADIUS * THUMB_HIT_RADIUS;
+    }
+
+private:
+    void Build() {
+        const PanelGeometry& g = geometry = CalcPanelGeometry(width, height, lineHeight, hasTimeline);
+
+        elements[ELEMENT_ART] = Rect(g.artX, g.artY, g.artSize, g.artSize);
+        const int controlX[3] = { g.prevX, g.playX, g.nextX };
+        for (int i = 0; i < 3; i++) {
+            // Hover circle; the glyph sits inside it. Pixel centres are on integer
+            // coordinates, so the 24px circle reaches into a 25th row and column.
+            elements[ELEMENT_PREV + i] = Rect(controlX[i] - 8, g.controlY - 12, 25, 25);
+        }
+        elements[ELEMENT_SEPARATOR] = Rect(g.separatorX - 3, 0, width - g.separatorX + 3, height);
+        if (g.hasTimeline) {
+            // Stops where the timeline starts so progress ticks never touch the text
+            elements[ELEMENT_TEXT] = Rect(g.textX, 0, g.textMaxW, g.barY - 4);
+            // Room for the hovered bar and the thumb overhanging both ends
+            elements[ELEMENT_TIMELINE] = Rect(g.barX - 8, g.barY - 4, g.barW + 16, BAR_HOVER_HEIGHT + 8);
+            elements[ELEMENT_SCRUB_TIP] = Rect(g.textX, 0, g.separatorX - 2 - g.textX, g.barY - 2);
+        } else {
+            elements[ELEMENT_TEXT] = Rect(g.textX, 0, g.textMaxW, height);
+            elements[ELEMENT_TIMELINE] = Rect(0, 0, 0, 0);
+            elements[ELEMENT_SCRUB_TIP] = Rect(0, 0, 0, 0);
+        }
+        elements[ELEMENT_HUD] = hud ? Rect(2, 2, min(width - 4, HUD_WIDTH), HUD_LINES * HUD_LINE_HEIGHT + 4)
+                                    : Rect(0, 0, 0, 0);
+
+        // Controls split the strip between them, 28px centred on each circle, and always
+        // cover the circle itself
+        hitRects[HIT_NONE] = Rect(0, 0, 0, 0);
+        for (int i = 0; i < 3; i++) {
+            const Rect& circle = elements[ELEMENT_PREV + i];
+            Rect band(circle.X - 2, 10, 28, height - 20);
+            Rect::Union(hitRects[HIT_PREV + i], band, circle);
+        }
+        // Includes the columns the bar's rounded ends and border reach
+        hitRects[HIT_TIMELINE] = g.hasTimeline ? Rect(g.barX - 1, g.barY - 4, g.barW + 3, BAR_HOVER_HEIGHT + 8)
+                                               : Rect(0, 0, 0, 0);
+        // Tab zone starts 5px left of the separator for easier targeting, and spans the
+        // separator line from end to end
+        hitRects[HIT_TAB] = Rect(g.separatorX - 5, 6, width - g.separatorX + 5, height - 11);
+
+        hitMap.assign((size_t)width * height, HIT_NONE);
+        for (int t = HIT_PREV; t < HIT_COUNT; t++) {
+            Rect r = hitRects[t];
+            int x0 = r.X < 0 ? 0 : r.X;
+            int y0 = r.Y < 0 ? 0 : r.Y;
+            int x1 = r.X + r.Width > width ? width : r.X + r.Width;
+            int y1 = r.Y + r.Height > height ? height : r.Y + r.Height;
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) hitMap[(size_t)y * width + x] = (uint8_t)t;
+            }
+        }
+    }
+} g_Layout;
+
+int TimelineProgressWidth(const PanelGeometry& g, const MediaSnapshot& state, double position) {
+    float progress = (float)(position / state.duration);
+    if (progress < 0.0f || isnan(progress)) progress = 0.0f;
+    if (progress > 1.0f) progress = 1.0f;
+    float drawProgress = g_TimelineDragging ? g_TimelineDragProgress : progress;
+    return (int)(g.barW * drawProgress);
+}
+
+// --- Panel Parts ---
+// The parts of the panel the mouse handlers hit-test. Drawn from the same geometry the
+// layout builds its hit map from; DrawMediaPanel paints them and the tests check every
+// pixel they cover against HitTest.
+
+// One transport control, HIT_PREV..HIT_NEXT, over its hover circle
+void DrawControl(Renderer& renderer, const PanelGeometry& g, int hit, bool playing, bool hovered,
+                 uint32_t color, uint32_t activeBg) {
+    const int controlX[3] = { g.prevX, g.playX, g.nextX };
+    int x = controlX[hit - HIT_PREV];
+    int y = g.controlY;
+    if (hovered) renderer.FillEllipse((float)(x - 8), (float)(y - 12), 24, 24, activeBg);
+    if (hit == HIT_PREV) {
+        float pts[6] = { (float)(x + 8), (float)(y - 6), (float)(x + 8), (float)(y + 6), (float)x, (float)y };
+        renderer.FillPolygon(pts, 3, color);
+        renderer.FillRect((float)x, (float)(y - 6), 2, 12, color);
+    } else if (hit == HIT_PLAY && playing) {
+        renderer.FillRect((float)x, (float)(y - 7), 3, 14, color);
+        renderer.FillRect((float)(x + 6), (float)(y - 7), 3, 14, color);
+    } else if (hit == HIT_PLAY) {
+        float pts[6] = { (float)x, (float)(y - 8), (float)x, (float)(y + 8), (float)(x + 10), (float)y };
+        renderer.FillPolygon(pts, 3, color);
+    } else {
+        float pts[6] = { (float)x, (float)(y - 6), (float)x, (float)(y + 6), (float)(x + 8), (float)y };
+        renderer.FillPolygon(pts, 3, color);
+        renderer.FillRect((float)(x + 8), (float)(y - 6), 2, 12, color);
+    }
+}
+
+// The separator line and the music icon of the tab zone. Bold level increases smoothly
+// when hovering.
+void DrawSeparator(Renderer& renderer, const PanelGeometry& g, int height, float boldLevel, bool pinned,
+                   const ThemePalette& palette) {
+    int separatorX = g.separatorX;
+    float lineThickness = 1.0f + (boldLevel * 2.5f);  // 1.0 to 3.5px
+    renderer.DrawLine((float)separatorX, 6, (float)separatorX, (float)(height - 6), palette.Separator(boldLevel), lineThickness);
+
+    // Draw music icon in hover area
+    int iconX = separatorX + 7;
+    int iconY = height / 2;
+    uint32_t noteColor = palette.note;
+
+    // Draw two musical notes (simplified as circles with stems)
+    // First note
+    int note1X = iconX - 3;
+    int note1Y = iconY + 1;
+    renderer.FillEllipse((float)(note1X - 2), (float)note1Y, 4, 3, noteColor);
+    renderer.DrawLine((float)note1X, (float)(note1Y - 3), (float)note1X, (float)note1Y, noteColor, 1.0f);
+
+    // Second note (higher)
+    int note2X = iconX + 3;
+    int note2Y = iconY - 2;
+    renderer.FillEllipse((float)(note2X - 2), (float)note2Y, 4, 3, noteColor);
+    renderer.DrawLine((float)note2X, (float)(note2Y - 3), (float)note2X, (float)note2Y, noteColor, 1.0f);
+
+    // Connecting beam
+    renderer.DrawLine((float)note1X, (float)(note1Y - 3), (float)note2X, (float)(note2Y - 3), noteColor, 1.0f);
+
+    // Dot while a session is pinned (right-click cycles)
+    if (pinned) renderer.FillEllipse((float)(iconX - 2), 8, 4, 4, noteColor);
+}
+
+// The bar with its progress; 'active' (hovered or dragging) thickens it and shows the
+// seek thumb at the end of the progress
+void DrawTimelineBar(Renderer& renderer, const PanelGeometry& g, int progressWidth, bool active,
+                     const ThemePalette& palette) {
+    int barHeight = active ? BAR_HOVER_HEIGHT : BAR_HEIGHT;
+    int barX = g.barX;
+    int barW = g.barW;
+    int barY = g.barY;
+
+    // Draw rounded background bar
+    float radius = barHeight / 2.0f;
+    renderer.FillRoundRect((float)barX, (float)barY, (float)barW, (float)barHeight, radius, palette.barBg);
+    renderer.DrawRoundRect((float)barX, (float)barY, (float)barW, (float)barHeight, radius, palette.barBorder, 1.5f);
+
+    // Draw progress (rounded)
+    if (progressWidth > 0) {
+        renderer.FillRoundRect((float)barX, (float)barY, (float)progressWidth, (float)barHeight, radius, palette.barFg);
+    }
+
+    if (active) {
+        int cx = barX + progressWidth;
+        int cy = barY + barHeight / 2;
+        int thumbRadius = barHeight / 2 + 2; // Smaller thumb
+        float thumbX = (float)(cx - thumbRadius), thumbY = (float)(cy - thumbRadius), thumbD = (float)(thumbRadius * 2);
+        renderer.FillEllipse(thumbX, thumbY, thumbD, thumbD, palette.thumb);
+        renderer.DrawEllipse(thumbX, thumbY, thumbD, thumbD, palette.thumbBorder, 1.5f);
+    }
+}
+
+// --- Text ---
+struct TextExtent {
+    float width = 0.0f;
+    float height = 0.0f;
+};
+
+// Draws text into premultiplied images. Swappable so text can be produced without GDI+,
+// e.g. from a canned glyph set when rendering headlessly.
+class GlyphProvider {
+public:
+    virtual ~GlyphProvider() {}
+    virtual TextExtent Measure(const wstring& text, int pixelSize) = 0;
+    // Draws 'text' in the title font with its layout box at (x, y)
+    virtual void DrawText(ArtImage& target, const wstring& text, int pixelSize, float x, float y, uint32_t argb) = 0;
+};
+
+#ifndef MUSIC_WIDGET_HEADLESS
+// Fonts by (family, pixel size, style), each made once. The title, the HUD and the scrub
+// tip draw at different sizes in the same frame, so keeping only the last one would
+// rebuild a font on every switch. Entries live until Reset (after a DPI change or before
+// GDI+ shuts down); only a settings change adds a new size.
+class FontCache {
+public:
+    Font* Get(int pixelSize, int style = FontStyleBold, const WCHAR* family = FONT_NAME) {
+        auto key = make_tuple(wstring(family), pixelSize, style);
+        auto it = m_fonts.find(key);
+        if (it != m_fonts.end()) return it->second.get();
+        unique_ptr<FontFamily>& fontFamily = m_families[get<0>(key)];
+        if (!fontFamily) fontFamily.reset(new FontFamily(family, nullptr));
+        unique_ptr<Font>& font = m_fonts[key];
+        font.reset(new Font(fontFamily.get(), (REAL)pixelSize, style, UnitPixel));
+        return font.get();
+    }
+
+    void Reset() {
+        m_fonts.clear();
+        m_families.clear();
+    }
+
+private:
+    map<wstring, unique_ptr<FontFamily>> m_families;  // Declared first so they outlive the fonts
+    map<tuple<wstring, int, int>, unique_ptr<Font>> m_fonts;
+} g_Fonts;
+
+#define TEXT_MEASURE_CAPACITY 64
+
+// Bounded LRU of MeasureString results keyed by (font, size, text), so flipping between
+// tracks or sessions does not lay the same strings out again
+class TextMeasureCache {
+public:
+    TextExtent Measure(const wstring& text, int pixelSize) {
+        wstring key = wstring(FONT_NAME) + L'|' + to_wstring(pixelSize) + L'|' + text;
+        auto it = m_index.find(key);
+        if (it != m_index.end()) {
+            g_PerfTextHits++;
+            m_entries.splice(m_entries.begin(), m_entries, it->second);
+            return it->second->extent;
+        }
+        g_PerfTextMisses++;
+
+        if (!m_graphics) {
+            m_probe.reset(new Bitmap(1, 1, PixelFormat32bppPARGB));
+            m_graphics.reset(new Graphics(m_probe.get()));
+            m_graphics->SetTextRenderingHint(TextRenderingHintAntiAlias);
+        }
+        RectF layoutRect(0, 0, 2000, 100);
+        RectF boundRect;
+        m_graphics->MeasureString(text.c_str(), -1, g_Fonts.Get(pixelSize), layoutRect, &boundRect);
+        TextExtent extent;
+        extent.width = boundRect.Width;
+        extent.height = boundRect.Height;
+
+        m_entries.push_front({ key, extent });
+        m_index[key] = m_entries.begin();
+        while (m_entries.size() > TEXT_MEASURE_CAPACITY) {
+            m_index.erase(m_entries.back().key);
+            m_entries.pop_back();
+        }
+        return extent;
+    }
+
+    void Clear() {
+        m_entries.clear();
+        m_index.clear();
+        m_graphics.reset();
+        m_probe.reset();
+    }
+
+private:
+    struct Entry {
+        wstring key;
+        TextExtent extent;
+    };
+
+    list<Entry> m_entries;  // Most recently used first
+    unordered_map<wstring, list<Entry>::iterator> m_index;
+    unique_ptr<Bitmap> m_probe;
+    unique_ptr<Graphics> m_graphics;  // Declared after m_probe so it is destroyed first
+} g_TextMeasure;
+
+class GdiplusGlyphProvider : public GlyphProvider {
+public:
+    TextExtent Measure(const wstring& text, int pixelSize) override {
+        return g_TextMeasure.Measure(text, pixelSize);
+    }
+
+    void DrawText(ArtImage& target, const wstring& text, int pixelSize, float x, float y, uint32_t argb) override {
+        if (target.width <= 0 || target.height <= 0) return;
+        if (!m_brush) m_brush.reset(new SolidBrush(Color(argb)));
+        m_brush->SetColor(Color(argb));
+        g_GdiplusViews.GraphicsFor(target)->DrawString(text.c_str(), -1, g_Fonts.Get(pixelSize), PointF(x, y), m_brush.get());
+    }
+
+    // Before GDI+ shuts down
+    void Reset() {
+        m_brush.reset();
+    }
+
+private:
+    unique_ptr<SolidBrush> m_brush;  // Made after GDI+ starts, recoloured per call
+} g_GdiplusGlyphs;
+
+GlyphProvider* g_Glyphs = &g_GdiplusGlyphs;
+#else
+// Headless builds have no fonts: whoever renders installs a provider first
+GlyphProvider* g_Glyphs = nullptr;
+#endif
+
+// --- Marquee ---
+// The title line is rasterized once per text/font/colour change into a strip holding
+// the text twice, MARQUEE_GAP apart. Scrolling is then a clipped blit of that strip at
+// a fractional offset, so frames cost no text layout at all.
+#define MARQUEE_GAP       40
+#define MARQUEE_PAD       2      // Transparent border so bilinear edges fade to nothing
+#define MARQUEE_SPEED     62.5f  // px per second
+#define MARQUEE_PAUSE_MS  1000   // Rest at the start of every lap
+
+struct MarqueeStrip {
+    wstring text;
+    int fontSize = 0;
+    int textWidth = 0;
+    float lineHeight = 0.0f;
+    DWORD color = 0;
+    bool wrap = false;
+    bool measured = false;
+    bool rendered = false;
+    ArtImage strip;
+
+    // Distance after which the doubled strip repeats itself
+    int Period() const { return textWidth + MARQUEE_GAP; }
+
+    // Returns true if the text or font changed; layout runs only then
+    bool Measure(const wstring& newText, int newFontSize) {
+        if (measured && newText == text && newFontSize == fontSize) return false;
+        text = newText;
+        fontSize = newFontSize;
+        rendered = false;
+
+        TextExtent extent = g_Glyphs->Measure(text, fontSize);
+        textWidth = (int)ceilf(extent.width);
+        lineHeight = extent.height;
+        measured = true;
+        return true;
+    }
+
+    // Rasterizes the strip if the colour or wrap mode changed since the last call
+    const ArtImage* Render(DWORD newColor, bool newWrap) {
+        if (rendered && newColor == color && newWrap == wrap) return &strip;
+        color = newColor;
+        wrap = newWrap;
+        rendered = false;
+        int w = MARQUEE_PAD * 2 + textWidth + (wrap ? Period() : 0);
+        int h = (int)ceilf(lineHeight);
+        if (textWidth <= 0 || h <= 0) return nullptr;
+
+        strip.width = w;
+        strip.height = h;
+        strip.pixels.assign((size_t)w * h, 0);
+        g_Glyphs->DrawText(strip, text, fontSize, (float)MARQUEE_PAD, 0.0f, color);
+        if (wrap) {
+            g_Glyphs->DrawText(strip, text, fontSize, (float)(MARQUEE_PAD + Period()), 0.0f, color);
+        }
+        rendered = true;
+        return &strip;
+    }
+
+    void Reset() {
+        rendered = false;
+        strip = ArtImage();
+        text.clear();
+        fontSize = 0;
+        measured = false;
+    }
+} g_Marquee;
+
+// Scroll offset at 'now': a pause, then a constant-speed lap of exactly one period,
+// which lands on a frame identical to offset 0. Independent of how often we paint.
+float MarqueeOffset(double now) {
+    if (!g_IsScrolling) return 0.0f;
+    double lapMs = MARQUEE_PAUSE_MS + g_Marquee.Period() * 1000.0 / MARQUEE_SPEED;
+    double phase = fmod(now - g_ScrollStartTime, lapMs);
+    if (phase < MARQUEE_PAUSE_MS) return 0.0f;
+    return (float)((phase - MARQUEE_PAUSE_MS) * MARQUEE_SPEED / 1000.0);
+}
+
+// Frame step for the marquee: sleeps through the rest at the start of each lap
+double MarqueeStep(double now) {
+    if (!g_IsScrolling) return FRAME_DONE;
+    double lapMs = MARQUEE_PAUSE_MS + g_Marquee.Period() * 1000.0 / MARQUEE_SPEED;
+    double phase = fmod(now - g_ScrollStartTime, lapMs);
+    if (phase < MARQUEE_PAUSE_MS) return now + (MARQUEE_PAUSE_MS - phase);
+    return now;
+}
+
+uint64_t MixKey(uint64_t key, uint64_t value) {
+    key ^= value + 0x9E3779B97F4A7C15ull + (key << 6) + (key >> 2);
+    return key;
+}
+
+uint64_t HashText(const wstring& text) {
+    uint64_t hash = 14695981039346656037ull;
+    for (wchar_t c : text) {
+        hash ^= (uint64_t)c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// --- Track Transition ---
+// On a track change the old cover crossfades into the new one while the old title slides
+// up and out and the new one rises into its place. The art blends are computed once per
+// transition from the cached display-sized covers, and each faded title strip once per
+// blend step, all with the image kernels, so a frame is still only blits. If the new
+// cover is not there yet, the old one stays up for ART_HOLD_MS rather than flashing the
+// placeholder, and fades over once it arrives.
+#define TRANSITION_MS     280.0
+#define TRANSITION_STEPS  8      // Precomputed blends per transition
+#define TRANSITION_SLIDE  8.0f   // px each title travels
+#define ART_HOLD_MS       1500.0
+
+double TransitionStep(double now);
+
+class TrackTransition {
+public:
+    // Call with the snapshot being laid out, before the marquee measures its text: the
+    // outgoing title is taken from the marquee strip here
+    void Update(const MediaSnapshot& state, double now, float textX, float textY) {
+        uint64_t track = MixKey(MixKey(HashText(state.sessionId), HashText(state.title)), HashText(state.artist));
+        if (!m_started) {
+            m_started = true;
+            m_track = track;
+            m_art = state.albumArt;
+            return;
+        }
+        if (track != m_track) {
+            m_track = track;
+            // The cover on screen right now is the one to leave from
+            shared_ptr<const ArtImage> from = m_artStart >= 0.0 ? m_to : (Holding(now) ? m_from : m_art);
+            m_artStart = -1.0;
+            m_holdUntil = 0.0;
+            m_from = from;
+            if (state.albumArt) BeginArt(state.albumArt, now);
+            else if (from) m_holdUntil = now + ART_HOLD_MS;
+
+            m_oldStrip = ArtImage();
+            if (g_Marquee.rendered) {
+                m_oldStrip = g_Marquee.strip;
+                m_oldX = textX - MARQUEE_PAD - g_ScrollOffset;
+                m_oldY = textY;
+            }
+            m_oldFaded.assign(TRANSITION_STEPS, ArtImage());
+            m_newFaded.assign(TRANSITION_STEPS, ArtImage());
+            m_newColor = 0;
+            m_textStart = now;
+            g_Frames.Start(ANIM_TRANSITION, TransitionStep);
+        } else if (state.albumArt != m_art && state.albumArt && Holding(now)) {
+            // The new cover arrived while the old one was held
+            m_holdUntil = 0.0;
+            BeginArt(state.albumArt, now);
+            g_Frames.Start(ANIM_TRANSITION, TransitionStep);
+        }
+        m_art = state.albumArt;
+    }
+
+    // Fixes the blend step and slide position for this frame; called from BuildScene
+    void Sample(double now) {
+        m_holding = Holding(now);
+        m_artStep = Step(m_artStart, now);
+        if (m_artStep == TRANSITION_STEPS && m_artStart >= 0.0) {
+            m_artStart = -1.0;
+            m_blends.clear();
+        }
+        if (m_artStart < 0.0 && !m_holding) m_from.reset();
+        m_textStep = Step(m_textStart, now);
+        if (m_textStep == TRANSITION_STEPS && m_textStart >= 0.0) {
+            m_textStart = -1.0;
+            m_oldStrip = ArtImage();
+            m_oldFaded.clear();
+            m_newFaded.clear();
+        }
+    }
+
+    double NextDue(double now) const {
+        if (m_artStart >= 0.0 || m_textStart >= 0.0) return now;
+        // Wake once more when the hold runs out, so the placeholder shows
+        if (Holding(now)) return m_holdUntil;
+        if (m_holding) return now;
+        return FRAME_DONE;
+    }
+
+    uint64_t ArtKey() const { return MixKey((uint64_t)m_artStep, m_holding); }
+    uint64_t TextKey() const { return (uint64_t)m_textStep; }
+
+    // Cover to draw in place of 'art' during a transition or hold. Sets 'overPlaceholder'
+    // when the result is a fade-in that needs the placeholder drawn underneath.
+    const ArtImage* Art(const ArtImage* art, bool& overPlaceholder) const {
+        overPlaceholder = false;
+        if (m_artStep < TRANSITION_STEPS) {
+            if (m_artStep == 0) {
+                overPlaceholder = !m_from;
+                return m_from ? m_from.get() : nullptr;
+            }
+            overPlaceholder = !m_from;
+            return &m_blends[m_artStep - 1];
+        }
+        if (!art && m_holding && m_from) return m_from.get();
+        return art;
+    }
+
+    bool Sliding() const { return m_textStep < TRANSITION_STEPS; }
+
+    // Eased 0..1 progress of the title slide
+    float TextProgress() const {
+        float t = (float)m_textStep / TRANSITION_STEPS;
+        return t * t * (3.0f - 2.0f * t);
+    }
+
+    // The outgoing title faded for this step, or null once it has gone
+    const ArtImage* OldText(float& x, float& y) {
+        if (!Sliding() || m_oldStrip.width <= 0) return nullptr;
+        x = m_oldX;
+        y = m_oldY - TRANSITION_SLIDE * TextProgress();
+        return Faded(m_oldStrip, m_oldFaded, TRANSITION_STEPS - m_textStep);
+    }
+
+    // The incoming title strip faded for this step
+    const ArtImage* NewText(const ArtImage& strip, DWORD color) {
+        if (color != m_newColor || m_newFaded.empty()) {
+            // Re-rendered in another colour meanwhile
+            m_newColor = color;
+            m_newFaded.assign(TRANSITION_STEPS, ArtImage());
+        }
+        return Faded(strip, m_newFaded, m_textStep);
+    }
+
+    void Reset() {
+        *this = TrackTransition();
+    }
+
+private:
+    bool Holding(double now) const { return m_holdUntil > now; }
+
+    static int Step(double start, double now) {
+        if (start < 0.0) return TRANSITION_STEPS;
+        int step = (int)((now - start) / TRANSITION_MS * TRANSITION_STEPS);
+        return step < 0 ? 0 : min(step, TRANSITION_STEPS);
+    }
+
+    // Step k of the fade holds 'from' blended k/TRANSITION_STEPS of the way to 'to'; the
+    // last step is 'to' itself and needs no copy. Without a same-sized 'from' the steps
+    // fade 'to' in over the placeholder instead.
+    void BeginArt(shared_ptr<const ArtImage> to, double now) {
+        if (m_from && (m_from->width != to->width || m_from->height != to->height)) m_from.reset();
+        m_to = to;
+        m_artStart = now;
+        m_blends.assign(TRANSITION_STEPS - 1, ArtImage());
+        vector<uint32_t> incoming;
+        vector<uint8_t> weight(to->pixels.size());
+        for (int k = 1; k < TRANSITION_STEPS; k++) {
+            ArtImage& blend = m_blends[k - 1];
+            fill(weight.begin(), weight.end(), (uint8_t)(255 * k / TRANSITION_STEPS));
+            if (m_from) {
+                blend = *m_from;
+                incoming = to->pixels;
+                g_Kernels.applyMask(incoming.data(), weight.data(), incoming.size());
+                g_Kernels.blendOver(blend.pixels.data(), incoming.data(), incoming.size());
+            } else {
+                blend = *to;
+                g_Kernels.applyMask(blend.pixels.data(), weight.data(), blend.pixels.size());
+            }
+        }
+    }
+
+    // 'strip' at 'step' / TRANSITION_STEPS opacity, made on first use
+    static const ArtImage* Faded(const ArtImage& strip, vector<ArtImage>& cache, int step) {
+        if (step >= TRANSITION_STEPS) return &strip;
+        if (step <= 0) return nullptr;
+        ArtImage& faded = cache[step];
+        if (faded.width != strip.width || faded.height != strip.height) {
+            faded = strip;
+            vector<uint8_t> weight(strip.pixels.size(), (uint8_t)(255 * step / TRANSITION_STEPS));
+            g_Kernels.applyMask(faded.pixels.data(), weight.data(), faded.pixels.size());
+        }
+        return &faded;
+    }
+
+    bool m_started = false;
+    uint64_t m_track = 0;
+    shared_ptr<const ArtImage> m_art;   // Cover of the last snapshot drawn
+    shared_ptr<const ArtImage> m_from;  // Cover being left, or held
+    shared_ptr<const ArtImage> m_to;
+    vector<ArtImage> m_blends;          // Steps 1 .. TRANSITION_STEPS - 1
+    double m_artStart = -1.0;           // Negative when not fading
+    double m_holdUntil = 0.0;
+    bool m_holding = false;
+    int m_artStep = TRANSITION_STEPS;
+
+    ArtImage m_oldStrip;
+    float m_oldX = 0.0f;
+    float m_oldY = 0.0f;
+    vector<ArtImage> m_oldFaded;
+    vector<ArtImage> m_newFaded;
+    DWORD m_newColor = 0;
+    double m_textStart = -1.0;
+    int m_textStep = TRANSITION_STEPS;
+} g_Transition;
+
+double TransitionStep(double now) {
+    return g_Transition.NextDue(now);
+}
+
+// --- Performance HUD ---
+#define HUD_FONT_SIZE    8
+#define HUD_INTERVAL_MS  500.0
+
+// Refreshed on its own cadence rather than per paint, so showing the stats does not
+// itself keep the panel repainting
+wstring g_HudText;
+ArtImage g_HudImage;
+uint64_t g_HudImageKey = 0;
+double g_HudLastTime = 0.0;
+uint64_t g_HudLastFrames = 0;
+uint64_t g_HudLastPixels = 0;
+
+int HitRatePercent(uint64_t hits, uint64_t misses) {
+    return hits + misses ? (int)(hits * 100 / (hits + misses)) : 0;
+}
+
+double HudStep(double now) {
+    double fps = 0.0;
+    if (g_HudLastTime > 0.0 && now > g_HudLastTime) {
+        fps = (g_PerfFrames - g_HudLastFrames) * 1000.0 / (now - g_HudLastTime);
+    }
+    // Pixels repainted per frame: how much of the panel the dirty rectangles really cover
+    double pixels = g_PerfFrames > g_HudLastFrames ?
+        (double)(g_PerfPixels - g_HudLastPixels) / (g_PerfFrames - g_HudLastFrames) : 0.0;
+    g_HudLastTime = now;
+    g_HudLastFrames = g_PerfFrames;
+    g_HudLastPixels = g_PerfPixels;
+
+    WCHAR timer[16];
+    swprintf_s(timer, g_Frames.ArmedDelay() ? L"%ums" : L"idle", g_Frames.ArmedDelay());
+    WCHAR text[512];
+    swprintf_s(text,
+               L"%.0f fps  paint %.2f/%.2f ms  %.1fk px  timer %ls\n"
+               L"props %.1f/%.1f  timeline %.1f/%.1f  cmd %.1f/%.1f ms\n"
+               L"decode %.1f/%.1f ms  art hit %d%%  text hit %d%%\n"
+               L"click %.0f/%.0f  confirm %.0f/%.0f  seek %.0f/%.0f ms  scrub %llu/%llu",
+               fps, g_PerfPaint.Percentile(0.5), g_PerfPaint.Percentile(0.99), pixels / 1000.0, timer,
+               g_PerfProperties.Percentile(0.5), g_PerfProperties.Percentile(0.99),
+               g_PerfTimeline.Percentile(0.5), g_PerfTimeline.Percentile(0.99),
+               g_PerfCommands.Percentile(0.5), g_PerfCommands.Percentile(0.99),
+               g_PerfDecode.Percentile(0.5), g_PerfDecode.Percentile(0.99),
+               HitRatePercent(g_PerfArtHits.load(memory_order_relaxed), g_PerfArtMisses.load(memory_order_relaxed)),
+               HitRatePercent(g_PerfTextHits, g_PerfTextMisses),
+               g_PerfClickToPaint.Percentile(0.5), g_PerfClickToPaint.Percentile(0.99),
+               g_PerfCommandConfirm.Percentile(0.5), g_PerfCommandConfirm.Percentile(0.99),
+               g_PerfSeek.Percentile(0.5), g_PerfSeek.Percentile(0.99),
+               (unsigned long long)g_PerfScrubSeeks, (unsigned long long)g_PerfScrubDropped);
+    g_HudText = text;
+    return now + HUD_INTERVAL_MS;
+}
+
+void UpdateHudAnimation() {
+    if (g_Settings.perfHud && !g_Frames.IsRunning(ANIM_HUD)) {
+        g_HudLastTime = 0.0;
+        g_Frames.Start(ANIM_HUD, HudStep);
+    } else if (!g_Settings.perfHud) {
+        g_Frames.Stop(ANIM_HUD);
+        g_HudText.clear();
+    }
+}
+
+// Dark translucent card with one line of text per row, rebuilt when the text changes
+const ArtImage* RenderHud(int width) {
+    uint64_t key = MixKey(HashText(g_HudText), (uint64_t)width);
+    if (key == g_HudImageKey && !g_HudImage.pixels.empty()) return &g_HudImage;
+    g_HudImageKey = key;
+    g_HudImage.width = width;
+    g_HudImage.height = HUD_LINES * HUD_LINE_HEIGHT + 4;
+    g_HudImage.pixels.assign((size_t)g_HudImage.width * g_HudImage.height, 0xB0000000);
+    size_t start = 0;
+    for (int line = 0; line < HUD_LINES && start <= g_HudText.size(); line++) {
+        size_t end = g_HudText.find(L'\n', start);
+        if (end == wstring::npos) end = g_HudText.size();
+        g_Glyphs->DrawText(g_HudImage, g_HudText.substr(start, end - start), HUD_FONT_SIZE,
+                           3.0f, 2.0f + line * HUD_LINE_HEIGHT, 0xFFFFFFFF);
+        start = end + 1;
+    }
+    return &g_HudImage;
+}
+
+// --- Scrub Tooltip ---
+// Target and track length above the thumb while the timeline is dragged
+#define SCRUB_TIP_FONT_SIZE 9
+
+wstring g_ScrubTipText;
+int g_ScrubTipWidth = 0;
+int g_ScrubTipHeight = 0;
+ArtImage g_ScrubTipImage;
+bool g_ScrubTipRendered = false;
+
+// m:ss, or h:mm:ss from an hour on
+wstring FormatTime(double seconds) {
+    int total = seconds > 0.0 ? (int)seconds : 0;
+    WCHAR text[16];
+    if (total >= 3600) swprintf_s(text, L"%d:%02d:%02d", total / 3600, total / 60 % 60, total % 60);
+    else swprintf_s(text, L"%d:%02d", total / 60, total % 60);
+    return text;
+}
+
+// Measured again only when the text changes, i.e. about once per second of target
+void UpdateScrubTip(double target, double duration) {
+    wstring text = FormatTime(target) + L" / " + FormatTime(duration);
+    if (text == g_ScrubTipText) return;
+    g_ScrubTipText = text;
+    TextExtent extent = g_Glyphs->Measure(text, SCRUB_TIP_FONT_SIZE);
+    g_ScrubTipWidth = (int)ceilf(extent.width) + 8;
+    g_ScrubTipHeight = (int)ceilf(extent.height) + 2;
+    g_ScrubTipRendered = false;
+}
+
+const ArtImage* RenderScrubTip() {
+    if (g_ScrubTipRendered) return &g_ScrubTipImage;
+    g_ScrubTipImage.width = g_ScrubTipWidth;
+    g_ScrubTipImage.height = g_ScrubTipHeight;
+    g_ScrubTipImage.pixels.assign((size_t)g_ScrubTipWidth * g_ScrubTipHeight, 0xC0000000);
+    g_Glyphs->DrawText(g_ScrubTipImage, g_ScrubTipText, SCRUB_TIP_FONT_SIZE, 4.0f, 1.0f, 0xFFFFFFFF);
+    g_ScrubTipRendered = true;
+    return &g_ScrubTipImage;
+}
+
+void ResetScrubTip() {
+    g_ScrubTipText.clear();
+    g_ScrubTipImage = ArtImage();
+    g_ScrubTipRendered = false;
+}
+
+wstring PanelText(const MediaSnapshot& state) {
+    wstring fullText = state.title;
+    if (!state.artist.empty()) fullText += L" • " + state.artist;
+    return fullText;
+}
+
+// Recomputes bounds and keys from the current state; cheap enough to run on every event
+void BuildScene(PanelScene& scene, const PanelLayout& layout, const MediaSnapshot& state, double position) {
+    const PanelGeometry& g = layout.geometry;
+    uint64_t color = g_Palette.text;
+    for (int i = 0; i < ELEMENT_COUNT; i++) scene.bounds[i] = layout.elements[i];
+
+    // Everything sits on the backdrop, so a new one redraws the whole panel
+    shared_ptr<const ArtImage> backdrop = state.backdrop;
+    if (backdrop && (backdrop->width != layout.width || backdrop->height != layout.height || !g_Settings.blurredBackdrop)) {
+        backdrop.reset();  // Stale until the worker catches up
+    }
+    if (backdrop != scene.backdrop) {
+        scene.backdrop = move(backdrop);
+        scene.InvalidateAll();
+    }
+
+    g_Transition.Sample(g_Frames.Now());
+    // Keyed on the generation, not the address, which a later cover can reuse
+    scene.keys[ELEMENT_ART] = MixKey(state.artGeneration, (uint64_t)g.artSize);
+    scene.keys[ELEMENT_ART] = MixKey(scene.keys[ELEMENT_ART], g_Transition.ArtKey());
+    for (int i = 0; i < 3; i++) {
+        scene.keys[ELEMENT_PREV + i] = MixKey(MixKey(color, g_HoverState == i + 1), ControlEnabled(state, HIT_PREV + i));
+    }
+    scene.keys[ELEMENT_PLAY] = MixKey(scene.keys[ELEMENT_PLAY], g_Commands.IsPlaying(state));
+
+    scene.keys[ELEMENT_SEPARATOR] = MixKey(MixKey(color, (uint64_t)(g_HoverBoldLevel * 1000.0f)), state.sessionPinned);
+
+    uint64_t textKey = MixKey(color, HashText(PanelText(state)));
+    textKey = MixKey(textKey, g_Commands.Skipping());
+    textKey = MixKey(textKey, (uint64_t)g_Settings.fontSize);
+    // The offset follows the clock, so sample it here together with everything else
+    g_ScrollOffset = MarqueeOffset(g_Frames.Now());
+    textKey = MixKey(textKey, (uint64_t)(g_ScrollOffset * 8.0f));  // 1/8 px steps
+    textKey = MixKey(textKey, (uint64_t)(g.textY * 16.0f));
+    textKey = MixKey(textKey, g_Transition.TextKey());
+    scene.keys[ELEMENT_TEXT] = textKey;
+    scene.position = position;
+    scene.progressWidth = g.hasTimeline ? TimelineProgressWidth(g, state, position) : 0;
+    if (g.hasTimeline) {
+        uint64_t timelineKey = MixKey(color, (uint64_t)scene.progressWidth);
+        timelineKey = MixKey(timelineKey, g_TimelineHover || g_TimelineDragging);
+        scene.keys[ELEMENT_TIMELINE] = timelineKey;
+    } else {
+        scene.keys[ELEMENT_TIMELINE] = 0;
+    }
+    if (g.hasTimeline && g_TimelineDragging) {
+        // Centred over the thumb, kept inside the area the layout gives it
+        UpdateScrubTip(g_TimelineDragProgress * state.duration, state.duration);
+        const Rect& area = layout.elements[ELEMENT_SCRUB_TIP];
+        int x = g.barX + (int)(g.barW * g_TimelineDragProgress) - g_ScrubTipWidth / 2;
+        if (x > area.X + area.Width - g_ScrubTipWidth) x = area.X + area.Width - g_ScrubTipWidth;
+        if (x < area.X) x = area.X;
+        int y = area.Y + area.Height - g_ScrubTipHeight;
+        if (y < area.Y) y = area.Y;
+        scene.bounds[ELEMENT_SCRUB_TIP] = Rect(x, y, min(g_ScrubTipWidth, area.Width), min(g_ScrubTipHeight, area.Height));
+        scene.keys[ELEMENT_SCRUB_TIP] = HashText(g_ScrubTipText);
+    } else {
+        scene.bounds[ELEMENT_SCRUB_TIP] = Rect(0, 0, 0, 0);
+        scene.keys[ELEMENT_SCRUB_TIP] = 0;
+    }
+    scene.keys[ELEMENT_HUD] = g_Settings.perfHud ? HashText(g_HudText) : 0;
+}
+
+// Brings the layout and scene up to date with 'state': measures the title, lays the
+// panel out, runs the marquee and keys every element. A font change marks everything.
+void UpdateScene(const MediaSnapshot& state, int width, int height) {
+    // Takes the outgoing title from the marquee, so it runs before the new text is measured
+    g_Transition.Update(state, g_Frames.Now(), (float)g_Layout.geometry.textX, g_Layout.geometry.textY);
+    bool textChanged = g_Marquee.Measure(PanelText(state), g_Settings.fontSize);
+    if (g_Marquee.lineHeight != g_TextLineHeight) {
+        // Font changed: every text-relative position moves
+        g_TextLineHeight = g_Marquee.lineHeight;
+        g_Scene.InvalidateAll();
+    }
 
+    g_Layout.Update(width, height, g_TextLineHeight, HasTimeline(state));
+    bool scrolling = g_Marquee.textWidth > g_Layout.geometry.textMaxW;
+    if (scrolling && (textChanged || !g_IsScrolling)) {
+        // New text starts its marquee from the beginning
+        g_ScrollStartTime = g_Frames.Now();
+        g_Frames.Start(ANIM_MARQUEE, MarqueeStep);
+    } else if (!scrolling && g_IsScrolling) {
+        g_Frames.Stop(ANIM_MARQUEE);
+    }
+    g_IsScrolling = scrolling;
+    BuildScene(g_Scene, g_Layout, state, CurrentPosition(state));
+}
 
+#ifndef MUSIC_WIDGET_HEADLESS
+// Updates the scene and invalidates exactly the elements that changed since they were
+// last drawn. WM_PAINT runs it too, before BeginPaint, so the update region always
+// covers what the paint is about to draw.
+void RefreshScene(HWND hwnd, const MediaSnapshot& state) {
+    RECT rc;
+    GetClientRect(hwnd, &rc);
+    UpdateScene(state, rc.right, rc.bottom);
 
-// Timeline seek state
-bool g_TimelineHover = false;
-bool g_TimelineDragging = false;
-float g_TimelineDragProgress = 0.0f;
+    // Art and backdrop follow the panel's size; the worker rescales from the decoded source
+    int artSize = g_Layout.geometry.artSize;
+    if (artSize != g_ArtSizeRequested) {
+        g_ArtSizeRequested = artSize;
+        g_MediaWorker.SetArtSize(artSize);
+    }
+    BackdropSpec backdropSpec;
+    if (g_Settings.blurredBackdrop) {
+        backdropSpec.width = rc.right;
+        backdropSpec.height = rc.bottom;
+        backdropSpec.light = g_LightMode;
+    }
+    if (!(backdropSpec == g_BackdropRequested)) {
+        g_BackdropRequested = backdropSpec;
+        g_MediaWorker.SetBackdrop(backdropSpec);
+    }
 
-// --- Settings ---
-void LoadSettings() {
-    g_Settings.width = Wh_GetIntSetting(L"PanelWidth");
-    g_Settings.height = Wh_GetIntSetting(L"PanelHeight");
-    g_Settings.fontSize = Wh_GetIntSetting(L"FontSize");
-    g_Settings.offsetX = Wh_GetIntSetting(L"OffsetX");
-    g_Settings.offsetY = Wh_GetIntSetting(L"OffsetY");
-    // Force visible defaults if settings are missing or invalid
-    if (g_Settings.width < 100) g_Settings.width = 400;
-    if (g_Settings.height < 24) g_Settings.height = 100;
-    if (g_Settings.offsetX < 0) g_Settings.offsetX = 100;
-    if (g_Settings.offsetY < 0) g_Settings.offsetY = 100;
-    g_Settings.autoTheme = Wh_GetIntSetting(L"AutoTheme") != 0;
-    
-    PCWSTR textHex = Wh_GetStringSetting(L"TextColor");
-    DWORD textRGB = 0xFFFFFF;
-    if (textHex) {
-        if (wcslen(textHex) > 0) textRGB = wcstoul(textHex, nullptr, 16);
-        Wh_FreeStringSetting(textHex);
+    if (g_Scene.fullRedraw) {
+        InvalidateRect(hwnd, NULL, FALSE);
+        return;
     }
-    g_Settings.manualTextColor = 0xFF000000 | textRGB;
-    
-    g_Settings.bgOpacity = Wh_GetIntSetting(L"BgOpacity");
-    if (g_Settings.bgOpacity < 0) g_Settings.bgOpacity = 0;
-    if (g_Settings.bgOpacity > 255) g_Settings.bgOpacity = 255;
+    for (int i = 0; i < ELEMENT_COUNT; i++) {
+        if (!g_Scene.IsDirty(i)) continue;
+        Rect dirty = g_Scene.DirtyRect(i);
+        RECT r = { dirty.X, dirty.Y, dirty.X + dirty.Width, dirty.Y + dirty.Height };
+        InvalidateRect(hwnd, &r, FALSE);
+    }
+}
 
-    if (g_Settings.width < 100) g_Settings.width = 300;
-    if (g_Settings.height < 24) g_Settings.height = 48;
+// Forces a full redraw, e.g. after a settings or theme change
+void InvalidateScene(HWND hwnd) {
+    g_Scene.InvalidateAll();
+    InvalidateRect(hwnd, NULL, FALSE);
 }
+#endif
 
-// --- WinRT / GSMTC ---
-GlobalSystemMediaTransportControlsSessionManager g_SessionManager = nullptr;
+// Draws the scene UpdateScene last built from 'state', which must be the snapshot it
+// was built from; nothing is laid out or keyed here
+void DrawMediaPanel(Renderer& renderer, const MediaSnapshot& state, int width, int height) {
+    TraceSpan span(TRACE_LEVEL_DEBUG, TRACE_CAT_RENDER, TRACE_PAINT);
+    ScopedLatency latency(g_PerfPaint);
+    g_PerfFrames++;
+    const ThemePalette& palette = g_Palette;
+    const PanelGeometry& g = g_Layout.geometry;
 
-Bitmap* StreamToBitmap(IRandomAccessStreamWithContentType const& stream) {
-    if (!stream) {
-        OutputDebugStringW(L"[AlbumArt] Stream is null");
-        return nullptr;
+    // Clear and redraw only the dirty rectangles; anything overlapping them is redrawn
+    // too, clipped, so the untouched parts of the back buffer stay valid
+    Rect dirtyRects[ELEMENT_COUNT];
+    bool dirty[ELEMENT_COUNT];
+    int dirtyCount = 0;
+    g_Scene.pixelsTouched = 0;
+    for (int i = 0; i < ELEMENT_COUNT; i++) {
+        dirty[i] = g_Scene.IsDirty(i);
+        if (!dirty[i] || g_Scene.fullRedraw) continue;
+        dirtyRects[dirtyCount] = g_Scene.DirtyRect(i);
+        g_Scene.pixelsTouched += (uint64_t)dirtyRects[dirtyCount].Width * dirtyRects[dirtyCount].Height;
+        dirtyCount++;
     }
-    
-    IStream* nativeStream = nullptr;
-    HRESULT hr = CreateStreamOverRandomAccessStream(reinterpret_cast<IUnknown*>(winrt::get_abi(stream)), IID_PPV_ARGS(&nativeStream));
-    if (FAILED(hr)) {
-        OutputDebugStringW(L"[AlbumArt] CreateStreamOverRandomAccessStream failed");
-        return nullptr;
+    if (g_Scene.fullRedraw) {
+        dirtyRects[0] = Rect(0, 0, width, height);
+        g_Scene.pixelsTouched = (uint64_t)width * height;
+        dirtyCount = 1;
+        g_Scene.fullRedraw = false;
     }
-    
-    if (!nativeStream) {
-        OutputDebugStringW(L"[AlbumArt] nativeStream is null");
-        return nullptr;
+    g_PerfPixels += g_Scene.pixelsTouched;
+    if (dirtyCount == 0) {
+        // Nothing changed on screen, but the paint still happened: a click whose
+        // optimistic state draws the same as before is complete all the same
+        g_Commands.MarkPainted(g_Frames.Now());
+        return;
     }
-    
-    Bitmap* bmp = Bitmap::FromStream(nativeStream, TRUE);  // TRUE = useIcm for better color handling
-    nativeStream->Release();
-    
-    if (!bmp) {
-        OutputDebugStringW(L"[AlbumArt] Bitmap::FromStream returned null");
-        return nullptr;
+
+    bool draw[ELEMENT_COUNT];
+    for (int i = 0; i < ELEMENT_COUNT; i++) {
+        draw[i] = false;
+        for (int d = 0; d < dirtyCount && !draw[i]; d++) {
+            draw[i] = g_Scene.bounds[i].IntersectsWith(dirtyRects[d]) != FALSE;
+        }
     }
-    
-    if (bmp->GetLastStatus() != Ok) {
-        WCHAR dbgMsg[256];
-        swprintf_s(dbgMsg, L"[AlbumArt] Bitmap status error: %d", bmp->GetLastStatus());
-        OutputDebugStringW(dbgMsg);
-        delete bmp;
-        return nullptr;
+
+    renderer.SetClip(dirtyRects, dirtyCount);
+    if (g_PresentPerPixel) {
+        renderer.Clear(palette.layeredClear);
+    } else {
+        renderer.Clear(0);
     }
-    
-    OutputDebugStringW(L"[AlbumArt] Bitmap loaded successfully");
-    return bmp;
-}
+    if (const ArtImage* backdrop = g_Scene.backdrop.get()) {
+        renderer.DrawImage(*backdrop, 0.0f, 0.0f, (float)width, (float)height, false);
+    }
+
+    // 1. Album Art
+    int artSize = g.artSize;
+    int artX = g.artX;
+    int artY = g.artY;
 
-void UpdateMediaInfo() {
-    try {
-        if (!g_SessionManager) {
-            g_SessionManager = GlobalSystemMediaTransportControlsSessionManager::RequestAsync().get();
+    if (draw[ELEMENT_ART]) {
+        // A crossfade step or the held previous cover while a track change is under way
+        bool overPlaceholder;
+        const ArtImage* art = g_Transition.Art(state.albumArt.get(), overPlaceholder);
+        if (!art || overPlaceholder) {
+            renderer.FillRoundRect((float)artX, (float)artY, (float)artSize, (float)artSize, ART_CORNER_RADIUS,
+                                   palette.artPlaceholder);
+        }
+        if (art && art->width == artSize && art->height == artSize) {
+            // Already display-sized: a straight 1:1 copy
+            renderer.DrawImage(*art, (float)artX, (float)artY, (float)artSize, (float)artSize, false);
+        } else if (art) {
+            // Rescale pending on the worker
+            renderer.DrawImage(*art, (float)artX, (float)artY, (float)artSize, (float)artSize, true);
         }
-        if (!g_SessionManager) return;
+    }
 
-        auto session = g_SessionManager.GetCurrentSession();
-        if (session) {
-            auto props = session.TryGetMediaPropertiesAsync().get();
-            auto info = session.GetPlaybackInfo();
+    // 2. Controls
+    uint32_t activeBg = palette.activeBg;
+    uint32_t controlColor[3];
+    for (int i = 0; i < 3; i++) {
+        if (!ControlEnabled(state, HIT_PREV + i)) controlColor[i] = palette.disabled;
+        else controlColor[i] = g_HoverState == i + 1 ? palette.hover : palette.text;
+    }
 
-            lock_guard<mutex> guard(g_MediaState.lock);
-            wstring newTitle = props.Title().c_str();
-            wstring newArtist = props.Artist().c_str();
-            
-            // Update album art if title changed, artist changed, or no art loaded
-            bool shouldUpdateArt = (newTitle != g_MediaState.title) || 
-                                   (newArtist != g_MediaState.artist) || 
-                                   (g_MediaState.albumArt == nullptr);
-            
-            if (shouldUpdateArt) {
-                if (g_MediaState.albumArt) { 
-                    delete g_MediaState.albumArt; 
-                    g_MediaState.albumArt = nullptr; 
-                }
-                
-                try {
-                    auto thumbRef = props.Thumbnail();
-                    if (thumbRef) {
-                        OutputDebugStringW(L"[AlbumArt] Thumbnail reference available, attempting load...");
-                        auto stream = thumbRef.OpenReadAsync().get();
-                        Bitmap* newArt = StreamToBitmap(stream);
-                        if (newArt) {
-                            g_MediaState.albumArt = newArt;
-                            OutputDebugStringW(L"[AlbumArt] Successfully loaded album art");
-                        } else {
-                            OutputDebugStringW(L"[AlbumArt] Failed to convert stream to bitmap");
-                        }
-                    } else {
-                        OutputDebugStringW(L"[AlbumArt] No thumbnail available for current track");
-                    }
-                } catch (const std::exception& e) {
-                    WCHAR dbgMsg[256];
-                    swprintf_s(dbgMsg, L"[AlbumArt] Exception loading thumbnail: %hs", e.what());
-                    OutputDebugStringW(dbgMsg);
-                } catch (...) {
-                    OutputDebugStringW(L"[AlbumArt] Unknown exception loading thumbnail");
-                }
-            }
-            
-            g_MediaState.title = newTitle;
-            g_MediaState.artist = newArtist;
-            g_MediaState.isPlaying = (info.PlaybackStatus() == GlobalSystemMediaTransportControlsSessionPlaybackStatus::Playing);
-            g_MediaState.hasMedia = true;
-
-            // Debug: log Spotify detection and timeline values
-            g_MediaState.isSpotify = false;
-            g_MediaState.position = 0.0;
-            g_MediaState.duration = 0.0;
-            try {
-                auto source = session.SourceAppUserModelId();
-                WCHAR dbgAppId[256];
-                swprintf_s(dbgAppId, L"[SessionAppId] %ls", source.c_str());
-                OutputDebugStringW(dbgAppId);
-                if (wcsstr(source.c_str(), L"Spotify") != nullptr) {
-                    g_MediaState.isSpotify = true;
-                    auto timeline = session.GetTimelineProperties();
-                    g_MediaState.position = timeline.Position().count() / 10000000.0;
-                    g_MediaState.duration = timeline.EndTime().count() / 10000000.0;
-                    // If duration is valid, update smoothPosition
-                    if (g_MediaState.duration > 0.0) {
-                        // If paused or stopped, always set smoothPosition to position
-                        auto playbackStatus = info.PlaybackStatus();
-                        if (playbackStatus != GlobalSystemMediaTransportControlsSessionPlaybackStatus::Playing) {
-                            g_MediaState.smoothPosition = g_MediaState.position;
-                        } else {
-                            // If seek/jump, update immediately
-                            if (abs(g_MediaState.smoothPosition - g_MediaState.position) > 2.0) {
-                                g_MediaState.smoothPosition = g_MediaState.position;
-                            }
-                            // Otherwise, interpolate
-                            // (interpolation handled in DrawMediaPanel)
-                        }
-                        // Update last tick for interpolation
-                        g_MediaState.lastUpdateTick = GetTickCount64();
-                    } else {
-                        g_MediaState.smoothPosition = 0.0;
-                        g_MediaState.lastUpdateTick = 0;
-                    }
-                    WCHAR dbgTimeline[256];
-                    swprintf_s(dbgTimeline, L"[SpotifyTimelineRaw] position=%lld duration=%lld", timeline.Position().count(), timeline.EndTime().count());
-                    OutputDebugStringW(dbgTimeline);
-                }
-            } catch (...) {}
-            WCHAR dbgMsg[256];
-            swprintf_s(dbgMsg, L"[SpotifyUpdate] isSpotify=%d position=%.2f duration=%.2f", g_MediaState.isSpotify ? 1 : 0, g_MediaState.position, g_MediaState.duration);
-            OutputDebugStringW(dbgMsg);
-        } else {
-            lock_guard<mutex> guard(g_MediaState.lock);
-            g_MediaState.hasMedia = false;
-            g_MediaState.title = L"No Media";
-            g_MediaState.artist = L"";
-            if (g_MediaState.albumArt) { delete g_MediaState.albumArt; g_MediaState.albumArt = nullptr; }
-            g_MediaState.isSpotify = false;
-            g_MediaState.position = 0.0;
-            g_MediaState.duration = 0.0;
-        }
-    } catch (...) {
-        lock_guard<mutex> guard(g_MediaState.lock);
-        g_MediaState.hasMedia = false;
-        g_MediaState.isSpotify = false;
-        g_MediaState.position = 0.0;
-        g_MediaState.duration = 0.0;
-    }
-}
-
-void SendMediaCommand(int cmd) {
-    try {
-        if (!g_SessionManager) return;
-        auto session = g_SessionManager.GetCurrentSession();
-        if (session) {
-            if (cmd == 1) session.TrySkipPreviousAsync();
-            else if (cmd == 2) session.TryTogglePlayPauseAsync();
-            else if (cmd == 3) session.TrySkipNextAsync();
-        }
-    } catch (...) {}
-}
-
-// --- Helper Functions ---
-struct TimelineGeometry {
-    int barX, barY, barW, barH;
-};
+    bool playing = g_Commands.IsPlaying(state);
+    for (int i = 0; i < 3; i++) {
+        if (draw[ELEMENT_PREV + i]) {
+            DrawControl(renderer, g, HIT_PREV + i, playing, g_HoverState == i + 1, controlColor[i], activeBg);
+        }
+    }
 
-TimelineGeometry CalcTimelineGeometry(int startControlX, int panelHeight, int panelWidth, int fontSize) {
-    int nX = startControlX + 56;
-    int textX = nX + 20;
-    int textMaxW = panelWidth - textX - 10;
-    
-    FontFamily fontFamily(FONT_NAME, nullptr);
-    Font font(&fontFamily, (REAL)fontSize, FontStyleBold, UnitPixel);
-    RectF layoutRect(0, 0, 2000, 100);
-    RectF boundRect;
-    Graphics g((HDC)0);
-    g.MeasureString(L"A", -1, &font, layoutRect, &boundRect);
-    
-    float timelineHeight = 10.0f;
-    float textY = ((float)panelHeight - boundRect.Height - timelineHeight) / 2.0f;
-    int barPadding = 4;
-    int barY = (int)(textY + boundRect.Height + barPadding) - 2;
-    int barHeight = 7;
-    
-    return { textX, barY, textMaxW, barHeight };
-}
+    // 3. Vertical Separator Line (20px from right, respecting 10px margin)
+    if (draw[ELEMENT_SEPARATOR]) DrawSeparator(renderer, g, height, g_HoverBoldLevel, state.sessionPinned, palette);
 
-// --- Visuals ---
-bool IsSystemLightMode() {
-    DWORD value = 0; DWORD size = sizeof(value);
-    if (RegGetValueW(HKEY_CURRENT_USER, L"Software\\Microsoft\\Windows\\CurrentVersion\\Themes\\Personalize", L"SystemUsesLightTheme", RRF_RT_DWORD, nullptr, &value, &size) == ERROR_SUCCESS) {
-        return value != 0;
+    // 4. Text
+    int textX = g.textX;
+    float textY = g.textY;
+
+    // Faded while a skip is outstanding: the old title is on its way out
+    uint32_t textColor = g_Commands.Skipping() ? palette.textFaded : palette.text;
+    const ArtImage* strip = draw[ELEMENT_TEXT] ? g_Marquee.Render(textColor, g_IsScrolling) : nullptr;
+    if (draw[ELEMENT_TEXT] && g_Transition.Sliding()) {
+        // The old title slides up and out while the new one rises into place
+        float oldX, oldY;
+        if (const ArtImage* old = g_Transition.OldText(oldX, oldY)) {
+            renderer.IntersectClip(g_Scene.bounds[ELEMENT_TEXT]);
+            renderer.DrawImage(*old, oldX, floorf(oldY + 0.5f), (float)old->width, (float)old->height, true);
+            renderer.SetClip(dirtyRects, dirtyCount);
+        }
+        if (strip) strip = g_Transition.NewText(*strip, textColor);
+        textY += TRANSITION_SLIDE * (1.0f - g_Transition.TextProgress());
+    }
+    if (strip) {
+        renderer.IntersectClip(g_Scene.bounds[ELEMENT_TEXT]);
+        // Fractional x is resampled by the bilinear filter for sub-pixel motion;
+        // y is snapped so the glyphs stay crisp vertically
+        renderer.DrawImage(*strip, (float)(textX - MARQUEE_PAD) - g_ScrollOffset, floorf(textY + 0.5f),
+                           (float)strip->width, (float)strip->height, true);
+        renderer.SetClip(dirtyRects, dirtyCount);
+    }
+
+    // 5. Spotify Progression Bar (native look, integrated)
+    if (g.hasTimeline && draw[ELEMENT_TIMELINE]) {
+        TRACE(TRACE_LEVEL_DEBUG, TRACE_CAT_RENDER, TRACE_TIMELINE, g_Scene.position, state.duration);
+        DrawTimelineBar(renderer, g, g_Scene.progressWidth, g_TimelineHover || g_TimelineDragging, palette);
+    }
+
+    // 6. Scrub tooltip
+    if (draw[ELEMENT_SCRUB_TIP] && !g_Scene.bounds[ELEMENT_SCRUB_TIP].IsEmptyArea()) {
+        const Rect& tip = g_Scene.bounds[ELEMENT_SCRUB_TIP];
+        renderer.IntersectClip(tip);
+        renderer.DrawImage(*RenderScrubTip(), (float)tip.X, (float)tip.Y, (float)g_ScrubTipWidth, (float)g_ScrubTipHeight, false);
+        renderer.SetClip(dirtyRects, dirtyCount);
+    }
+
+    // 7. Performance HUD
+    if (g_Settings.perfHud && draw[ELEMENT_HUD]) {
+        const Rect& hud = g_Scene.bounds[ELEMENT_HUD];
+        if (hud.Width > 0) {
+            const ArtImage* image = RenderHud(hud.Width);
+            renderer.DrawImage(*image, (float)hud.X, (float)hud.Y, (float)image->width, (float)image->height, false);
+        }
     }
-    return false;
-}
 
-DWORD GetCurrentTextColor() {
-    if (g_Settings.autoTheme) return IsSystemLightMode() ? 0xFF000000 : 0xFFFFFFFF;
-    return g_Settings.manualTextColor;
+    for (int i = 0; i < ELEMENT_COUNT; i++) {
+        if (!draw[i] && !dirty[i]) continue;
+        g_Scene.drawnKeys[i] = g_Scene.keys[i];
+        g_Scene.drawnBounds[i] = g_Scene.bounds[i];
+        g_Scene.drawn[i] = true;
+    }
+    renderer.SetClip(nullptr, 0);
+    g_Commands.MarkPainted(g_Frames.Now());
 }
 
-void UpdateAppearance(HWND hwnd) {
-    // 1. Native Windows 11 Rounding
-    DWM_WINDOW_CORNER_PREFERENCE preference = DWMWCP_ROUND;
-    DwmSetWindowAttribute(hwnd, DWMWA_WINDOW_CORNER_PREFERENCE, &preference, sizeof(preference));
+// --- Window Procedure ---
+#define IDT_FRAME      1002
+#define APP_WM_CLOSE   WM_APP
+#define APP_WM_MEDIA_CHANGED (WM_APP + 1)
+#define APP_WM_COMMAND_DONE  (WM_APP + 2)  // wParam: command, lParam: accepted
+#define APP_WM_THEME_CHANGED (WM_APP + 3)
 
-    // 2. Acrylic Blur
-    HMODULE hUser = GetModuleHandle(L"user32.dll");
-    if (hUser) {
-        auto SetComp = (pSetWindowCompositionAttribute)GetProcAddress(hUser, "SetWindowCompositionAttribute");
-        if (SetComp) {
-            // Calculate tint color based on theme
-            DWORD tint = 0; // Default transparent
-            if (g_Settings.autoTheme) {
-                // Light: Slight white tint, Dark: Slight black tint
-                tint = IsSystemLightMode() ? 0x40FFFFFF : 0x40000000;
-            } else {
-                tint = (g_Settings.bgOpacity << 24) | (0xFFFFFF); // User tint
-            }
+#define HOVER_HOLD_MS  3000.0  // Hold over the tab zone this long to slide the panel
+#define HOVER_GRACE_MS 500.0   // Re-entering within this resumes the hold
+#define SLIDE_SPEED    937.5   // px per second (15px per 16ms frame)
 
-            ACCENT_POLICY policy = { ACCENT_ENABLE_ACRYLICBLURBEHIND, 0, tint, 0 };
-            WINDOWCOMPOSITIONATTRIBDATA data = { WCA_ACCENT_POLICY, &policy, sizeof(ACCENT_POLICY) };
-            SetComp(hwnd, &data);
-        }
+// Repaints often enough for the progress bar to advance about a pixel per tick, and not at all while paused
+void UpdateProgressAnimation(const MediaSnapshot& state) {
+    double duration = state.duration;
+    if (!(state.isSpotify && g_Commands.IsPlaying(state) && duration > 0.0)) {
+        g_Frames.Stop(ANIM_PROGRESS);
+        return;
     }
+    double interval = duration * 1000.0 / (g_Settings.width > 0 ? g_Settings.width : 1);
+    if (state.playbackRate > 0.0) interval /= state.playbackRate;
+    if (interval < 16.0) interval = 16.0;
+    if (interval > 1000.0) interval = 1000.0;
+    g_Frames.Start(ANIM_PROGRESS, [interval](double now) { return now + interval; });
 }
 
-void DrawMediaPanel(HDC hdc, int width, int height) {
-    Graphics graphics(hdc);
-    graphics.SetSmoothingMode(SmoothingModeAntiAlias);
-    graphics.SetTextRenderingHint(TextRenderingHintAntiAlias);
-    graphics.Clear(Color(0, 0, 0, 0)); 
+// Ends the outstanding command either way; the timeline goes back to the real snapshot
+void EndCommand(const MediaSnapshot& state) {
+    g_Commands.Clear();
+    g_Frames.Stop(ANIM_COMMAND);
+    g_TimelineVersion = 0;
+    UpdateProgressAnimation(state);
+}
 
-    Color mainColor{GetCurrentTextColor()};
-    
-    // Lock Data
-    MediaState state;
-    {
-        lock_guard<mutex> guard(g_MediaState.lock);
-        state.title = g_MediaState.title;
-        state.artist = g_MediaState.artist;
-        state.albumArt = g_MediaState.albumArt ? g_MediaState.albumArt->Clone() : nullptr;
-        state.hasMedia = g_MediaState.hasMedia;
-        state.isPlaying = g_MediaState.isPlaying;
-        state.isSpotify = g_MediaState.isSpotify;
-        state.position = g_MediaState.position;
-        state.duration = g_MediaState.duration;
-    }
-
-    // Calculate animation offset
-    int separatorX = width - 20;
+double CommandStep(double now) {
+    if (now < g_Commands.Deadline()) return g_Commands.Deadline();
+    TRACE(TRACE_LEVEL_INFO, TRACE_CAT_MEDIA, TRACE_ROLLBACK, g_Commands.Command(), 0);
+    // Still queued behind a slow one: too late to be worth running
+    g_MediaWorker.CancelCommand(g_Commands.QueueId());
+    g_Commands.Clear();
+    g_TimelineVersion = 0;
+    UpdateProgressAnimation(CurrentMediaSnapshot());
+    return FRAME_DONE;
+}
 
-    // 1. Album Art
-    int artSize = height - 12;
-    int artX = 6;
-    int artY = 6;
-    
-    if (state.albumArt) {
-        graphics.DrawImage(state.albumArt, artX, artY, artSize, artSize);
-        delete state.albumArt;
-    } else {
-        SolidBrush placeBrush{Color(40, 128, 128, 128)};
-        graphics.FillRectangle(&placeBrush, artX, artY, artSize, artSize);
+// Shows the command's effect now and sends it; the worker's answer and the next
+// snapshots confirm or roll it back. 'seconds' is the target of a COMMAND_SEEK.
+void IssueCommand(const MediaSnapshot& state, int cmd, double seconds = 0.0) {
+    double now = g_Frames.Now();
+    double position = CurrentPosition(state);
+    g_Commands.Issue(cmd, state, now, seconds);
+    if (HasTimeline(state)) {
+        // Pausing freezes the bar where it is, resuming runs it on, a skip starts over
+        TimelineSample sample;
+        sample.position = cmd == 2 ? position : cmd == COMMAND_SEEK ? seconds : 0.0;
+        sample.stamp = now;
+        sample.duration = state.duration;
+        sample.rate = state.playbackRate;
+        sample.playing = g_Commands.IsPlaying(state);
+        g_Timeline.Update(sample, now);
     }
+    g_Frames.Start(ANIM_COMMAND, CommandStep);
+    UpdateProgressAnimation(state);
+    g_Commands.SetQueueId(cmd == COMMAND_SEEK ? g_MediaWorker.Seek(seconds) : SendMediaCommand(cmd));
+}
 
-    // 2. Controls
-    int startControlX = artX + artSize + 12;
-    int controlY = height / 2;
-
-    SolidBrush iconBrush{mainColor};
-    SolidBrush hoverBrush{Color(255, mainColor.GetRed(), mainColor.GetGreen(), mainColor.GetBlue())};
-    SolidBrush activeBg{Color(40, mainColor.GetRed(), mainColor.GetGreen(), mainColor.GetBlue())};
-
-    // Prev
-    int pX = startControlX;
-    if (g_HoverState == 1) graphics.FillEllipse(&activeBg, pX - 8, controlY - 12, 24, 24);
-    Point prevPts[3] = { Point(pX + 8, controlY - 6), Point(pX + 8, controlY + 6), Point(pX, controlY) };
-    graphics.FillPolygon(g_HoverState == 1 ? &hoverBrush : &iconBrush, prevPts, 3);
-    graphics.FillRectangle(g_HoverState == 1 ? &hoverBrush : &iconBrush, pX, controlY - 6, 2, 12);
-
-    // Play/Pause
-    int plX = startControlX + 28;
-    if (g_HoverState == 2) graphics.FillEllipse(&activeBg, plX - 8, controlY - 12, 24, 24);
-    if (state.isPlaying) {
-        graphics.FillRectangle(g_HoverState == 2 ? &hoverBrush : &iconBrush, plX, controlY - 7, 3, 14);
-        graphics.FillRectangle(g_HoverState == 2 ? &hoverBrush : &iconBrush, plX + 6, controlY - 7, 3, 14);
-    } else {
-        Point playPts[3] = { Point(plX, controlY - 8), Point(plX, controlY + 8), Point(plX + 10, controlY) };
-        graphics.FillPolygon(g_HoverState == 2 ? &hoverBrush : &iconBrush, playPts, 3);
+// Called for every published snapshot
+void ReconcileCommand(const MediaSnapshot& state) {
+    if (!g_Commands.Active()) return;
+    CommandOverlay::Outcome outcome = g_Commands.Reconcile(state);
+    if (outcome == CommandOverlay::PENDING) return;
+    if (outcome == CommandOverlay::CONFIRMED && g_Commands.Command() != COMMAND_SEEK) {
+        g_PerfCommandConfirm.Record(g_Frames.Now() - g_Commands.IssuedAt());
     }
+    EndCommand(state);
+}
 
-    // Next
-    int nX = startControlX + 56;
-    if (g_HoverState == 3) graphics.FillEllipse(&activeBg, nX - 8, controlY - 12, 24, 24);
-    Point nextPts[3] = { Point(nX, controlY - 6), Point(nX, controlY + 6), Point(nX + 8, controlY) };
-    graphics.FillPolygon(g_HoverState == 3 ? &hoverBrush : &iconBrush, nextPts, 3);
-    graphics.FillRectangle(g_HoverState == 3 ? &hoverBrush : &iconBrush, nX + 8, controlY - 6, 2, 12);
+// Live scrubbing: while the timeline is dragged the latest target is sent at most once
+// per ScrubSeekMs. Targets replaced in between are counted as dropped.
+bool g_ScrubUnsent = false;
+double g_ScrubLastSeek = 0.0;
 
-    // 3. Vertical Separator Line (20px from right, respecting 10px margin)
-    int contentMaxX = separatorX - 10;  // 10px margin to left of separator
-    
-    // Draw vertical separator line (always visible, position independent)
-    // Bold level increases smoothly when hovering
-    {
-        float lineThickness = 1.0f + (g_HoverBoldLevel * 2.5f);  // 1.0 to 3.5px
-        Color sepColor(60 + (int)(60 * g_HoverBoldLevel), mainColor.GetRed(), mainColor.GetGreen(), mainColor.GetBlue());
-        Pen sepPen(sepColor, lineThickness);
-        graphics.DrawLine(&sepPen, separatorX, 6, separatorX, height - 6);
-        
-        // Draw music icon in hover area
-        int iconX = separatorX + 7;
-        int iconY = height / 2;
-        Color iconColor(100, 100, 100);  // Grey color
-        
-        // Draw two musical notes (simplified as circles with stems)
-        // First note
-        int note1X = iconX - 3;
-        int note1Y = iconY + 1;
-        SolidBrush noteBrush(iconColor);
-        graphics.FillEllipse(&noteBrush, note1X - 2, note1Y, 4, 3);
-        Pen noteStem(iconColor, 1.0f);
-        graphics.DrawLine(&noteStem, note1X, note1Y - 3, note1X, note1Y);
-        
-        // Second note (higher)
-        int note2X = iconX + 3;
-        int note2Y = iconY - 2;
-        graphics.FillEllipse(&noteBrush, note2X - 2, note2Y, 4, 3);
-        graphics.DrawLine(&noteStem, note2X, note2Y - 3, note2X, note2Y);
-        
-        // Connecting beam
-        graphics.DrawLine(&noteStem, note1X, note1Y - 3, note2X, note2Y - 3);
+double ScrubStep(double now) {
+    if (!g_TimelineDragging || !g_ScrubUnsent) return FRAME_DONE;
+    double due = g_ScrubLastSeek + g_Settings.scrubSeekMs;
+    if (now < due) return due;
+    const MediaSnapshot& state = CurrentMediaSnapshot();
+    if (HasTimeline(state)) {
+        g_MediaWorker.Seek(g_TimelineDragProgress * state.duration);
+        g_PerfScrubSeeks++;
     }
+    g_ScrubUnsent = false;
+    g_ScrubLastSeek = now;
+    return FRAME_DONE;
+}
 
-    // 4. Text
-    int textX = nX + 20;
-    int textMaxW = contentMaxX - textX;
-    if (textMaxW < 50) textMaxW = 50;  // Minimum width
+// Called whenever a drag moves g_TimelineDragProgress
+void ScrubMoved() {
+    if (g_Settings.scrubSeekMs <= 0) return;
+    if (g_ScrubUnsent) g_PerfScrubDropped++;
+    g_ScrubUnsent = true;
+    if (!g_Frames.IsRunning(ANIM_SCRUB)) g_Frames.Start(ANIM_SCRUB, ScrubStep);
+}
 
-    wstring fullText = state.title;
-    if (!state.artist.empty()) fullText += L" • " + state.artist;
+// The release sends the final target itself
+void EndScrub() {
+    g_ScrubUnsent = false;
+    g_Frames.Stop(ANIM_SCRUB);
+}
 
-    FontFamily fontFamily(FONT_NAME, nullptr);
-    Font font(&fontFamily, (REAL)g_Settings.fontSize, FontStyleBold, UnitPixel);
-    SolidBrush textBrush{mainColor};
+void MovePanelWindow(HWND hwnd) {
+    RECT screenRect;
+    SystemParametersInfo(SPI_GETWORKAREA, 0, &screenRect, 0);
+    int x = g_Settings.offsetX + g_PanelOffsetX;
+    int y = screenRect.bottom - g_Settings.height - g_Settings.offsetY;
+    SetWindowPos(hwnd, NULL, x, y, 0, 0, SWP_NOZORDER | SWP_NOSIZE | SWP_NOACTIVATE);
+}
 
-    RectF layoutRect(0, 0, 2000, 100);
-    RectF boundRect;
-    graphics.MeasureString(fullText.c_str(), -1, &font, layoutRect, &boundRect);
-    g_TextWidth = (int)boundRect.Width;
+// Constant-speed slide from where the panel was when the slide started
+double SlideStep(double now) {
+    double distance = g_PanelTargetOffsetX - g_SlideFromX;
+    double travelled = (now - g_SlideStartTime) * SLIDE_SPEED / 1000.0;
+    if (travelled >= fabs(distance)) {
+        g_PanelOffsetX = g_PanelTargetOffsetX;
+    } else {
+        g_PanelOffsetX = (int)(g_SlideFromX + (distance > 0 ? travelled : -travelled));
+    }
+    MovePanelWindow(g_hMediaWindow);
+    return g_PanelOffsetX == g_PanelTargetOffsetX ? FRAME_DONE : now;
+}
 
-    // Text vertical position: leave space for timeline if Spotify
-    float timelineHeight = (state.isSpotify && state.duration > 0.0) ? 10.0f : 0.0f;
-    float textY = ((float)height - boundRect.Height - timelineHeight) / 2.0f;
+void TogglePanelSlide() {
+    int slideAmount = g_Settings.width - 20;
+    if (g_PanelOpen) {
+        // Slide left (open to closed)
+        g_PanelTargetOffsetX = -slideAmount;
+        g_PanelOpen = false;
+    } else {
+        // Slide right (closed to open)
+        g_PanelTargetOffsetX = 0;
+        g_PanelOpen = true;
+    }
+    g_SlideFromX = g_PanelOffsetX;
+    g_SlideStartTime = g_Frames.Now();
+    g_Frames.Start(ANIM_SLIDE, SlideStep);
+}
 
-    Region textClip(Rect(textX, 0, textMaxW, height));
-    graphics.SetClip(&textClip);
+// Separator bolds over the hold time, then triggers the slide; after leaving it fades
+// at the same rate for the grace period
+double HoverStep(double now) {
+    if (g_HoverTabZone) {
+        double elapsed = now - g_HoverTimerStart;
+        g_HoverBoldLevel = elapsed >= HOVER_HOLD_MS ? 1.0f : (float)(elapsed / HOVER_HOLD_MS);
+        if (elapsed < HOVER_HOLD_MS) return now;
 
-    if (g_TextWidth > textMaxW) {
-        g_IsScrolling = true;
-        float drawX = (float)(textX - g_ScrollOffset);
-        graphics.DrawString(fullText.c_str(), -1, &font, PointF(drawX, textY), &textBrush);
-        if (drawX + g_TextWidth < width) {
-            graphics.DrawString(fullText.c_str(), -1, &font, PointF(drawX + g_TextWidth + 40, textY), &textBrush);
-        }
-    } else {
-        g_IsScrolling = false;
-        g_ScrollOffset = 0;
-        graphics.DrawString(fullText.c_str(), -1, &font, PointF((float)textX, textY), &textBrush);
+        g_HoverTabZone = false;
+        g_HoverBoldLevel = 0.0f;
+        TogglePanelSlide();
+        return FRAME_DONE;
     }
 
-    // 5. Spotify Progression Bar (native look, integrated)
-    if (state.isSpotify && state.duration > 0.0) {
-        WCHAR dbgMsg[256];
-        swprintf_s(dbgMsg, L"[SpotifyTimeline] position=%.2f duration=%.2f progress=%.2f isPlaying=%d", state.position, state.duration, (state.duration > 0.0 ? state.position / state.duration : 0.0), state.isPlaying ? 1 : 0);
-        OutputDebugStringW(dbgMsg);
-
-        // Timeline bar geometry
-        int barHeight = g_TimelineHover || g_TimelineDragging ? 8 : 5;
-        int barPadding = 4;
-        int barX = textX;
-        int barW = textMaxW;
-        int barY = (int)(textY + boundRect.Height + barPadding);
-
-        // Progress calculation
-        float progress = (float)(state.position / state.duration);
-        if (progress < 0.0f || isnan(progress)) progress = 0.0f;
-        if (progress > 1.0f) progress = 1.0f;
-        float drawProgress = g_TimelineDragging ? g_TimelineDragProgress : progress;
-
-        // Colors: subtle, native, with rounded corners
-        Color barBg(32, 0, 0, 0); // subtle dark overlay
-        Color barFg(mainColor.GetRed(), mainColor.GetGreen(), mainColor.GetBlue(), 220); // main accent, slightly transparent
-        Color barBorder(60, mainColor.GetRed(), mainColor.GetGreen(), mainColor.GetBlue());
-        SolidBrush bgBrush(barBg);
-        SolidBrush fgBrush(barFg);
-        Pen borderPen(barBorder, 1.5f);
-
-        Region fullClip(Rect(0, 0, width, height));
-        graphics.SetClip(&fullClip, CombineModeReplace);
-
-        // Draw rounded background bar
-        int radius = barHeight / 2;
-        GraphicsPath bgPath;
-        bgPath.AddArc(barX, barY, barHeight, barHeight, 90, 180);
-        bgPath.AddArc(barX + barW - barHeight, barY, barHeight, barHeight, 270, 180);
-        bgPath.AddLine(barX + barW - radius, barY + barHeight, barX + radius, barY + barHeight);
-        bgPath.CloseFigure();
-        graphics.FillPath(&bgBrush, &bgPath);
-        graphics.DrawPath(&borderPen, &bgPath);
-
-        // Draw progress (rounded)
-        int progW = (int)(barW * drawProgress);
-        if (progW > 0) {
-            GraphicsPath fgPath;
-            if (progW < barHeight) {
-                fgPath.AddArc(barX, barY, barHeight, barHeight, 90, 180 * (float)progW / (float)barHeight);
+    double since = now - g_HoverLastLeftTime;
+    if (since < HOVER_GRACE_MS) {
+        g_HoverBoldLevel = g_HoverLeftBoldLevel - (float)(since / 1000.0);
+        if (g_HoverBoldLevel > 0.0f) return now;
+    }
+    g_HoverBoldLevel = 0.0f;
+    return FRAME_DONE;
+}
+
+// Applies a pointer move to the tab-zone, drag and hover state; returns true if the hand
+// cursor should show
+bool HandlePointerMove(int x, int y) {
+    HitTarget hit = g_Layout.HitTest(x, y);
+    int newState = 0;
+    bool shouldShowHandCursor = false;
+
+    // Tab zone detection (right side of separator line)
+    bool hoveredTabZone = hit == HIT_TAB;
+
+    // Handle hover timer for tab zone
+    if (hoveredTabZone) {
+        if (!g_HoverTabZone) {
+            // Entering hover zone
+            double now = g_Frames.Now();
+            // Check if recently left (within the grace period)
+            if (g_HoverLastLeftTime > 0 && now - g_HoverLastLeftTime < HOVER_GRACE_MS) {
+                // Resume from previous progress
+                double timeSincePreviousStart = now - g_HoverTimerStart;
+                if (timeSincePreviousStart > HOVER_HOLD_MS) {
+                    g_HoverTimerStart = now;  // Reset if was too long ago
+                }
             } else {
-                fgPath.AddArc(barX, barY, barHeight, barHeight, 90, 180);
-                fgPath.AddArc(barX + progW - barHeight, barY, barHeight, barHeight, 270, 180);
-                fgPath.AddLine(barX + progW - radius, barY + barHeight, barX + radius, barY + barHeight);
+                // Fresh start
+                g_HoverTimerStart = now;
             }
-            fgPath.CloseFigure();
-            graphics.FillPath(&fgBrush, &fgPath);
+            g_HoverTabZone = true;
+            g_HoverLastLeftTime = 0;
+            g_Frames.Start(ANIM_HOVER, HoverStep);
         }
-
-        // Draw seek thumb (circle) if hovered or dragging
-        bool showThumb = g_TimelineHover || g_TimelineDragging;
-        if (showThumb) {
-            int cx = barX + progW;
-            int cy = barY + barHeight / 2;
-            int thumbRadius = barHeight / 2 + 2; // Smaller thumb
-            Color thumbColor(mainColor.GetRed(), mainColor.GetGreen(), mainColor.GetBlue(), 220);
-            Color thumbBorder(255, 255, 255, 255);
-            SolidBrush thumbBrush(thumbColor);
-            Pen thumbPen(thumbBorder, 1.5f);
-            graphics.FillEllipse(&thumbBrush, cx - thumbRadius, cy - thumbRadius, thumbRadius * 2, thumbRadius * 2);
-            graphics.DrawEllipse(&thumbPen, cx - thumbRadius, cy - thumbRadius, thumbRadius * 2, thumbRadius * 2);
+        shouldShowHandCursor = true;
+    } else {
+        if (g_HoverTabZone) {
+            // Leaving hover zone; HoverStep keeps running to fade the bold out
+            g_HoverTabZone = false;
+            g_HoverLeftBoldLevel = g_HoverBoldLevel;
+            g_HoverLastLeftTime = g_Frames.Now();
         }
+    }
 
-        // Restore text clip for any further drawing
-        graphics.SetClip(&textClip);
+    if (g_TimelineDragging) {
+        // Update drag progress
+        float progress = g_Layout.TimelineFraction(x);
+        if (progress != g_TimelineDragProgress) {
+            g_TimelineDragProgress = progress;
+            ScrubMoved();
+        }
+        shouldShowHandCursor = true;
+    } else if (hit == HIT_TIMELINE) {
+        g_TimelineHover = true;
+        shouldShowHandCursor = true;
+    } else {
+        g_TimelineHover = false;
+        // Continue to check controls
+        if (hit >= HIT_PREV && hit <= HIT_NEXT) newState = hit;
+        if (newState > 0) shouldShowHandCursor = true;
+        g_HoverState = newState;
     }
+    return shouldShowHandCursor;
 }
 
-// --- Window Procedure ---
-#define IDT_POLL_MEDIA 1001
-#define IDT_ANIMATION  1002
-#define IDT_HOVER_TIMER 1003
-#define APP_WM_CLOSE   WM_APP
+#ifndef MUSIC_WIDGET_HEADLESS
+struct MessageDepthScope {
+    MessageDepthScope() { g_MessageDepth++; }
+    ~MessageDepthScope() { g_MessageDepth--; }
+};
 
 LRESULT CALLBACK MediaWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
+    MessageDepthScope depth;
     switch (msg) {
         case WM_CREATE: 
+            g_ThemeWatcher.Start(hwnd, APP_WM_THEME_CHANGED);
+            RefreshTheme();
             UpdateAppearance(hwnd); // Apply DWM Rounding + Acrylic
-            SetTimer(hwnd, IDT_POLL_MEDIA, 1000, NULL); 
+            g_Frames.Attach(hwnd, IDT_FRAME);
+            UpdateHudAnimation();
+            // Media updates are event driven and arrive from the worker
+            g_MediaWorker.Start(hwnd, APP_WM_MEDIA_CHANGED, APP_WM_COMMAND_DONE, g_Settings.height - 12, ArtCacheBudget());
             return 0;
 
         case WM_ERASEBKGND: 
@@ -699,205 +5086,102 @@ LRESULT CALLBACK MediaWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
             return 0;
 
         case WM_DESTROY:
-            g_SessionManager = nullptr;
+            g_ThemeWatcher.Stop();
+            g_Frames.Detach();
+            g_MediaWorker.Stop();
+            // Drop the last snapshot's bitmap before GDI+ shuts down
+            g_MediaSnapshots.Reset();
+            g_Timeline.Reset();
+            g_TimelineVersion = 0;
+            g_TimelineSession.clear();
+            g_Commands.Clear();
+            g_ArtAccent = ArtPalette();
+            g_Marquee.Reset();
+            g_Transition.Reset();
+            g_HudImage = ArtImage();
+            ResetScrubTip();
+            g_TextMeasure.Clear();
+            g_Fonts.Reset();
+            g_GdiplusGlyphs.Reset();
+            g_GdiplusViews.Clear();
+            g_BackBuffer.Release();
             PostQuitMessage(0);
             return 0;
 
+        case WM_DPICHANGED:
+            // Reallocated at the new size on the next paint
+            g_BackBuffer.Release();
+            g_TextMeasure.Clear();
+            g_Fonts.Reset();
+            g_Marquee.Reset();
+            g_Transition.Reset();
+            ResetScrubTip();
+            InvalidateScene(hwnd);
+            return 0;
+
         case WM_SETTINGCHANGE:
+            if (g_PresentPerPixel != g_Settings.perPixelAlpha) ApplyPresentMode(hwnd);
+            g_MediaWorker.SetArtBudget(ArtCacheBudget());
+            RefreshTheme();
             UpdateAppearance(hwnd);
-            InvalidateRect(hwnd, NULL, TRUE);
+            UpdateHudAnimation();
+            InvalidateScene(hwnd);
             return 0;
 
-        case WM_TIMER:
-            if (wParam == IDT_POLL_MEDIA) {
-                UpdateMediaInfo();
-                InvalidateRect(hwnd, NULL, FALSE);
-                // Use fast timer for Spotify timeline, slower otherwise
-                {
-                    lock_guard<mutex> guard(g_MediaState.lock);
-                    int timerInterval = 1000;  // Default: 1s
-                    if (g_MediaState.isSpotify) {
-                        timerInterval = 16;  // 16ms for smooth timeline
-                    }
-                    SetTimer(hwnd, IDT_POLL_MEDIA, timerInterval, NULL);
-                }
-            }
-            else if (wParam == IDT_HOVER_TIMER) {
-                // Update bold level and check timer
-                if (g_HoverTabZone) {
-                    ULONGLONG elapsed = GetTickCount64() - g_HoverTimerStart;
-                    float boldTarget = (float)elapsed / 3000.0f;  // 0.0 to 1.0 over 3 seconds
-                    if (boldTarget > 1.0f) boldTarget = 1.0f;
-                    g_HoverBoldLevel = boldTarget;
-                    
-                    if (elapsed >= 3000) {
-                        // Trigger panel slide
-                        int slideAmount = g_Settings.width - 20;
-                        
-                        if (g_PanelOpen) {
-                            // Slide left (open to closed)
-                            g_PanelTargetOffsetX = -slideAmount;
-                            g_PanelOpen = false;
-                        } else {
-                            // Slide right (closed to open)
-                            g_PanelTargetOffsetX = 0;
-                            g_PanelOpen = true;
-                        }
-                        
-                        // Kill the hover timer since we've triggered the action
-                        KillTimer(hwnd, IDT_HOVER_TIMER);
-                        g_HoverTabZone = false;
-                        g_HoverBoldLevel = 0.0f;
-                        
-                        // Start animation timer if not already running
-                        SetTimer(hwnd, IDT_ANIMATION, 16, NULL);
-                        InvalidateRect(hwnd, NULL, FALSE);
-                    } else {
-                        InvalidateRect(hwnd, NULL, FALSE);
-                    }
-                } else {
-                    // Slowly decrease bold level when not hovering
-                    ULONGLONG now = GetTickCount64();
-                    if (now - g_HoverLastLeftTime < 500) {  // Grace period: 500ms
-                        // Still in grace period, decrease bold slowly
-                        g_HoverBoldLevel -= 0.05f;  // Decrease over time
-                        if (g_HoverBoldLevel < 0.0f) g_HoverBoldLevel = 0.0f;
-                        InvalidateRect(hwnd, NULL, FALSE);
-                    } else {
-                        // Grace period expired, kill the timer
-                        KillTimer(hwnd, IDT_HOVER_TIMER);
-                        g_HoverBoldLevel = 0.0f;
-                    }
-                }
-            }
-            else if (wParam == IDT_ANIMATION) {
-                if (g_IsScrolling || g_PanelOffsetX != g_PanelTargetOffsetX) {
-                    // Handle text scrolling
-                    if (g_IsScrolling) {
-                        if (g_ScrollWait > 0) {
-                            g_ScrollWait--;
-                        } else {
-                            g_ScrollOffset++;
-                            if (g_ScrollOffset > g_TextWidth + 40) {
-                                g_ScrollOffset = 0;
-                                g_ScrollWait = 60; 
-                            }
-                        }
-                    }
-                    
-                    // Handle panel sliding animation
-                    if (g_PanelOffsetX != g_PanelTargetOffsetX) {
-                        int diff = g_PanelTargetOffsetX - g_PanelOffsetX;
-                        int step = (diff > 0) ? 15 : -15;  // 15px per frame
-                        
-                        if (abs(diff) <= 15) {
-                            g_PanelOffsetX = g_PanelTargetOffsetX;
-                        } else {
-                            g_PanelOffsetX += step;
-                        }
-                        
-                        // Update window position
-                        RECT screenRect;
-                        SystemParametersInfo(SPI_GETWORKAREA, 0, &screenRect, 0);
-                        int x = g_Settings.offsetX + g_PanelOffsetX;
-                        int y = screenRect.bottom - g_Settings.height - g_Settings.offsetY;
-                        SetWindowPos(hwnd, NULL, x, y, 0, 0, SWP_NOZORDER | SWP_NOSIZE | SWP_NOACTIVATE);
-                    }
-                    
-                    InvalidateRect(hwnd, NULL, FALSE);
-                } else {
-                    KillTimer(hwnd, IDT_ANIMATION); 
-                }
+        case APP_WM_THEME_CHANGED: {
+            // Re-armed before reading so a change in between is not missed
+            g_ThemeWatcher.Arm();
+            bool wasLight = g_LightMode;
+            RefreshTheme();
+            if (g_LightMode != wasLight) {
+                UpdateAppearance(hwnd);
+                InvalidateScene(hwnd);
             }
             return 0;
+        }
 
-        case WM_MOUSEMOVE: {
-            int x = LOWORD(lParam);
-            int y = HIWORD(lParam);
-            int artSize = g_Settings.height - 12;
-            int startControlX = 6 + artSize + 12;
-            int newState = 0;
-            bool shouldShowHandCursor = false;
-            
-            // Tab zone detection (right side of separator line, 20px from right)
-            int separatorX = g_Settings.width - 20;
-            int tabZoneLeft = separatorX - 5;  // 5px to left of separator for easier targeting
-            bool hoveredTabZone = (x >= tabZoneLeft && y >= 6 && y <= g_Settings.height - 6);
-            
-            // Handle hover timer for tab zone
-            if (hoveredTabZone) {
-                if (!g_HoverTabZone) {
-                    // Entering hover zone
-                    ULONGLONG now = GetTickCount64();
-                    // Check if recently left (within 500ms grace period)
-                    if (g_HoverLastLeftTime > 0 && now - g_HoverLastLeftTime < 500) {
-                        // Resume from previous progress
-                        ULONGLONG timeSincePreviousStart = now - g_HoverTimerStart;
-                        if (timeSincePreviousStart > 3000) {
-                            g_HoverTimerStart = now;  // Reset if was too long ago
-                        }
-                    } else {
-                        // Fresh start
-                        g_HoverTimerStart = now;
-                    }
-                    g_HoverTabZone = true;
-                    g_HoverLastLeftTime = 0;
-                    SetTimer(hwnd, IDT_HOVER_TIMER, 50, NULL);  // Check every 50ms for smooth animation
-                }
-                shouldShowHandCursor = true;
-            } else {
-                if (g_HoverTabZone) {
-                    // Leaving hover zone, but don't kill the timer yet (grace period)
-                    g_HoverTabZone = false;
-                    g_HoverLastLeftTime = GetTickCount64();
-                    // Timer continues for 500ms to allow smooth unbold animation
-                }
+        case APP_WM_MEDIA_CHANGED: {
+            // A new snapshot was published
+            const MediaSnapshot& state = AcquireMediaSnapshot();
+            ReconcileCommand(state);
+            if (SetArtAccent(state.artPalette)) {
+                // The tint is part of the acrylic policy
+                UpdateAppearance(hwnd);
+                InvalidateScene(hwnd);
             }
+            UpdateProgressAnimation(state);
+            RefreshScene(hwnd, state);
+            return 0;
+        }
 
-            // Timeline bar geometry via helper function
-            TimelineGeometry tlGeom = CalcTimelineGeometry(startControlX, g_Settings.height, g_Settings.width, g_Settings.fontSize);
-            int barX = tlGeom.barX;
-            int barY = tlGeom.barY;
-            int barW = tlGeom.barW;
-            int barH = tlGeom.barH;
-            int circleRadius = 8;
-
-            // Timeline drag/hover logic
-            // Don't allow timeline interaction in hover area (right side)
-            bool onTimeline = false;
-            if (g_MediaState.isSpotify && g_MediaState.duration > 0.0) {
-                int rightBoundary = separatorX - 15;  // Exclude hover area
-                if (y >= barY - 4 && y <= barY + barH + 8 && x >= barX && x <= barX + barW && x < rightBoundary) {
-                    onTimeline = true;
-                }
+        case APP_WM_COMMAND_DONE:
+            // A rejected command rolls back at once rather than at its deadline
+            if (!lParam && g_Commands.Command() == (int)wParam) {
+                TRACE(TRACE_LEVEL_INFO, TRACE_CAT_MEDIA, TRACE_ROLLBACK, wParam, 1);
+                const MediaSnapshot& state = AcquireMediaSnapshot();
+                EndCommand(state);
+                RefreshScene(hwnd, state);
             }
+            return 0;
 
-            if (g_TimelineDragging) {
-                // Update drag progress
-                float rel = (float)(x - barX) / (float)barW;
-                if (rel < 0.0f) rel = 0.0f;
-                if (rel > 1.0f) rel = 1.0f;
-                g_TimelineDragProgress = rel;
-                shouldShowHandCursor = true;
-                InvalidateRect(hwnd, NULL, FALSE);
-            } else if (onTimeline) {
-                g_TimelineHover = true;
-                shouldShowHandCursor = true;
-                InvalidateRect(hwnd, NULL, FALSE);
-            } else {
-                g_TimelineHover = false;
-                // Continue to check controls
-                if (y > 10 && y < g_Settings.height - 10) {
-                    if (x >= startControlX - 10 && x < startControlX + 14) newState = 1;
-                    else if (x >= startControlX + 14 && x < startControlX + 42) newState = 2;
-                    else if (x >= startControlX + 42 && x < startControlX + 66) newState = 3;
-                }
-                if (newState > 0) shouldShowHandCursor = true;
-                if (newState != g_HoverState) {
-                    g_HoverState = newState;
-                    InvalidateRect(hwnd, NULL, FALSE);
-                }
+        case WM_TIMER:
+            if (wParam == IDT_FRAME) {
+                // All animations advance together, then one refresh picks up what moved;
+                // the steps read the snapshot taken here
+                const MediaSnapshot& state = AcquireMediaSnapshot();
+                g_Frames.Tick();
+                RefreshScene(hwnd, state);
             }
+            return 0;
+
+        case WM_DISPLAYCHANGE:
+            g_Frames.UpdateFrameInterval();
+            break;
+
+        case WM_MOUSEMOVE: {
+            // Signed: while dragging with capture the pointer can leave the window
+            bool shouldShowHandCursor = HandlePointerMove((short)LOWORD(lParam), (short)HIWORD(lParam));
+            RefreshScene(hwnd, AcquireMediaSnapshot());
 
             // Update cursor based on hover state
             SetCursor(LoadCursor(NULL, shouldShowHandCursor ? IDC_HAND : IDC_ARROW));
@@ -909,58 +5193,41 @@ LRESULT CALLBACK MediaWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
         case WM_MOUSELEAVE:
             g_HoverState = 0;
             g_TimelineHover = false;
-            g_HoverTabZone = false;
-            g_HoverLastLeftTime = GetTickCount64();
-            if (!g_TimelineDragging) g_TimelineDragProgress = 0.0f;
-            // Reset the timer to normal speed when leaving
-            {
-                lock_guard<mutex> guard(g_MediaState.lock);
-                int timerInterval = 1000;
-                if (g_MediaState.isSpotify) {
-                    timerInterval = 16;
-                }
-                SetTimer(hwnd, IDT_POLL_MEDIA, timerInterval, NULL);
+            if (g_HoverTabZone) {
+                g_HoverTabZone = false;
+                g_HoverLeftBoldLevel = g_HoverBoldLevel;
+                g_HoverLastLeftTime = g_Frames.Now();
             }
-            InvalidateRect(hwnd, NULL, FALSE);
+            if (!g_TimelineDragging) g_TimelineDragProgress = 0.0f;
+            RefreshScene(hwnd, AcquireMediaSnapshot());
             break;
         case WM_LBUTTONDOWN: {
-            int x = LOWORD(lParam);
-            int y = HIWORD(lParam);
+            int x = (short)LOWORD(lParam);
+            int y = (short)HIWORD(lParam);
             
             // Check if clicking on timeline
-            if (g_MediaState.isSpotify && g_MediaState.duration > 0.0) {
-                int artSize = g_Settings.height - 12;
-                int startControlX = 6 + artSize + 12;
-                TimelineGeometry tlGeom = CalcTimelineGeometry(startControlX, g_Settings.height, g_Settings.width, g_Settings.fontSize);
-                int circleRadius = 8;
-                
-                float progress = (float)(g_MediaState.position / g_MediaState.duration);
+            const MediaSnapshot& state = AcquireMediaSnapshot();
+            if (HasTimeline(state)) {
+                float progress = (float)(CurrentPosition(state) / state.duration);
                 if (progress < 0.0f || isnan(progress)) progress = 0.0f;
                 if (progress > 1.0f) progress = 1.0f;
                 
-                int cx = tlGeom.barX + (int)(tlGeom.barW * progress);
-                int cy = tlGeom.barY + tlGeom.barH / 2;
-                int dx = x - cx;
-                int dy = y - cy;
-                
                 // Check if clicking on seek thumb
-                if (dx * dx + dy * dy <= circleRadius * circleRadius * 2) {
+                if (g_Layout.ThumbHit(progress, x, y)) {
                     g_TimelineDragging = true;
                     g_TimelineDragProgress = progress;
                     SetCapture(hwnd);
-                    InvalidateRect(hwnd, NULL, FALSE);
+                    RefreshScene(hwnd, state);
                     return 0;
                 }
                 
                 // Allow clicking anywhere on bar to start drag
-                if (y >= tlGeom.barY - 4 && y <= tlGeom.barY + tlGeom.barH + 8 && x >= tlGeom.barX && x <= tlGeom.barX + tlGeom.barW) {
-                    float rel = (float)(x - tlGeom.barX) / (float)tlGeom.barW;
-                    if (rel < 0.0f) rel = 0.0f;
-                    if (rel > 1.0f) rel = 1.0f;
+                if (g_Layout.HitTest(x, y) == HIT_TIMELINE) {
                     g_TimelineDragging = true;
-                    g_TimelineDragProgress = rel;
+                    g_TimelineDragProgress = g_Layout.TimelineFraction(x);
+                    ScrubMoved();
                     SetCapture(hwnd);
-                    InvalidateRect(hwnd, NULL, FALSE);
+                    RefreshScene(hwnd, state);
                     return 0;
                 }
             }
@@ -968,35 +5235,32 @@ LRESULT CALLBACK MediaWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
             // Don't send command on down, only on up
             return 0;
         }
-        case WM_LBUTTONUP:
+        case WM_LBUTTONUP: {
+            const MediaSnapshot& state = AcquireMediaSnapshot();
             if (g_TimelineDragging) {
-                // Seek to new time
-                if (g_MediaState.isSpotify && g_MediaState.duration > 0.0) {
-                    double newTime = g_TimelineDragProgress * g_MediaState.duration;
-                    // Seek Spotify
-                    try {
-                        if (g_SessionManager) {
-                            auto session = g_SessionManager.GetCurrentSession();
-                            if (session) {
-                                auto timeline = session.GetTimelineProperties();
-                                auto status = session.GetPlaybackInfo().PlaybackStatus();
-                                session.TryChangePlaybackPositionAsync((LONGLONG)(newTime * 10000000)).get();
-                                // If paused, update position immediately
-                                if (status != GlobalSystemMediaTransportControlsSessionPlaybackStatus::Playing) {
-                                    lock_guard<mutex> guard(g_MediaState.lock);
-                                    g_MediaState.position = newTime;
-                                }
-                            }
-                        }
-                    } catch (...) {}
+                // Seek to the final target; the bar stays there until the player confirms
+                EndScrub();
+                if (state.isSpotify && state.duration > 0.0) {
+                    IssueCommand(state, COMMAND_SEEK, g_TimelineDragProgress * state.duration);
                 }
                 g_TimelineDragging = false;
                 ReleaseCapture();
-                InvalidateRect(hwnd, NULL, FALSE);
+                RefreshScene(hwnd, state);
                 return 0;
             }
             // Send control command on button up (not down) to prevent double clicks
-            if (g_HoverState > 0) SendMediaCommand(g_HoverState);
+            HitTarget hit = g_Layout.HitTest((short)LOWORD(lParam), (short)HIWORD(lParam));
+            if (hit >= HIT_PREV && hit <= HIT_NEXT && ControlEnabled(state, hit)) {
+                IssueCommand(state, hit);
+                RefreshScene(hwnd, state);
+            }
+            return 0;
+        }
+        case WM_RBUTTONUP:
+            g_MediaWorker.CycleSession();
+            return 0;
+        case WM_MBUTTONUP:
+            DumpTrace();
             return 0;
         case WM_MOUSEWHEEL: {
             short zDelta = GET_WHEEL_DELTA_WPARAM(wParam);
@@ -1006,25 +5270,203 @@ LRESULT CALLBACK MediaWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
             return 0;
         }
         case WM_PAINT: {
+            RECT rc; GetClientRect(hwnd, &rc);
+            if (g_BackBuffer.Ensure(NULL, rc.right, rc.bottom) && g_BackBuffer.fresh) {
+                g_BackBuffer.fresh = false;
+                InvalidateScene(hwnd);
+            }
+            // One snapshot for the whole paint. Anything that changed since the last refresh
+            // is folded in first, so the update region covers what is drawn.
+            const MediaSnapshot& state = AcquireMediaSnapshot();
+            RefreshScene(hwnd, state);
+
             PAINTSTRUCT ps;
             HDC hdc = BeginPaint(hwnd, &ps);
-            RECT rc; GetClientRect(hwnd, &rc);
-            HDC memDC = CreateCompatibleDC(hdc);
-            HBITMAP memBitmap = CreateCompatibleBitmap(hdc, rc.right, rc.bottom);
-            HBITMAP oldBitmap = (HBITMAP)SelectObject(memDC, memBitmap);
-            
-            DrawMediaPanel(memDC, rc.right, rc.bottom);
-            
-            if (g_IsScrolling) SetTimer(hwnd, IDT_ANIMATION, 16, NULL);
+            if (g_BackBuffer.dc) {
+                if (g_Settings.softwareRenderer) {
+                    SoftwareRenderer renderer(g_BackBuffer.bits, g_BackBuffer.width, g_BackBuffer.height, g_BackBuffer.width);
+                    DrawMediaPanel(renderer, state, rc.right, rc.bottom);
+                } else {
+                    Graphics graphics(g_BackBuffer.surface);
+                    GdiplusRenderer renderer(graphics);
+                    DrawMediaPanel(renderer, state, rc.right, rc.bottom);
+                }
+                PresentBackBuffer(hwnd, hdc);
+            }
 
-            BitBlt(hdc, 0, 0, rc.right, rc.bottom, memDC, 0, 0, SRCCOPY);
-            SelectObject(memDC, oldBitmap); DeleteObject(memBitmap); DeleteDC(memDC);
             EndPaint(hwnd, &ps);
             return 0;
         }
     }
     return DefWindowProc(hwnd, msg, wParam, lParam);
 }
+#endif
+
+// --- Benchmark ---
+// tests/bench.cpp plays scripted sessions through the headless pipeline and reports every
+// stage; the Benchmark setting adds what only Windows can measure, the GDI+ paint. Both
+// run each scenario on a panel that has never been shown and put the UI state back after.
+#define BENCH_FRAME_MS (1000.0 / 60.0)
+
+// The UI globals a scenario drives. Each one is copied on construction; Restore() puts
+// every copy back, between scenarios and once more when the benchmark is over.
+class BenchSandbox {
+public:
+    BenchSandbox() {
+        Keep(g_UiSnapshots);
+        Keep(g_Glyphs);
+        Keep(g_Frames);
+        Keep(g_Commands);
+        Keep(g_Scene);
+        Keep(g_Layout);
+        Keep(g_Timeline);
+        Keep(g_TimelineVersion);
+        Keep(g_TimelineSession);
+        Keep(g_Marquee);
+        Keep(g_Transition);
+        Keep(g_TextLineHeight);
+        Keep(g_ScrollOffset);
+        Keep(g_IsScrolling);
+        Keep(g_ScrollStartTime);
+        Keep(g_HoverState);
+        Keep(g_HoverTimerStart);
+        Keep(g_HoverTabZone);
+        Keep(g_HoverBoldLevel);
+        Keep(g_HoverLeftBoldLevel);
+        Keep(g_HoverLastLeftTime);
+        Keep(g_PanelOpen);
+        Keep(g_PanelOffsetX);
+        Keep(g_PanelTargetOffsetX);
+        Keep(g_SlideFromX);
+        Keep(g_SlideStartTime);
+        Keep(g_TimelineHover);
+        Keep(g_TimelineDragging);
+        Keep(g_TimelineDragProgress);
+        Keep(g_ScrubUnsent);
+        Keep(g_ScrubLastSeek);
+        Keep(g_ScrubTipText);
+        Keep(g_ScrubTipWidth);
+        Keep(g_ScrubTipHeight);
+        Keep(g_ScrubTipImage);
+        Keep(g_ScrubTipRendered);
+        Keep(g_ArtSizeRequested);
+        Keep(g_BackdropRequested);
+        Keep(g_HudText);
+        Keep(g_HudImage);
+        Keep(g_HudImageKey);
+        Keep(g_HudLastTime);
+        Keep(g_HudLastFrames);
+        Keep(g_HudLastPixels);
+        Keep(g_PerfFrames);
+        Keep(g_PerfPixels);
+        Keep(g_PerfScrubSeeks);
+        Keep(g_PerfScrubDropped);
+        Keep(g_PerfArtHits);
+        Keep(g_PerfArtMisses);
+        Keep(g_Settings.scrubSeekMs);
+    }
+
+    template <typename T>
+    void Keep(T& global) {
+        m_restore.push_back([&global, saved = global] { global = saved; });
+    }
+
+    template <typename T>
+    void Keep(atomic<T>& global) {
+        m_restore.push_back([&global, saved = global.load()] { global.store(saved); });
+    }
+
+    void Restore() {
+        for (auto& restore : m_restore) restore();
+    }
+
+    ~BenchSandbox() {
+        Restore();
+    }
+
+private:
+    vector<function<void()>> m_restore;
+};
+
+#ifndef MUSIC_WIDGET_HEADLESS
+// Paints of a synthetic Spotify track, drawn into a memory buffer by each renderer before
+// the panel is created: every frame from scratch, then a long title scrolling. Paint
+// times go to the mod log as one JSON object per line.
+void RunBenchmark() {
+    int width = g_Settings.width;
+    int height = g_Settings.height;
+    if (width <= 0 || height <= 0) return;
+    Wh_Log(L"Benchmark: %dx%d", width, height);
+
+    BenchSandbox sandbox;
+    VirtualClock clock;
+    MediaSnapshot state;
+    state.version = 1;
+    state.hasMedia = true;
+    state.isPlaying = true;
+    state.isSpotify = true;
+    state.sessionId = L"Spotify.exe";
+    state.duration = 240.0;
+    state.artGeneration = 1;
+    // A panel that has never been shown, on 'title' from its first second
+    auto fresh = [&](const wstring& title) {
+        sandbox.Restore();
+        g_Frames.SetClock(&clock);
+        state.title = title;
+        state.artist = L"Benchmark";
+        state.position = 0.0;
+        state.positionStamp = clock.Now();
+        UpdateScene(state, width, height);
+        int artSize = g_Layout.geometry.artSize;
+        ArtImage cover;
+        cover.width = cover.height = artSize;
+        cover.pixels.resize((size_t)artSize * artSize);
+        for (int y = 0; y < artSize; y++) {
+            for (int x = 0; x < artSize; x++) {
+                cover.pixels[(size_t)y * artSize + x] = 0xFF000000 | (x * 255 / artSize) << 16 | (y * 255 / artSize) << 8 | 0x60;
+            }
+        }
+        state.albumArt = make_shared<ArtImage>(move(cover));
+    };
+
+    vector<uint32_t> pixels((size_t)width * height);
+    Bitmap surface(width, height, width * 4, PixelFormat32bppPARGB, (BYTE*)pixels.data());
+    wstring longTitle;
+    for (int i = 0; i < 8; i++) longTitle += L"An Unreasonably Long Song Title, Part " + to_wstring(i + 1) + L" ";
+    for (bool software : { false, true }) {
+        const wchar_t* rendererName = software ? L"software" : L"gdiplus";
+        // What WM_PAINT does: the scene brought up to date, then drawn
+        auto paint = [&](LatencyHistogram& histogram, bool full) {
+            UpdateScene(state, width, height);
+            if (full) g_Scene.InvalidateAll();
+            ScopedLatency latency(histogram);
+            if (software) {
+                SoftwareRenderer renderer(pixels.data(), width, height, width);
+                DrawMediaPanel(renderer, state, width, height);
+            } else {
+                Graphics graphics(&surface);
+                GdiplusRenderer renderer(graphics);
+                DrawMediaPanel(renderer, state, width, height);
+            }
+        };
+        struct { const wchar_t* scenario; bool full; int frames; } scenarios[] = {
+            { L"full_redraw", true, 120 }, { L"long_marquee", false, 600 },
+        };
+        for (auto& scenario : scenarios) {
+            fresh(scenario.full ? L"Benchmark Frame" : longTitle);
+            LatencyHistogram paints;
+            for (int f = 0; f < scenario.frames; f++) {
+                clock.Advance(BENCH_FRAME_MS);
+                g_Frames.Tick();
+                paint(paints, scenario.full);
+            }
+            Wh_Log(L"{\"scenario\":\"%s\",\"renderer\":\"%s\",\"stage\":\"paint\",\"samples\":%llu,"
+                   L"\"p50_us\":%.1f,\"p99_us\":%.1f}",
+                   scenario.scenario, rendererName, (unsigned long long)paints.Count(),
+                   paints.Percentile(0.50) * 1000.0, paints.Percentile(0.99) * 1000.0);
+        }
+    }
+}
 
 // --- Main Thread ---
 void MediaThread() {
@@ -1041,6 +5483,10 @@ void MediaThread() {
     wc.hCursor = LoadCursor(NULL, IDC_ARROW);
     RegisterClass(&wc);
 
+    InitImageKernels();
+    RefreshTheme();
+    if (g_Settings.benchmark) RunBenchmark();
+
         // Position at bottom-left of screen
         RECT screenRect;
         SystemParametersInfo(SPI_GETWORKAREA, 0, &screenRect, 0);
@@ -1056,7 +5502,7 @@ void MediaThread() {
         ShowWindow(g_hMediaWindow, SW_SHOWNORMAL);
         UpdateWindow(g_hMediaWindow);
 
-    SetLayeredWindowAttributes(g_hMediaWindow, 0, 255, LWA_ALPHA);
+    ApplyPresentMode(g_hMediaWindow);
     
     MSG msg;
     while (GetMessage(&msg, NULL, 0, 0)) {
@@ -1074,6 +5520,7 @@ std::thread* g_pMediaThread = nullptr;
 // --- CALLBACKS ---
 BOOL WhTool_ModInit() {
     LoadSettings(); 
+    InstallCrashFilter();
     g_Running = true;
     g_pMediaThread = new std::thread(MediaThread);
     return TRUE;
@@ -1087,12 +5534,13 @@ void WhTool_ModUninit() {
         delete g_pMediaThread;
         g_pMediaThread = nullptr;
     }
+    RemoveCrashFilter();
 }
 
 void WhTool_ModSettingsChanged() {
     LoadSettings();
     if (g_hMediaWindow) {
-         SendMessage(g_hMediaWindow, WM_TIMER, IDT_POLL_MEDIA, 0);
+         g_MediaWorker.Notify(L"", MEDIA_CHANGE_ALL);
          SendMessage(g_hMediaWindow, WM_SETTINGCHANGE, 0, 0); 
     }
 }
@@ -1257,4 +5705,5 @@ void Wh_ModUninit() {
 
     WhTool_ModUninit();
     ExitProcess(0);
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,446 @@
+// Benchmark of the headless pipeline, one JSON object per scenario and stage on stdout.
+// Scripted sessions are played through the real code: a ScriptedMediaSource feeds a
+// MediaWorker driven synchronously through Apply, a VirtualClock drives the frame
+// scheduler, and SoftwareRenderer paints into memory with canned glyphs. Each stage
+// reports p50/p99/max and allocations per call. Not run by ctest:
+//   bench [scenario...]    (every scenario when none is named)
+#include "../music.mod.cpp"
+#include "test_cover.h"
+#include "canned_glyphs.h"
+#include "scripted_media_source.h"
+
+#include <cstdlib>
+#include <new>
+
+// Every form of new in the process is counted; the matching deletes only pair the
+// allocator up
+atomic<uint64_t> g_AllocCount{0};
+
+static void* CountedAlloc(size_t size) noexcept {
+    g_AllocCount.fetch_add(1, memory_order_relaxed);
+    return malloc(size ? size : 1);
+}
+
+static void* CountedAlignedAlloc(size_t size, align_val_t align) noexcept {
+    g_AllocCount.fetch_add(1, memory_order_relaxed);
+    size_t alignment = (size_t)align;
+    return aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+void* operator new(size_t size) {
+    if (void* p = CountedAlloc(size)) return p;
+    throw bad_alloc();
+}
+void* operator new[](size_t size) {
+    if (void* p = CountedAlloc(size)) return p;
+    throw bad_alloc();
+}
+void* operator new(size_t size, align_val_t align) {
+    if (void* p = CountedAlignedAlloc(size, align)) return p;
+    throw bad_alloc();
+}
+void* operator new[](size_t size, align_val_t align) {
+    if (void* p = CountedAlignedAlloc(size, align)) return p;
+    throw bad_alloc();
+}
+void* operator new(size_t size, const nothrow_t&) noexcept { return CountedAlloc(size); }
+void* operator new[](size_t size, const nothrow_t&) noexcept { return CountedAlloc(size); }
+void* operator new(size_t size, align_val_t align, const nothrow_t&) noexcept { return CountedAlignedAlloc(size, align); }
+void* operator new[](size_t size, align_val_t align, const nothrow_t&) noexcept { return CountedAlignedAlloc(size, align); }
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+void operator delete(void* p, const nothrow_t&) noexcept { free(p); }
+void operator delete[](void* p, const nothrow_t&) noexcept { free(p); }
+void operator delete(void* p, align_val_t) noexcept { free(p); }
+void operator delete[](void* p, align_val_t) noexcept { free(p); }
+void operator delete(void* p, size_t, align_val_t) noexcept { free(p); }
+void operator delete[](void* p, size_t, align_val_t) noexcept { free(p); }
+void operator delete(void* p, align_val_t, const nothrow_t&) noexcept { free(p); }
+void operator delete[](void* p, align_val_t, const nothrow_t&) noexcept { free(p); }
+
+// Gradient unique to 'seed', so every track gets its own cover
+static vector<uint8_t> MakeBenchCover(int size, uint32_t seed) {
+    vector<uint32_t> pixels((size_t)size * size);
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            uint32_t r = (x * 255 / size + seed * 37) & 0xFF;
+            uint32_t g = (y * 255 / size + seed * 91) & 0xFF;
+            uint32_t b = ((x ^ y) + seed * 13) & 0xFF;
+            pixels[(size_t)y * size + x] = 0xFF000000 | (r << 16) | (g << 8) | b;
+        }
+    }
+    return EncodeTestCover(size, size, pixels);
+}
+
+// Samples of one scenario, grouped by stage
+class BenchRun {
+public:
+    explicit BenchRun(const char* scenario) : m_scenario(scenario) {}
+
+    template <typename F>
+    void Measure(const char* stage, F work) {
+        Stage& s = Find(stage);
+        uint64_t allocs = g_AllocCount.load(memory_order_relaxed);
+        double start = g_SystemClock.Now();
+        work();
+        double end = g_SystemClock.Now();
+        // Read before the sample is stored, whose push_back may allocate
+        s.allocs += g_AllocCount.load(memory_order_relaxed) - allocs;
+        s.micros.push_back((end - start) * 1000.0);
+    }
+
+    // Pixels a stage produced or redrew, reported per call and as throughput at the median
+    void AddPixels(const char* stage, uint64_t pixels) {
+        Find(stage).pixels += pixels;
+    }
+
+    // A stage with a budget also reports whether its p99 stays within it
+    void SetBudget(const char* stage, double micros) {
+        Find(stage).budget = micros;
+    }
+
+    void Report() {
+        for (Stage& s : m_stages) {
+            if (s.micros.empty()) continue;
+            sort(s.micros.begin(), s.micros.end());
+            size_t calls = s.micros.size();
+            printf("{\"scenario\":\"%s\",\"stage\":\"%s\",\"samples\":%zu,\"p50_us\":%.1f,\"p99_us\":%.1f,"
+                   "\"max_us\":%.1f,\"allocs_per_call\":%.2f",
+                   m_scenario, s.name, calls, Percentile(s.micros, 0.50), Percentile(s.micros, 0.99),
+                   s.micros.back(), (double)s.allocs / calls);
+            if (s.pixels) {
+                double pixels = (double)s.pixels / calls;
+                printf(",\"px_per_call\":%.0f,\"mpx_per_s\":%.1f", pixels, pixels / Percentile(s.micros, 0.50));
+            }
+            if (s.budget > 0.0) {
+                printf(",\"budget_us\":%.0f,\"within_budget\":%s", s.budget,
+                       Percentile(s.micros, 0.99) <= s.budget ? "true" : "false");
+            }
+            printf("}\n");
+        }
+        fflush(stdout);
+    }
+
+private:
+    struct Stage {
+        const char* name;
+        vector<double> micros;
+        uint64_t allocs = 0;
+        uint64_t pixels = 0;
+        double budget = 0.0;
+    };
+
+    Stage& Find(const char* name) {
+        for (Stage& s : m_stages) {
+            if (strcmp(s.name, name) == 0) return s;
+        }
+        m_stages.push_back(Stage());
+        m_stages.back().name = name;
+        return m_stages.back();
+    }
+
+    // Nearest-rank percentile of sorted samples
+    static double Percentile(const vector<double>& sorted, double q) {
+        size_t rank = (size_t)ceil(q * sorted.size());
+        return sorted[rank > 0 ? rank - 1 : 0];
+    }
+
+    const char* m_scenario;
+    vector<Stage> m_stages;
+};
+
+// One Spotify session on a never-started worker, and a panel drawn at the default size
+struct BenchPanel {
+    const wstring appId = L"Spotify.exe";
+    int width = g_Settings.width;
+    int height = g_Settings.height;
+    int artSize = g_Settings.height - 12;
+    BenchSandbox sandbox;
+    VirtualClock clock;
+    CannedGlyphProvider glyphs;
+    ScriptedMediaSource source;
+    TripleBuffer<MediaSnapshot> snapshots;
+    MediaWorker pipeline{snapshots};
+    vector<uint32_t> pixels;
+
+    // Live scrubbing stays off: drag_seek seeks the source directly instead
+    BenchPanel() : pixels((size_t)width * height) {
+        g_UiSnapshots = &snapshots;
+        g_Glyphs = &glyphs;
+        g_Frames.SetClock(&clock);
+        g_ArtSizeRequested = artSize;
+        g_Settings.scrubSeekMs = 0;
+        BuildPalette();
+    }
+
+    // A new track playing from its start, read in full
+    void SetTrack(const wstring& title, const wstring& artist, double duration, uint32_t coverSeed) {
+        source.SetTrack(appId, title, artist, MakeBenchCover(256, coverSeed));
+        source.SetTimeline(appId, 0.0, duration, clock.Now());
+    }
+
+    void Apply(unsigned changes) {
+        pipeline.Apply(source, changes, artSize);
+    }
+
+    // What WM_PAINT does: one snapshot, the scene brought up to date, then drawn
+    void Paint() {
+        const MediaSnapshot& state = AcquireMediaSnapshot();
+        UpdateScene(state, width, height);
+        SoftwareRenderer renderer(pixels.data(), width, height, width);
+        DrawMediaPanel(renderer, state, width, height);
+    }
+
+    void Frame(BenchRun& run) {
+        clock.Advance(BENCH_FRAME_MS);
+        run.Measure("tick", [&] { g_Frames.Tick(); });
+        run.Measure("paint", [&] { Paint(); });
+        run.AddPixels("paint", g_Scene.pixelsTouched);
+    }
+};
+
+// Track churn: a new track every few frames; the second half replays earlier covers
+static void TrackChurn() {
+    BenchPanel panel;
+    BenchRun run("track_churn");
+    for (int i = 0; i < 160; i++) {
+        int track = i % 80;
+        panel.SetTrack(L"Track " + to_wstring(track), L"Artist " + to_wstring(track % 7), 180.0 + track, track);
+        run.Measure("update", [&] { panel.Apply(MEDIA_CHANGE_ALL); });
+        for (int f = 0; f < 4; f++) panel.Frame(run);
+    }
+    run.Report();
+}
+
+// Long marquee: a title far wider than the text area scrolling for ten seconds
+static void LongMarquee() {
+    BenchPanel panel;
+    BenchRun run("long_marquee");
+    wstring title;
+    for (int i = 0; i < 8; i++) title += L"An Unreasonably Long Song Title, Part " + to_wstring(i + 1) + L" ";
+    panel.SetTrack(title, L"Somebody Featuring Everybody Else", 600.0, 1000);
+    panel.Apply(MEDIA_CHANGE_ALL);
+    for (int f = 0; f < 600; f++) panel.Frame(run);
+    run.Report();
+}
+
+// Drag-seeking: grab the bar, sweep across it over one second, release and seek
+static void DragSeek() {
+    BenchPanel panel;
+    BenchRun run("drag_seek");
+    panel.SetTrack(L"Seek Target", L"Scrubber", 240.0, 2000);
+    panel.Apply(MEDIA_CHANGE_ALL);
+    panel.Frame(run);
+    const PanelGeometry& g = g_Layout.geometry;
+    int y = g.barY + BAR_HEIGHT / 2;
+    for (int drag = 0; drag < 8; drag++) {
+        g_TimelineDragging = true;
+        g_TimelineDragProgress = g_Layout.TimelineFraction(g.barX);
+        for (int f = 0; f <= 60; f++) {
+            int x = g.barX + g.barW * f / 60;
+            run.Measure("pointer", [&] { HandlePointerMove(x, y); });
+            panel.Frame(run);
+        }
+        run.Measure("seek", [&] {
+            panel.source.SetTimeline(panel.appId, g_TimelineDragProgress * 240.0, 240.0, panel.clock.Now());
+            panel.Apply(MEDIA_CHANGE_TIMELINE);
+        });
+        g_TimelineDragging = false;
+        panel.Frame(run);
+    }
+    run.Report();
+}
+
+// Hover: visit each control, the bar and the tab zone, staying on the tab for less than
+// the hold time so the separator bolds and fades without sliding the panel
+static void Hover() {
+    BenchPanel panel;
+    BenchRun run("hover");
+    panel.SetTrack(L"Hover Target", L"Pointer", 240.0, 3000);
+    panel.Apply(MEDIA_CHANGE_ALL);
+    panel.Frame(run);
+    const PanelGeometry& g = g_Layout.geometry;
+    const int stops[5][2] = {
+        { g.prevX + 4, g.controlY }, { g.playX + 4, g.controlY }, { g.nextX + 4, g.controlY },
+        { g.barX + g.barW / 2, g.barY + BAR_HEIGHT / 2 }, { g.separatorX + 7, panel.height / 2 }
+    };
+    for (int lap = 0; lap < 4; lap++) {
+        for (int stop = 0; stop < 5; stop++) {
+            int frames = stop == 4 ? 120 : 30;
+            for (int f = 0; f < frames; f++) {
+                run.Measure("pointer", [&] { HandlePointerMove(stops[stop][0], stops[stop][1]); });
+                panel.Frame(run);
+            }
+        }
+    }
+    run.Report();
+}
+
+// Cover pipeline: decoded and premultiplied once, resampled once per display size, then
+// a 1:1 blit per frame, which must not allocate
+static void ArtPipeline() {
+    BenchRun run("art_pipeline");
+    vector<uint8_t> bytes = MakeBenchCover(1000, 5);
+    ArtImage cover;
+    for (int i = 0; i < 10; i++) {
+        run.Measure("decode", [&] { DecodeArt(bytes, cover); });
+        run.AddPixels("decode", cover.pixels.size());
+    }
+    vector<uint32_t> straight(cover.pixels.size());
+    for (int i = 0; i < 10; i++) {
+        memcpy(straight.data(), bytes.data() + 8, straight.size() * 4);
+        run.Measure("premultiply", [&] { g_Kernels.premultiply(straight.data(), straight.size()); });
+        run.AddPixels("premultiply", straight.size());
+    }
+    // The art at 100%, 150% and 200% scaling of the default panel
+    const struct { const char* stage; int size; } sizes[] = {
+        { "resample_88", 88 }, { "resample_132", 132 }, { "resample_176", 176 },
+    };
+    ArtImage art;
+    for (auto& size : sizes) {
+        for (int i = 0; i < 10; i++) {
+            run.Measure(size.stage, [&] { art = ResampleArt(cover, size.size, size.size); });
+            run.AddPixels(size.stage, cover.pixels.size());
+        }
+    }
+    vector<uint32_t> pixels((size_t)art.width * art.height);
+    for (int i = 0; i < 100; i++) {
+        run.Measure("blit", [&] {
+            SoftwareRenderer renderer(pixels.data(), art.width, art.height, art.width);
+            renderer.DrawImage(art, 0.0f, 0.0f, (float)art.width, (float)art.height, false);
+        });
+        run.AddPixels("blit", pixels.size());
+    }
+    run.Report();
+}
+
+// Adaptive accent: the palette histogram over a large cover, which has a millisecond to
+// finish on the worker
+static void PaletteExtraction() {
+    BenchRun run("art_palette");
+    run.SetBudget("extract", 1000.0);
+    ArtImage cover;
+    DecodeArt(MakeBenchCover(1000, 7), cover);
+    for (int i = 0; i < 50; i++) {
+        run.Measure("extract", [&] { ExtractArtPalette(cover); });
+        run.AddPixels("extract", cover.pixels.size());
+    }
+    run.Report();
+}
+
+// Blurred backdrop: built once per cover and panel size, at a few panel sizes, then
+// drawn each frame as a single blit
+static void BackdropBlur() {
+    BenchRun run("backdrop_blur");
+    ArtImage cover;
+    DecodeArt(MakeBenchCover(1000, 11), cover);
+    const struct { const char* stage; int width, height; } sizes[] = {
+        { "300x48", 300, 48 }, { "400x100", 400, 100 }, { "600x96", 600, 96 }, { "1200x192", 1200, 192 },
+    };
+    ArtImage backdrop;
+    for (auto& size : sizes) {
+        BackdropSpec spec;
+        spec.width = size.width;
+        spec.height = size.height;
+        for (int i = 0; i < 20; i++) {
+            run.Measure(size.stage, [&] { backdrop = BlurBackdrop(cover, spec); });
+            run.AddPixels(size.stage, (uint64_t)size.width * size.height);
+        }
+    }
+    vector<uint32_t> pixels((size_t)backdrop.width * backdrop.height);
+    for (int i = 0; i < 100; i++) {
+        run.Measure("blit", [&] {
+            SoftwareRenderer renderer(pixels.data(), backdrop.width, backdrop.height, backdrop.width);
+            renderer.DrawImage(backdrop, 0.0f, 0.0f, (float)backdrop.width, (float)backdrop.height, false);
+        });
+        run.AddPixels("blit", pixels.size());
+    }
+    run.Report();
+}
+
+// Image kernels: every level this CPU runs, over a 1000x1000 image. Only speed is
+// measured here; image_kernels_test checks each level against the scalar reference.
+static void Kernels() {
+    const int size = 1000;
+    const size_t count = (size_t)size * size;
+    vector<uint32_t> straight(count), backdrop(count);
+    vector<uint8_t> mask(count);
+    uint32_t seed = 1;
+    for (size_t i = 0; i < count; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        straight[i] = seed;
+        backdrop[i] = seed * 2654435761u;
+        // Runs of full coverage, like the inside of a corner mask
+        mask[i] = (i / 64) % 2 ? 255 : (uint8_t)(seed >> 8);
+    }
+    ArtImage cover;
+    cover.width = size;
+    cover.height = size;
+    cover.pixels = straight;
+    PremultiplyScalar(cover.pixels.data(), count);
+    PremultiplyScalar(backdrop.data(), count);
+    const vector<uint32_t>& premultiplied = cover.pixels;
+    int artSize = g_Settings.height - 12;
+
+    const char* scenarios[SIMD_LEVELS] = { "kernels_scalar", "kernels_sse2", "kernels_avx2" };
+    vector<uint32_t> out(count), bins((size_t)(PALETTE_BINS + 1) * 4);
+    for (int level = SIMD_SCALAR; level <= g_SimdLevel; level++) {
+        const ImageKernels& kernels = g_KernelTable[level];
+        BenchRun run(scenarios[level]);
+        // Each stage is timed over a fresh copy of its input, made outside the timing
+        auto measure = [&](const char* stage, const vector<uint32_t>& input, auto work) {
+            for (int i = 0; i < 10; i++) {
+                out = input;
+                run.Measure(stage, work);
+                run.AddPixels(stage, count);
+            }
+        };
+        measure("premultiply", straight, [&] { kernels.premultiply(out.data(), count); });
+        measure("unpremultiply", premultiplied, [&] { kernels.unpremultiply(out.data(), count); });
+        measure("blend_over", backdrop, [&] { kernels.blendOver(out.data(), premultiplied.data(), count); });
+        measure("apply_mask", premultiplied, [&] { kernels.applyMask(out.data(), mask.data(), count); });
+        measure("box_blur", out, [&] { kernels.boxBlurColumns(premultiplied.data(), out.data(), size, size, 16); });
+        measure("palette_bins", out, [&] {
+            fill(bins.begin(), bins.end(), 0u);
+            for (int y = 0; y < size; y++) kernels.countPaletteBins(&straight[(size_t)y * size], size, bins.data());
+        });
+        // Throughput counted in source pixels, the ones the downscale reads
+        for (int i = 0; i < 10; i++) {
+            run.Measure("resample", [&] { ResampleArt(cover, artSize, artSize, kernels); });
+            run.AddPixels("resample", count);
+        }
+        run.Report();
+    }
+}
+
+static const struct {
+    const char* name;
+    void (*run)();
+} g_Scenarios[] = {
+    { "track_churn", TrackChurn },
+    { "long_marquee", LongMarquee },
+    { "drag_seek", DragSeek },
+    { "hover", Hover },
+    { "art_pipeline", ArtPipeline },
+    { "art_palette", PaletteExtraction },
+    { "backdrop_blur", BackdropBlur },
+    { "kernels", Kernels },
+};
+
+int main(int argc, char** argv) {
+    InitImageKernels();
+    printf("{\"bench\":\"music_widget\",\"width\":%d,\"height\":%d,\"simd\":\"%ls\"}\n", g_Settings.width,
+           g_Settings.height, g_Kernels.name);
+    int ran = 0;
+    for (auto& scenario : g_Scenarios) {
+        bool wanted = argc < 2;
+        for (int i = 1; i < argc; i++) wanted = wanted || strcmp(argv[i], scenario.name) == 0;
+        if (!wanted) continue;
+        scenario.run();
+        ran++;
+    }
+    return ran > 0 ? 0 : 1;
+}
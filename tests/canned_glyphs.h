@@ -0,0 +1,38 @@
+// Text without fonts, for rendering the panel headlessly. Every character is a cell of
+// fixed advance holding a solid bar whose height follows the character code, so the
+// output is identical on every machine and a different string draws differently.
+#pragma once
+
+class CannedGlyphProvider : public GlyphProvider {
+public:
+    TextExtent Measure(const wstring& text, int pixelSize) override {
+        TextExtent extent;
+        extent.width = (float)(Advance(pixelSize) * (int)text.size());
+        extent.height = LineHeight(pixelSize);
+        return extent;
+    }
+
+    void DrawText(ArtImage& target, const wstring& text, int pixelSize, float x, float y, uint32_t argb) override {
+        uint32_t color = argb;
+        PremultiplyScalar(&color, 1);
+        int advance = Advance(pixelSize);
+        int left = (int)floorf(x + 0.5f);
+        // The bars stand on a baseline about where the font's would be
+        int baseline = (int)floorf(y + 0.5f) + (int)(pixelSize * 1.05f);
+        for (size_t i = 0; i < text.size(); i++) {
+            if (text[i] == L' ') continue;
+            int height = pixelSize * (4 + (int)(text[i] % 5)) / 8;
+            int x0 = left + (int)i * advance + 1;
+            int x1 = x0 + advance - 2;
+            for (int py = max(baseline - height, 0); py < min(baseline, target.height); py++) {
+                for (int px = max(x0, 0); px < min(x1, target.width); px++) {
+                    uint32_t& dst = target.pixels[(size_t)py * target.width + px];
+                    dst = BlendOverPixel(color, dst);
+                }
+            }
+        }
+    }
+
+    static int Advance(int pixelSize) { return max(2, pixelSize * 5 / 8); }
+    static float LineHeight(int pixelSize) { return ceilf(pixelSize * 1.33f); }
+};
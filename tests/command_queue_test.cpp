@@ -0,0 +1,247 @@
+// CommandQueue merging, and the worker running it against a session that takes its
+// time to answer each command.
+#include "../music.mod.cpp"
+#include "harness.h"
+#include "worker_fixture.h"
+
+#define CMD_PREV   HIT_PREV
+#define CMD_TOGGLE HIT_PLAY
+#define CMD_NEXT   HIT_NEXT
+
+static function<void(CommandStatus)> Collect(vector<CommandStatus>& statuses) {
+    return [&statuses](CommandStatus status) { statuses.push_back(status); };
+}
+
+TEST(SkipBurstIsOneBoundedEntry) {
+    CommandQueue queue;
+    vector<CommandStatus> statuses;
+    for (int i = 0; i < 12; i++) queue.Push(CMD_NEXT, 0.0, 1000.0 + i, Collect(statuses));
+    QueuedCommand entry;
+    CHECK(queue.Pop(entry));
+    CHECK(queue.Empty());
+    CHECK_EQ(entry.count, 12);
+    CHECK_EQ(entry.Calls(), COMMAND_MAX_SKIPS);
+    CHECK_EQ(entry.deadline, 1011.0);  // The newest command's
+    entry.Complete(COMMAND_ACCEPTED);
+    CHECK_EQ(statuses.size(), (size_t)12);
+    for (CommandStatus status : statuses) CHECK_EQ(status, COMMAND_ACCEPTED);
+
+    queue.Push(CMD_PREV, 0.0, 0.0, nullptr);
+    queue.Push(CMD_PREV, 0.0, 0.0, nullptr);
+    CHECK(queue.Pop(entry));
+    CHECK_EQ(entry.Calls(), 2);
+}
+
+TEST(TogglesCancelInPairs) {
+    CommandQueue queue;
+    QueuedCommand entry;
+    for (int toggles = 1; toggles <= 5; toggles++) {
+        for (int i = 0; i < toggles; i++) queue.Push(CMD_TOGGLE, 0.0, 0.0, nullptr);
+        CHECK(queue.Pop(entry));
+        CHECK_EQ(entry.Calls(), toggles % 2);
+    }
+}
+
+TEST(SeeksKeepTheLastTarget) {
+    CommandQueue queue;
+    for (int i = 1; i <= 30; i++) queue.Push(COMMAND_SEEK, i * 2.0, 0.0, nullptr);
+    QueuedCommand entry;
+    CHECK(queue.Pop(entry));
+    CHECK_EQ(entry.Calls(), 1);
+    CHECK_EQ(entry.seconds, 60.0);
+}
+
+TEST(DifferentCommandsKeepTheirOrder) {
+    CommandQueue queue;
+    int order[] = { CMD_NEXT, CMD_NEXT, CMD_PREV, CMD_NEXT, COMMAND_SEEK, CMD_TOGGLE };
+    for (int cmd : order) queue.Push(cmd, 5.0, 0.0, nullptr);
+    int expected[][2] = { { CMD_NEXT, 2 }, { CMD_PREV, 1 }, { CMD_NEXT, 1 }, { COMMAND_SEEK, 1 }, { CMD_TOGGLE, 1 } };
+    QueuedCommand entry;
+    for (auto& e : expected) {
+        CHECK(queue.Pop(entry));
+        CHECK_EQ(entry.cmd, e[0]);
+        CHECK_EQ(entry.count, e[1]);
+    }
+    CHECK(!queue.Pop(entry));
+}
+
+// The entry in flight has been popped; what arrives meanwhile queues behind it
+TEST(InFlightEntryIsNotMergedInto) {
+    CommandQueue queue;
+    queue.Push(CMD_NEXT, 0.0, 0.0, nullptr);
+    QueuedCommand inFlight;
+    CHECK(queue.Pop(inFlight));
+    queue.Push(CMD_NEXT, 0.0, 0.0, nullptr);
+    queue.Push(CMD_NEXT, 0.0, 0.0, nullptr);
+    CHECK_EQ(inFlight.count, 1);
+    QueuedCommand next;
+    CHECK(queue.Pop(next));
+    CHECK_EQ(next.count, 2);
+}
+
+TEST(CancelTakesTheWholeEntry) {
+    CommandQueue queue;
+    vector<CommandStatus> statuses;
+    uint64_t first = queue.Push(CMD_NEXT, 0.0, 0.0, Collect(statuses));
+    uint64_t second = queue.Push(CMD_NEXT, 0.0, 0.0, Collect(statuses));
+    uint64_t seek = queue.Push(COMMAND_SEEK, 10.0, 0.0, Collect(statuses));
+    CHECK(first != second && second != seek);
+
+    QueuedCommand cancelled;
+    CHECK(queue.Cancel(second, cancelled));
+    CHECK_EQ(cancelled.count, 2);
+    cancelled.Complete(COMMAND_CANCELLED);
+    CHECK_EQ(statuses.size(), (size_t)2);
+    CHECK(!queue.Cancel(first, cancelled));
+    CHECK(!queue.Cancel(12345, cancelled));
+
+    deque<QueuedCommand> rest;
+    queue.TakeAll(rest);
+    CHECK_EQ(rest.size(), (size_t)1);
+    CHECK_EQ(rest[0].cmd, COMMAND_SEEK);
+    CHECK(queue.Empty());
+}
+
+// Keeps the worker busy inside a task until it goes out of scope, so commands pile up
+// behind it the way they do behind a slow round trip
+class WorkerHold {
+public:
+    explicit WorkerHold(MediaWorker& worker) {
+        worker.Post([this](MediaSource&) {
+            m_held = true;
+            while (!m_release) this_thread::yield();
+        });
+        CHECK(WaitFor([this] { return m_held.load(); }));
+    }
+
+    ~WorkerHold() { m_release = true; }
+
+private:
+    atomic<bool> m_held{false};
+    atomic<bool> m_release{false};
+};
+
+static void StartSlowSession(WorkerFixture& f, int delayMs) {
+    f.source->AddSession(L"Spotify.exe", L"Song");
+    f.source->commandDelayMs = delayMs;
+    f.Start();
+    f.WaitForSnapshot([](const MediaSnapshot& s) { return s.title == L"Song"; });
+}
+
+TEST(WorkerMergesSkipsBehindASlowCall) {
+    WorkerFixture f;
+    StartSlowSession(f, 30);
+    {
+        WorkerHold hold(f.worker);
+        for (int i = 0; i < 20; i++) f.worker.Command(CMD_NEXT);
+    }
+    f.Drain();
+    vector<int> sent = f.source->Commands();
+    CHECK_EQ(sent.size(), (size_t)COMMAND_MAX_SKIPS);
+    for (int cmd : sent) CHECK_EQ(cmd, CMD_NEXT);
+}
+
+TEST(WorkerKeepsOrderAndDropsToggledPairs) {
+    WorkerFixture f;
+    StartSlowSession(f, 10);
+    {
+        WorkerHold hold(f.worker);
+        f.worker.Command(CMD_NEXT);
+        f.worker.Command(CMD_TOGGLE);
+        f.worker.Command(CMD_TOGGLE);
+        f.worker.Command(CMD_PREV);
+        f.worker.Command(CMD_TOGGLE);
+    }
+    f.Drain();
+    vector<int> sent = f.source->Commands();
+    vector<int> expected = { CMD_NEXT, CMD_PREV, CMD_TOGGLE };
+    CHECK(sent == expected);
+}
+
+TEST(WorkerSendsOnlyTheLastSeekOfADrag) {
+    WorkerFixture f;
+    StartSlowSession(f, 40);
+    // A drag sending a new target every 5 ms while each seek takes 40 ms to answer: one
+    // seek goes out per round trip at most
+    auto start = chrono::steady_clock::now();
+    for (int i = 1; i <= 60; i++) {
+        f.worker.Seek(i);
+        this_thread::sleep_for(chrono::milliseconds(5));
+    }
+    int dragMs = (int)chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+    f.Drain();
+    CHECK(f.source->seeks <= dragMs / 40 + 2);
+    CHECK(f.source->seeks < 60);
+    CHECK(f.source->seeks >= 2);
+    CHECK_EQ(f.source->LastSeek(), 60.0);
+    // Published right away, ahead of the app's own timeline event
+    CHECK_EQ(f.snapshots.Acquire().position, 60.0);
+}
+
+// The worker's own sample after a seek must not confirm the seek; the app's timeline does
+TEST(SeekIsConfirmedByTheAppNotByItsEstimate) {
+    WorkerFixture f;
+    f.source->AddSession(L"Spotify.exe", L"Song");
+    f.source->SetTimeline(L"Spotify.exe", 10.0, 180.0, g_SystemClock.Now());
+    f.Start();
+    const MediaSnapshot& before = f.WaitForSnapshot([](const MediaSnapshot& s) { return s.duration == 180.0; });
+    CommandOverlay overlay;
+    overlay.Issue(COMMAND_SEEK, before, g_SystemClock.Now(), 60.0);
+
+    f.worker.Seek(60.0);
+    const MediaSnapshot& estimate = f.WaitForSnapshot([](const MediaSnapshot& s) { return s.position == 60.0; });
+    CHECK(estimate.positionEstimated);
+    CHECK_EQ(overlay.Reconcile(estimate), CommandOverlay::PENDING);
+
+    // Other events keep the estimate rather than the stale timeline read before the seek
+    f.source->SetTrack(L"Spotify.exe", L"Song", L"");
+    f.Drain();
+    CHECK_EQ(f.snapshots.Acquire().position, 60.0);
+    CHECK_EQ(overlay.Reconcile(f.snapshots.Current()), CommandOverlay::PENDING);
+
+    // The app has not caught up yet
+    f.source->SetTimeline(L"Spotify.exe", 10.5, 180.0, g_SystemClock.Now());
+    const MediaSnapshot& stale = f.WaitForSnapshot([](const MediaSnapshot& s) { return !s.positionEstimated; });
+    CHECK_EQ(overlay.Reconcile(stale), CommandOverlay::PENDING);
+
+    f.source->SetTimeline(L"Spotify.exe", 60.2, 180.0, g_SystemClock.Now());
+    const MediaSnapshot& real = f.WaitForSnapshot([](const MediaSnapshot& s) { return s.position > 60.0; });
+    CHECK_EQ(overlay.Reconcile(real), CommandOverlay::CONFIRMED);
+}
+
+TEST(WorkerDropsCancelledCommands) {
+    WorkerFixture f;
+    StartSlowSession(f, 10);
+    {
+        WorkerHold hold(f.worker);
+        uint64_t id = f.worker.Command(CMD_NEXT);
+        f.worker.Command(CMD_TOGGLE);
+        f.worker.CancelCommand(id);
+    }
+    f.Drain();
+    vector<int> expected = { CMD_TOGGLE };
+    CHECK(f.source->Commands() == expected);
+
+    // Cycling the session drops whatever was queued for the old one
+    f.source->AddSession(L"msedge.exe", L"Video");
+    f.Drain();
+    {
+        WorkerHold hold(f.worker);
+        f.worker.Command(CMD_NEXT);
+        f.worker.Command(CMD_PREV);
+        f.worker.CycleSession();
+    }
+    f.Drain();
+    CHECK(f.source->Commands() == expected);
+}
+
+TEST(SlowSessionDoesNotDelayQueueing) {
+    WorkerFixture f;
+    StartSlowSession(f, 200);
+    f.worker.Command(CMD_NEXT);
+    // Queued while the first command is waiting on the app: returns at once
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < 100; i++) f.worker.Command(i % 2 ? CMD_PREV : CMD_NEXT);
+    CHECK(chrono::steady_clock::now() - start < chrono::milliseconds(150));
+    f.Drain();
+}
@@ -0,0 +1,185 @@
+// FrameScheduler on a VirtualClock: which steps run when, what timer is armed, and
+// that replaying the same schedule gives the same frames.
+#include "../music.mod.cpp"
+#include "harness.h"
+
+#define TEST_WINDOW ((HWND)1)
+#define TEST_TIMER  7
+
+// Follows the armed timer the way WM_TIMER would until nothing is left to run
+static int RunUntilIdle(FrameScheduler& frames, VirtualClock& clock, int maxTicks = 10000) {
+    int ticks = 0;
+    while (frames.ArmedDelay() && ticks < maxTicks) {
+        clock.Advance(frames.ArmedDelay());
+        frames.Tick();
+        ticks++;
+    }
+    return ticks;
+}
+
+TEST(IdleArmsNothing) {
+    VirtualClock clock;
+    FrameScheduler frames;
+    frames.SetClock(&clock);
+    g_HeadlessTimer = HeadlessTimer();
+    frames.Attach(TEST_WINDOW, TEST_TIMER);
+    CHECK_EQ(frames.ArmedDelay(), 0u);
+    CHECK_EQ(frames.NextDue(), FRAME_DONE);
+    CHECK_EQ(g_HeadlessTimer.sets, 0);
+    frames.Detach();
+}
+
+TEST(RunsEveryFrameUntilDone) {
+    VirtualClock clock;
+    FrameScheduler frames;
+    frames.SetClock(&clock);
+    g_HeadlessTimer = HeadlessTimer();
+    frames.Attach(TEST_WINDOW, TEST_TIMER);
+    CHECK_EQ(frames.FrameInterval(), 16u);  // The headless display runs at 60 Hz
+
+    vector<double> times;
+    frames.Start(ANIM_SLIDE, [&](double now) {
+        times.push_back(now);
+        return times.size() < 5 ? now : FRAME_DONE;
+    });
+    CHECK_EQ(frames.ArmedDelay(), frames.FrameInterval());
+    CHECK_EQ(RunUntilIdle(frames, clock), 5);
+    CHECK_EQ(times.size(), (size_t)5);
+    CHECK_EQ(times[4] - times[0], 4.0 * frames.FrameInterval());
+    // Settled: the timer is gone, and was armed once for the whole run
+    CHECK(!frames.IsRunning(ANIM_SLIDE));
+    CHECK(!g_HeadlessTimer.armed);
+    CHECK_EQ(g_HeadlessTimer.sets, 1);
+    frames.Detach();
+}
+
+TEST(SleepsUntilALaterDeadline) {
+    VirtualClock clock;
+    FrameScheduler frames;
+    frames.SetClock(&clock);
+    frames.Attach(TEST_WINDOW, TEST_TIMER);
+
+    int calls = 0;
+    double first = 0.0;
+    frames.Start(ANIM_MARQUEE, [&](double now) {
+        if (++calls == 1) first = now;
+        return calls == 1 ? now + 2000.0 : FRAME_DONE;
+    });
+    RunUntilIdle(frames, clock, 1);
+    CHECK_EQ(calls, 1);
+    CHECK_EQ(frames.ArmedDelay(), 2000u);
+
+    // Woken early by another animation: the sleeping one is left alone
+    clock.Advance(100.0);
+    frames.Tick();
+    CHECK_EQ(calls, 1);
+    CHECK_EQ(frames.ArmedDelay(), 1900u);
+    CHECK_EQ(RunUntilIdle(frames, clock), 1);
+    CHECK_EQ(calls, 2);
+    CHECK_EQ(clock.now, first + 2000.0);
+    frames.Detach();
+}
+
+TEST(StepsMayStartAndStopAnimations) {
+    VirtualClock clock;
+    FrameScheduler frames;
+    frames.SetClock(&clock);
+    frames.Attach(TEST_WINDOW, TEST_TIMER);
+
+    vector<string> log;
+    frames.Start(ANIM_HOVER, [&](double now) {
+        log.push_back("hover");
+        // Hands over to the progress animation and stops itself, while it runs
+        frames.Start(ANIM_PROGRESS, [&](double now) {
+            log.push_back("progress");
+            return log.size() < 4 ? now : FRAME_DONE;
+        });
+        frames.Stop(ANIM_HOVER);
+        return now;
+    });
+    frames.Start(ANIM_HUD, [&](double now) {
+        log.push_back("hud");
+        // Replaces itself; the new step runs from the next frame
+        frames.Start(ANIM_HUD, [&](double) {
+            log.push_back("hud2");
+            return FRAME_DONE;
+        });
+        return now;
+    });
+    RunUntilIdle(frames, clock);
+
+    // Progress starts in the frame that registers it, its slot coming after hover's; the
+    // next frame runs it again and then the replacement HUD step
+    vector<string> expected = { "hover", "progress", "hud", "progress", "hud2" };
+    CHECK_EQ(log.size(), expected.size());
+    for (size_t i = 0; i < log.size() && i < expected.size(); i++) CHECK_EQ(log[i], expected[i]);
+    CHECK(!frames.IsRunning(ANIM_HOVER));
+    CHECK(!frames.IsRunning(ANIM_PROGRESS));
+    CHECK(!frames.IsRunning(ANIM_HUD));
+    CHECK_EQ(frames.ArmedDelay(), 0u);
+    frames.Detach();
+}
+
+// A panel-like mix: a marquee that pauses between passes, a hover fade and a progress
+// bar that wakes once a second. Returns every (time, id) step that ran.
+static vector<pair<double, int>> ReplaySchedule() {
+    VirtualClock clock;
+    clock.now = 12345.0;
+    FrameScheduler frames;
+    frames.SetClock(&clock);
+    frames.Attach(TEST_WINDOW, TEST_TIMER);
+
+    vector<pair<double, int>> ran;
+    double marqueeStart = clock.now;
+    frames.Start(ANIM_MARQUEE, [&](double now) {
+        ran.push_back({ now - marqueeStart, ANIM_MARQUEE });
+        double phase = fmod(now - marqueeStart, 1500.0);
+        return phase < 500.0 ? now : now + (1500.0 - phase);
+    });
+    int hover = 0;
+    frames.Start(ANIM_HOVER, [&](double now) {
+        ran.push_back({ now - marqueeStart, ANIM_HOVER });
+        return ++hover < 7 ? now : FRAME_DONE;
+    });
+    frames.Start(ANIM_PROGRESS, [&](double now) {
+        ran.push_back({ now - marqueeStart, ANIM_PROGRESS });
+        return now + 1000.0;
+    });
+    while (clock.now - marqueeStart < 5000.0) {
+        clock.Advance(frames.ArmedDelay());
+        frames.Tick();
+    }
+    frames.Detach();
+    return ran;
+}
+
+TEST(ReplayIsDeterministic) {
+    vector<pair<double, int>> first = ReplaySchedule();
+    vector<pair<double, int>> second = ReplaySchedule();
+    CHECK(first.size() > 50);
+    CHECK(first == second);
+
+    // Between marquee passes only the progress bar wakes, once a second
+    int idleSteps = 0;
+    for (auto& step : first) {
+        double phase = fmod(step.first, 1500.0);
+        if (phase >= 500.0 + 16.0) {
+            idleSteps++;
+            CHECK_EQ(step.second, (int)ANIM_PROGRESS);
+        }
+    }
+    CHECK(idleSteps > 0);
+}
+
+TEST(DetachKillsTheTimer) {
+    VirtualClock clock;
+    FrameScheduler frames;
+    frames.SetClock(&clock);
+    g_HeadlessTimer = HeadlessTimer();
+    frames.Attach(TEST_WINDOW, TEST_TIMER);
+    frames.Start(ANIM_SCRUB, [](double now) { return now; });
+    CHECK(g_HeadlessTimer.armed);
+    frames.Detach();
+    CHECK(!g_HeadlessTimer.armed);
+    CHECK(!frames.IsRunning(ANIM_SCRUB));
+}
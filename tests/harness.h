@@ -0,0 +1,97 @@
+// Included by each test right after music.mod.cpp. TEST bodies run in the order they are
+// defined; a failed CHECK is reported and the test carries on, and the process exits
+// non-zero if any failed.
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+
+#include "test_cover.h"
+
+struct TestCase {
+    const char* name;
+    void (*run)();
+};
+
+inline vector<TestCase>& TestCases() {
+    static vector<TestCase> cases;
+    return cases;
+}
+
+inline int g_TestFailures = 0;
+
+struct TestRegistration {
+    TestRegistration(const char* name, void (*run)()) { TestCases().push_back({ name, run }); }
+};
+
+#define TEST(name) \
+    static void name(); \
+    static TestRegistration name##_registration(#name, name); \
+    static void name()
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            g_TestFailures++; \
+        } \
+    } while (0)
+
+#define CHECK_EQ(a, b) \
+    do { \
+        auto _a = (a); \
+        auto _b = (b); \
+        if (!(_a == _b)) { \
+            fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: %s vs %s\n", __FILE__, __LINE__, #a, #b, \
+                    TestText(_a).c_str(), TestText(_b).c_str()); \
+            g_TestFailures++; \
+        } \
+    } while (0)
+
+#define CHECK_NEAR(a, b, tolerance) \
+    do { \
+        double _a = (a); \
+        double _b = (b); \
+        if (!(fabs(_a - _b) <= (tolerance))) { \
+            fprintf(stderr, "%s:%d: CHECK_NEAR(%s, %s) failed: %.6f vs %.6f\n", __FILE__, __LINE__, #a, #b, _a, _b); \
+            g_TestFailures++; \
+        } \
+    } while (0)
+
+template <typename T>
+string TestText(const T& value) {
+    if constexpr (is_same_v<T, wstring>) {
+        return string(value.begin(), value.end());
+    } else if constexpr (is_same_v<T, string>) {
+        return value;
+    } else if constexpr (is_enum_v<T>) {
+        return to_string((long long)value);
+    } else if constexpr (is_pointer_v<T>) {
+        char text[32];
+        snprintf(text, sizeof(text), "%p", (const void*)value);
+        return text;
+    } else {
+        return to_string(value);
+    }
+}
+
+// Polls 'done' until it holds or 'ms' have passed, for results another thread produces
+template <typename F>
+bool WaitFor(F done, int ms = 5000) {
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(ms);
+    while (!done()) {
+        if (chrono::steady_clock::now() > deadline) return false;
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    return true;
+}
+
+int main() {
+    InitImageKernels();
+    for (const TestCase& test : TestCases()) {
+        int failures = g_TestFailures;
+        test.run();
+        printf("%s %s\n", g_TestFailures == failures ? "PASS" : "FAIL", test.name);
+    }
+    return g_TestFailures ? 1 : 0;
+}
@@ -0,0 +1,173 @@
+// Stand-ins for the Windows and GDI+ names the portable core of music.mod.cpp still
+// uses, so it builds on Linux with MUSIC_WIDGET_HEADLESS defined. Nothing here draws,
+// posts or arms anything: timers are only remembered, messages are dropped.
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cwchar>
+#include <functional>
+#include <thread>
+
+typedef uint32_t DWORD;
+typedef unsigned int UINT;
+typedef uintptr_t UINT_PTR;
+typedef uintptr_t WPARAM;
+typedef intptr_t LPARAM;
+typedef int BOOL;
+typedef unsigned char BYTE;
+typedef wchar_t WCHAR;
+typedef struct HWND__* HWND;
+typedef void* TIMERPROC;
+
+#ifndef FALSE
+#define FALSE 0
+#define TRUE 1
+#endif
+
+union LARGE_INTEGER {
+    int64_t QuadPart;
+};
+
+inline BOOL QueryPerformanceCounter(LARGE_INTEGER* counter) {
+    counter->QuadPart = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    return TRUE;
+}
+
+inline BOOL QueryPerformanceFrequency(LARGE_INTEGER* frequency) {
+    frequency->QuadPart = 1000000000;
+    return TRUE;
+}
+
+inline DWORD GetCurrentThreadId() {
+    return (DWORD)std::hash<std::thread::id>()(std::this_thread::get_id());
+}
+
+// The CRT's array overload; format strings shared with Linux use %ls for wide strings
+template <size_t N, typename... Args>
+inline int swprintf_s(wchar_t (&buffer)[N], const wchar_t* format, Args... args) {
+    return swprintf(buffer, N, format, args...);
+}
+
+inline BOOL PostMessage(HWND, UINT, WPARAM, LPARAM) {
+    return TRUE;
+}
+
+// The frame timer as SetTimer/KillTimer last left it
+struct HeadlessTimer {
+    bool armed = false;
+    UINT delay = 0;
+    int sets = 0;
+};
+inline HeadlessTimer g_HeadlessTimer;
+
+inline UINT_PTR SetTimer(HWND, UINT_PTR id, UINT delay, TIMERPROC) {
+    g_HeadlessTimer.armed = true;
+    g_HeadlessTimer.delay = delay;
+    g_HeadlessTimer.sets++;
+    return id;
+}
+
+inline BOOL KillTimer(HWND, UINT_PTR) {
+    g_HeadlessTimer.armed = false;
+    return TRUE;
+}
+
+struct RECT {
+    long left, top, right, bottom;
+};
+#define SPI_GETWORKAREA 0x0030
+#define SWP_NOSIZE      0x0001
+#define SWP_NOZORDER    0x0004
+#define SWP_NOACTIVATE  0x0010
+
+// A 1920x1080 desktop with nothing docked
+inline BOOL SystemParametersInfo(UINT action, UINT, void* param, UINT) {
+    if (action == SPI_GETWORKAREA) *(RECT*)param = { 0, 0, 1920, 1080 };
+    return TRUE;
+}
+
+inline BOOL SetWindowPos(HWND, HWND, int, int, int, int, UINT) {
+    return TRUE;
+}
+
+struct DEVMODEW {
+    DWORD dmSize;
+    DWORD dmDisplayFrequency;
+};
+#define ENUM_CURRENT_SETTINGS ((DWORD)-1)
+#define USER_TIMER_MINIMUM 0x0000000A
+
+inline BOOL EnumDisplaySettingsW(const wchar_t*, DWORD, DEVMODEW* mode) {
+    mode->dmDisplayFrequency = 60;
+    return TRUE;
+}
+
+namespace winrt {
+inline void init_apartment() {}
+inline void uninit_apartment() {}
+}
+
+// The integer rectangle the layout and scene are built from, and the colour the palette
+// is built with, both with GDI+'s semantics
+namespace Gdiplus {
+typedef uint32_t ARGB;
+
+class Color {
+public:
+    Color() {}
+    Color(ARGB argb) : m_argb(argb) {}
+    Color(BYTE r, BYTE g, BYTE b) : Color(255, r, g, b) {}
+    Color(BYTE a, BYTE r, BYTE g, BYTE b) : m_argb((ARGB)a << 24 | (ARGB)r << 16 | (ARGB)g << 8 | b) {}
+
+    BYTE GetA() const { return (BYTE)(m_argb >> 24); }
+    BYTE GetR() const { return (BYTE)(m_argb >> 16); }
+    BYTE GetG() const { return (BYTE)(m_argb >> 8); }
+    BYTE GetB() const { return (BYTE)m_argb; }
+    BYTE GetRed() const { return GetR(); }
+    BYTE GetGreen() const { return GetG(); }
+    BYTE GetBlue() const { return GetB(); }
+    ARGB GetValue() const { return m_argb; }
+
+private:
+    ARGB m_argb = 0xFF000000;
+};
+
+struct Rect {
+    int X = 0;
+    int Y = 0;
+    int Width = 0;
+    int Height = 0;
+
+    Rect() {}
+    Rect(int x, int y, int width, int height) : X(x), Y(y), Width(width), Height(height) {}
+
+    bool IsEmptyArea() const { return Width <= 0 || Height <= 0; }
+
+    BOOL IntersectsWith(const Rect& other) const {
+        return X < other.X + other.Width && Y < other.Y + other.Height &&
+               other.X < X + Width && other.Y < Y + Height;
+    }
+
+    static BOOL Intersect(Rect& out, const Rect& a, const Rect& b) {
+        int right = std::min(a.X + a.Width, b.X + b.Width);
+        int bottom = std::min(a.Y + a.Height, b.Y + b.Height);
+        int left = std::max(a.X, b.X);
+        int top = std::max(a.Y, b.Y);
+        out = Rect(left, top, right - left, bottom - top);
+        return !out.IsEmptyArea();
+    }
+
+    static BOOL Union(Rect& out, const Rect& a, const Rect& b) {
+        int right = std::max(a.X + a.Width, b.X + b.Width);
+        int bottom = std::max(a.Y + a.Height, b.Y + b.Height);
+        int left = std::min(a.X, b.X);
+        int top = std::min(a.Y, b.Y);
+        out = Rect(left, top, right - left, bottom - top);
+        return !out.IsEmptyArea();
+    }
+};
+}
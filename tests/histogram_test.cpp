@@ -0,0 +1,111 @@
+// LatencyHistogram: bucket accuracy, percentiles, clamping and concurrent recording.
+// Built with TSan where available.
+#include "../music.mod.cpp"
+#include "harness.h"
+
+// The bound the histogram promises for a percentile
+#define RELATIVE_ERROR 0.125
+
+TEST(EmptyIsZero) {
+    LatencyHistogram histogram;
+    CHECK_EQ(histogram.Count(), (uint64_t)0);
+    CHECK_EQ(histogram.Percentile(0.5), 0.0);
+    CHECK_EQ(histogram.Percentile(1.0), 0.0);
+}
+
+TEST(ExactBelowEightMicroseconds) {
+    LatencyHistogram histogram;
+    for (int micros = 0; micros < 8; micros++) {
+        histogram.Reset();
+        histogram.Record(micros / 1000.0);
+        CHECK_NEAR(histogram.Percentile(0.5) * 1000.0, micros + 0.5, 1e-9);
+    }
+}
+
+TEST(EveryValueWithinTheBound) {
+    LatencyHistogram histogram;
+    double last = 0.0;
+    // Every microsecond up to 100 ms, then log-spaced up to five minutes
+    for (double micros = 8.0; micros < 300e6; micros = micros < 100000.0 ? micros + 1.0 : micros * 1.01) {
+        histogram.Reset();
+        histogram.Record(micros / 1000.0);
+        double reported = histogram.Percentile(0.5) * 1000.0;
+        if (fabs(reported - micros) > micros * RELATIVE_ERROR) {
+            fprintf(stderr, "  %.0f us reported as %.1f us\n", micros, reported);
+            CHECK(false);
+            break;
+        }
+        // Bigger values never land in a lower bucket
+        CHECK(reported >= last);
+        last = reported;
+    }
+}
+
+TEST(Percentiles) {
+    LatencyHistogram histogram;
+    for (int ms = 1; ms <= 1000; ms++) histogram.Record(ms);
+    CHECK_EQ(histogram.Count(), (uint64_t)1000);
+    CHECK_NEAR(histogram.Percentile(0.5), 500.0, 500.0 * RELATIVE_ERROR);
+    CHECK_NEAR(histogram.Percentile(0.9), 900.0, 900.0 * RELATIVE_ERROR);
+    CHECK_NEAR(histogram.Percentile(0.99), 990.0, 990.0 * RELATIVE_ERROR);
+    CHECK_NEAR(histogram.Percentile(1.0), 1000.0, 1000.0 * RELATIVE_ERROR);
+    CHECK_NEAR(histogram.Percentile(0.0), 1.0, 1.0 * RELATIVE_ERROR);
+    double last = 0.0;
+    for (double q = 0.0; q <= 1.0; q += 0.01) {
+        CHECK(histogram.Percentile(q) >= last);
+        last = histogram.Percentile(q);
+    }
+}
+
+// A few slow outliers show in the tail without moving the median
+TEST(TailOutliers) {
+    LatencyHistogram histogram;
+    for (int i = 0; i < 990; i++) histogram.Record(2.0);
+    for (int i = 0; i < 10; i++) histogram.Record(250.0);
+    CHECK_NEAR(histogram.Percentile(0.5), 2.0, 2.0 * RELATIVE_ERROR);
+    CHECK_NEAR(histogram.Percentile(0.99), 2.0, 2.0 * RELATIVE_ERROR);
+    CHECK_NEAR(histogram.Percentile(0.999), 250.0, 250.0 * RELATIVE_ERROR);
+}
+
+TEST(OutOfRangeIsClamped) {
+    LatencyHistogram histogram;
+    histogram.Record(-5.0);
+    CHECK_NEAR(histogram.Percentile(1.0), 0.0005, 1e-12);
+    histogram.Reset();
+    histogram.Record(1e12);
+    CHECK_EQ(histogram.Count(), (uint64_t)1);
+    // The top bucket ends at 2^30 us, about nine minutes
+    double top = (double)(1ull << 30) / 1000.0;
+    CHECK(histogram.Percentile(1.0) <= top);
+    CHECK(histogram.Percentile(1.0) >= top * (1.0 - RELATIVE_ERROR));
+}
+
+TEST(ResetEmpties) {
+    LatencyHistogram histogram;
+    for (int i = 0; i < 100; i++) histogram.Record(i);
+    histogram.Reset();
+    CHECK_EQ(histogram.Count(), (uint64_t)0);
+    CHECK_EQ(histogram.Percentile(0.5), 0.0);
+}
+
+// Recorded from the worker while the UI thread reads it for the HUD
+TEST(ConcurrentRecording) {
+    LatencyHistogram histogram;
+    atomic<bool> done{false};
+    thread reader([&] {
+        while (!done) {
+            double p = histogram.Percentile(0.99);
+            CHECK(p >= 0.0 && p < 100.0);
+        }
+    });
+    vector<thread> writers;
+    for (int t = 0; t < 4; t++) {
+        writers.emplace_back([&, t] {
+            for (int i = 0; i < 50000; i++) histogram.Record((t + 1) * 0.25 + (i % 100) * 0.01);
+        });
+    }
+    for (thread& writer : writers) writer.join();
+    done = true;
+    reader.join();
+    CHECK_EQ(histogram.Count(), (uint64_t)200000);
+}
@@ -0,0 +1,240 @@
+// Every SIMD level this CPU runs must produce the scalar reference's output bit for bit,
+// including the tails shorter than a vector and the edge values of each channel.
+#include "../music.mod.cpp"
+#include "harness.h"
+
+#include <random>
+
+static const size_t g_Lengths[] = { 0, 1, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 67, 1000 };
+
+static vector<uint32_t> RandomPixels(size_t count, uint32_t seed) {
+    mt19937 random(seed);
+    vector<uint32_t> pixels(count);
+    for (uint32_t& p : pixels) {
+        p = random();
+        // Plenty of the alphas that take special paths
+        switch (random() % 4) {
+        case 0: p |= 0xFF000000u; break;
+        case 1: p &= 0x00FFFFFFu; break;
+        default: break;
+        }
+    }
+    return pixels;
+}
+
+// Clamps each channel to the alpha, as in any premultiplied image
+static vector<uint32_t> RandomPremultiplied(size_t count, uint32_t seed) {
+    vector<uint32_t> pixels = RandomPixels(count, seed);
+    PremultiplyScalar(pixels.data(), pixels.size());
+    return pixels;
+}
+
+// Runs 'check' for each SIMD level above scalar that this CPU supports
+template <typename F>
+static void ForEachVectorLevel(F check) {
+    for (int level = SIMD_SCALAR + 1; level <= DetectSimdLevel(); level++) check(g_KernelTable[level]);
+}
+
+TEST(LevelsUnderTest) {
+    printf("  levels: ");
+    for (int level = SIMD_SCALAR; level <= DetectSimdLevel(); level++) printf("%ls ", g_KernelTable[level].name);
+    printf("\n");
+}
+
+TEST(ReferenceRounding) {
+    // Premultiply floors, blending and masking round to nearest
+    uint32_t p = 0x80FF4001;
+    PremultiplyScalar(&p, 1);
+    CHECK_EQ(p, (uint32_t)0x80802000);
+    CHECK_EQ(BlendOverPixel(0xFF123456, 0xFFABCDEF), (uint32_t)0xFF123456);
+    CHECK_EQ(BlendOverPixel(0x00000000, 0xFFABCDEF), (uint32_t)0xFFABCDEF);
+    CHECK_EQ(BlendOverPixel(0x80000000, 0xFFFFFFFF), (uint32_t)0xFF7F7F7F);
+    uint32_t masked = 0xFFFFFFFF;
+    uint8_t half = 128;
+    ApplyMaskScalar(&masked, &half, 1);
+    CHECK_EQ(masked, (uint32_t)0x80808080);
+}
+
+TEST(PremultiplyEveryAlphaAndChannel) {
+    // Every (alpha, value) pair, with the value in each channel
+    vector<uint32_t> straight;
+    for (uint32_t a = 0; a < 256; a++) {
+        for (uint32_t c = 0; c < 256; c++) straight.push_back(a << 24 | c << 16 | (255 - c) << 8 | c);
+    }
+    vector<uint32_t> expected = straight;
+    PremultiplyScalar(expected.data(), expected.size());
+    ForEachVectorLevel([&](const ImageKernels& kernels) {
+        vector<uint32_t> out = straight;
+        kernels.premultiply(out.data(), out.size());
+        CHECK(out == expected);
+        for (size_t length : g_Lengths) {
+            vector<uint32_t> pixels = RandomPixels(length, (uint32_t)length);
+            vector<uint32_t> reference = pixels;
+            PremultiplyScalar(reference.data(), length);
+            kernels.premultiply(pixels.data(), length);
+            CHECK(pixels == reference);
+        }
+    });
+}
+
+TEST(UnpremultiplyEveryValidPixel) {
+    vector<uint32_t> premultiplied;
+    for (uint32_t a = 0; a < 256; a++) {
+        for (uint32_t c = 0; c <= a; c++) premultiplied.push_back(a << 24 | c << 16 | (a - c) << 8 | c / 2);
+    }
+    vector<uint32_t> expected = premultiplied;
+    UnpremultiplyScalar(expected.data(), expected.size());
+    ForEachVectorLevel([&](const ImageKernels& kernels) {
+        vector<uint32_t> out = premultiplied;
+        kernels.unpremultiply(out.data(), out.size());
+        CHECK(out == expected);
+        for (size_t length : g_Lengths) {
+            vector<uint32_t> pixels = RandomPremultiplied(length, (uint32_t)length + 100);
+            vector<uint32_t> reference = pixels;
+            UnpremultiplyScalar(reference.data(), length);
+            kernels.unpremultiply(pixels.data(), length);
+            CHECK(pixels == reference);
+        }
+    });
+}
+
+TEST(BlendOver) {
+    ForEachVectorLevel([&](const ImageKernels& kernels) {
+        for (size_t length : g_Lengths) {
+            vector<uint32_t> src = RandomPremultiplied(length, (uint32_t)length + 200);
+            vector<uint32_t> dst = RandomPremultiplied(length, (uint32_t)length + 300);
+            vector<uint32_t> reference = dst;
+            BlendOverScalar(reference.data(), src.data(), length);
+            kernels.blendOver(dst.data(), src.data(), length);
+            CHECK(dst == reference);
+        }
+        // Every source alpha over every destination value
+        vector<uint32_t> src, dst;
+        for (uint32_t a = 0; a < 256; a++) {
+            for (uint32_t c = 0; c < 256; c++) {
+                src.push_back(a << 24 | (a / 2) << 16 | (a / 3) << 8 | a);
+                dst.push_back(c * 0x01010101u);
+            }
+        }
+        vector<uint32_t> reference = dst;
+        BlendOverScalar(reference.data(), src.data(), src.size());
+        kernels.blendOver(dst.data(), src.data(), src.size());
+        CHECK(dst == reference);
+    });
+}
+
+TEST(ApplyMaskEveryCoverage) {
+    vector<uint32_t> pixels;
+    vector<uint8_t> mask;
+    for (uint32_t m = 0; m < 256; m++) {
+        for (uint32_t c = 0; c < 256; c++) {
+            pixels.push_back(0xFF000000u | c << 16 | (255 - c) << 8 | c);
+            mask.push_back((uint8_t)m);
+        }
+    }
+    vector<uint32_t> expected = pixels;
+    ApplyMaskScalar(expected.data(), mask.data(), expected.size());
+    ForEachVectorLevel([&](const ImageKernels& kernels) {
+        vector<uint32_t> out = pixels;
+        kernels.applyMask(out.data(), mask.data(), out.size());
+        CHECK(out == expected);
+        for (size_t length : g_Lengths) {
+            vector<uint32_t> tail = RandomPremultiplied(length, (uint32_t)length + 400);
+            vector<uint8_t> coverage(length);
+            for (size_t i = 0; i < length; i++) coverage[i] = (uint8_t)(i * 37);
+            vector<uint32_t> reference = tail;
+            ApplyMaskScalar(reference.data(), coverage.data(), length);
+            kernels.applyMask(tail.data(), coverage.data(), length);
+            CHECK(tail == reference);
+        }
+    });
+}
+
+TEST(Resample) {
+    struct Size {
+        int srcW, srcH, dstW, dstH;
+    };
+    const Size sizes[] = {
+        { 37, 23, 11, 7 }, { 640, 640, 36, 36 }, { 300, 300, 88, 88 }, { 5, 5, 13, 13 },
+        { 16, 16, 16, 16 }, { 1, 40, 1, 9 }, { 40, 1, 9, 1 }, { 33, 17, 17, 33 },
+    };
+    ForEachVectorLevel([&](const ImageKernels& kernels) {
+        for (const Size& size : sizes) {
+            ArtImage src;
+            src.width = size.srcW;
+            src.height = size.srcH;
+            src.pixels = RandomPremultiplied((size_t)size.srcW * size.srcH, (uint32_t)size.srcW * 31 + size.srcH);
+            ArtImage expected = ResampleArt(src, size.dstW, size.dstH, g_KernelTable[SIMD_SCALAR]);
+            ArtImage out = ResampleArt(src, size.dstW, size.dstH, kernels);
+            if (out.pixels != expected.pixels) {
+                fprintf(stderr, "  %ls %dx%d to %dx%d\n", kernels.name, size.srcW, size.srcH, size.dstW, size.dstH);
+                CHECK(false);
+            }
+        }
+    });
+}
+
+TEST(BoxBlurColumns) {
+    const int widths[] = { 1, 3, 4, 7, 8, 9, 16, 17, 33 };
+    const int heights[] = { 1, 2, 5, 40, 130 };
+    const int radii[] = { 1, 2, 7, 64, 127 };
+    ForEachVectorLevel([&](const ImageKernels& kernels) {
+        for (int width : widths) {
+            for (int height : heights) {
+                vector<uint32_t> src = RandomPremultiplied((size_t)width * height, (uint32_t)(width * 1000 + height));
+                for (int radius : radii) {
+                    vector<uint32_t> expected(src.size()), out(src.size());
+                    BoxBlurColumnsScalar(src.data(), expected.data(), width, height, radius);
+                    kernels.boxBlurColumns(src.data(), out.data(), width, height, radius);
+                    if (out != expected) {
+                        fprintf(stderr, "  %ls %dx%d radius %d\n", kernels.name, width, height, radius);
+                        CHECK(false);
+                    }
+                }
+            }
+        }
+    });
+    // Flat areas come out exactly as they went in
+    vector<uint32_t> flat(16 * 50, 0xFF336699), out(flat.size());
+    BoxBlurColumnsScalar(flat.data(), out.data(), 16, 50, 20);
+    CHECK(out == flat);
+}
+
+// Interleaved histograms may split a bin differently per level; the totals must match
+static vector<uint32_t> FoldBins(const vector<uint32_t>& bins) {
+    vector<uint32_t> folded(PALETTE_BINS + 1);
+    for (int bin = 0; bin <= PALETTE_BINS; bin++) {
+        for (int k = 0; k < 4; k++) folded[bin] += bins[(size_t)(PALETTE_BINS + 1) * k + bin];
+    }
+    return folded;
+}
+
+TEST(CountPaletteBins) {
+    ForEachVectorLevel([&](const ImageKernels& kernels) {
+        for (size_t length : g_Lengths) {
+            vector<uint32_t> pixels = RandomPixels(length, (uint32_t)length + 500);
+            vector<uint32_t> expected((size_t)(PALETTE_BINS + 1) * 4), out(expected.size());
+            CountPaletteBinsScalar(pixels.data(), (int)length, expected.data());
+            kernels.countPaletteBins(pixels.data(), (int)length, out.data());
+            CHECK(FoldBins(out) == FoldBins(expected));
+        }
+    });
+}
+
+// The whole backdrop pipeline, which chains resample, blur, blend and mask
+TEST(BlurBackdrop) {
+    ArtImage cover;
+    cover.width = 300;
+    cover.height = 300;
+    cover.pixels = RandomPremultiplied(300 * 300, 7);
+    for (bool light : { false, true }) {
+        BackdropSpec spec;
+        spec.width = 400;
+        spec.height = 100;
+        spec.light = light;
+        ArtImage expected = BlurBackdrop(cover, spec, g_KernelTable[SIMD_SCALAR]);
+        ForEachVectorLevel([&](const ImageKernels& kernels) {
+            CHECK(BlurBackdrop(cover, spec, kernels).pixels == expected.pixels);
+        });
+    }
+}
@@ -0,0 +1,153 @@
+// Drawing and hit-testing agree: each part of the panel a handler hit-tests is painted
+// with the software renderer, alone, and every pixel it covers must hit that part.
+#include "../music.mod.cpp"
+#include "harness.h"
+
+struct PanelCase {
+    int width;
+    int height;
+    int fontSize;
+    bool timeline;
+};
+
+static vector<PanelCase> PanelCases() {
+    vector<PanelCase> cases;
+    for (int width : { 240, 400, 640 }) {
+        for (int height : { 32, 48, 100 }) {
+            for (int fontSize : { 10, 14, 22 }) {
+                for (bool timeline : { false, true }) cases.push_back({ width, height, fontSize, timeline });
+            }
+        }
+    }
+    return cases;
+}
+
+static string CaseName(const PanelCase& c) {
+    return to_string(c.width) + "x" + to_string(c.height) + " font " + to_string(c.fontSize) +
+           (c.timeline ? " timeline" : "");
+}
+
+// Renders 'draw' onto a cleared panel and returns every pixel it touched
+template <typename F>
+static vector<pair<int, int>> Painted(const PanelCase& c, F draw) {
+    vector<uint32_t> pixels((size_t)c.width * c.height, 0);
+    SoftwareRenderer renderer(pixels.data(), c.width, c.height, c.width);
+    draw(renderer);
+    vector<pair<int, int>> painted;
+    for (int y = 0; y < c.height; y++) {
+        for (int x = 0; x < c.width; x++) {
+            if (pixels[(size_t)y * c.width + x] >> 24) painted.push_back({ x, y });
+        }
+    }
+    return painted;
+}
+
+static PanelLayout LayoutFor(const PanelCase& c) {
+    g_Settings.fontSize = c.fontSize;
+    g_Settings.perfHud = false;
+    PanelLayout layout;
+    layout.Update(c.width, c.height, 0.0f, c.timeline);
+    return layout;
+}
+
+static ThemePalette OpaquePalette() {
+    ThemePalette palette;
+    palette.note = palette.barBg = palette.barFg = palette.barBorder = 0xFFFFFFFF;
+    palette.thumb = palette.thumbBorder = 0xFFFFFFFF;
+    return palette;
+}
+
+TEST(ControlsHitWhereTheyAreDrawn) {
+    for (const PanelCase& c : PanelCases()) {
+        PanelLayout layout = LayoutFor(c);
+        for (int hit = HIT_PREV; hit <= HIT_NEXT; hit++) {
+            for (int variant = 0; variant < 4; variant++) {
+                bool hovered = variant & 1, playing = variant & 2;
+                auto painted = Painted(c, [&](Renderer& r) {
+                    DrawControl(r, layout.geometry, hit, playing, hovered, 0xFFFFFFFF, 0xFF808080);
+                });
+                CHECK(!painted.empty());
+                int misses = 0;
+                for (auto& p : painted) misses += layout.HitTest(p.first, p.second) != hit;
+                if (misses) fprintf(stderr, "  %s: control %d variant %d\n", CaseName(c).c_str(), hit, variant);
+                CHECK_EQ(misses, 0);
+            }
+        }
+    }
+}
+
+TEST(SeparatorHitsTheTab) {
+    ThemePalette palette = OpaquePalette();
+    for (const PanelCase& c : PanelCases()) {
+        PanelLayout layout = LayoutFor(c);
+        auto painted = Painted(c, [&](Renderer& r) {
+            DrawSeparator(r, layout.geometry, c.height, 1.0f, true, palette);
+        });
+        CHECK(!painted.empty());
+        int misses = 0;
+        for (auto& p : painted) misses += layout.HitTest(p.first, p.second) != HIT_TAB;
+        if (misses) fprintf(stderr, "  %s\n", CaseName(c).c_str());
+        CHECK_EQ(misses, 0);
+    }
+}
+
+TEST(TimelineHitsWhereItIsDrawn) {
+    ThemePalette palette = OpaquePalette();
+    for (const PanelCase& c : PanelCases()) {
+        if (!c.timeline) continue;
+        PanelLayout layout = LayoutFor(c);
+        const PanelGeometry& g = layout.geometry;
+        for (float progress : { 0.0f, 0.37f, 1.0f }) {
+            int progressWidth = (int)(g.barW * progress);
+            for (bool active : { false, true }) {
+                auto painted = Painted(c, [&](Renderer& r) { DrawTimelineBar(r, g, progressWidth, active, palette); });
+                CHECK(!painted.empty());
+                // The thumb overhangs the bar's ends; grabbing it counts as hitting it
+                int misses = 0;
+                for (auto& p : painted) {
+                    bool hit = layout.HitTest(p.first, p.second) == HIT_TIMELINE ||
+                               (active && layout.ThumbHit(progress, p.first, p.second));
+                    misses += !hit;
+                }
+                if (misses) fprintf(stderr, "  %s: progress %.2f%s\n", CaseName(c).c_str(), progress, active ? " active" : "");
+                CHECK_EQ(misses, 0);
+            }
+        }
+    }
+}
+
+// The fraction a click maps to is where the progress would then be drawn up to
+TEST(TimelineFractionMatchesProgress) {
+    PanelCase c = { 400, 48, 14, true };
+    PanelLayout layout = LayoutFor(c);
+    const PanelGeometry& g = layout.geometry;
+    for (int x = g.barX; x <= g.barX + g.barW; x++) {
+        float fraction = layout.TimelineFraction(x);
+        CHECK(abs((int)(g.barW * fraction + 0.5f) - (x - g.barX)) <= 1);
+    }
+    CHECK_EQ(layout.TimelineFraction(g.barX - 20), 0.0f);
+    CHECK_EQ(layout.TimelineFraction(g.barX + g.barW + 20), 1.0f);
+}
+
+TEST(NoTimelineNoTimelineHits) {
+    for (const PanelCase& c : PanelCases()) {
+        if (c.timeline) continue;
+        PanelLayout layout = LayoutFor(c);
+        for (int y = 0; y < c.height; y++) {
+            for (int x = 0; x < c.width; x++) CHECK(layout.HitTest(x, y) != HIT_TIMELINE);
+        }
+        CHECK(!layout.ThumbHit(0.5f, layout.geometry.barX, layout.geometry.barY));
+    }
+}
+
+TEST(RelayoutOnlyWhenAnInputChanges) {
+    g_Settings.fontSize = 14;
+    g_Settings.perfHud = false;
+    PanelLayout layout;
+    CHECK(layout.Update(400, 48, 18.0f, true));
+    CHECK(!layout.Update(400, 48, 18.0f, true));
+    CHECK(layout.Update(400, 48, 18.0f, false));
+    g_Settings.fontSize = 16;
+    CHECK(layout.Update(400, 48, 18.0f, false));
+    g_Settings.fontSize = 14;
+}
@@ -0,0 +1,207 @@
+// The media worker's update logic against a scripted source: which session is shown,
+// what gets re-read for each kind of event, and the source's lifetime.
+#include "../music.mod.cpp"
+#include "harness.h"
+#include "worker_fixture.h"
+
+TEST(PublishesCurrentSession) {
+    WorkerFixture f;
+    f.source->AddSession(L"Spotify.exe", L"Song A", L"Artist A");
+    f.source->SetTimeline(L"Spotify.exe", 12.0, 200.0, 0.0);
+    f.Start();
+    const MediaSnapshot& state = f.WaitForSnapshot([](const MediaSnapshot& s) { return s.title == L"Song A"; });
+    CHECK_EQ(state.artist, wstring(L"Artist A"));
+    CHECK_EQ(state.sessionId, wstring(L"Spotify.exe"));
+    CHECK(state.hasMedia);
+    CHECK(state.isSpotify);
+    CHECK_EQ(state.duration, 200.0);
+}
+
+TEST(NoSessionPublishesNoMedia) {
+    WorkerFixture f;
+    f.Start();
+    const MediaSnapshot& state = f.WaitForSnapshot([](const MediaSnapshot& s) { return s.version > 0; });
+    CHECK(!state.hasMedia);
+    CHECK_EQ(state.title, wstring(L"No Media"));
+}
+
+TEST(EventRereadsOnlyItsSession) {
+    WorkerFixture f;
+    f.source->AddSession(L"Spotify.exe", L"Song A");
+    f.source->AddSession(L"msedge.exe", L"Video B");
+    f.Start();
+    f.WaitForSnapshot([](const MediaSnapshot& s) { return s.title == L"Song A"; });
+    f.Drain();
+
+    int reads = f.source->reads;
+    uint64_t version = f.snapshots.Acquire().version;
+    f.source->SetTrack(L"msedge.exe", L"Video C", L"");
+    f.Drain();
+    CHECK_EQ(f.source->reads - reads, 1);
+    // Not the session on screen, so nothing new is published
+    CHECK_EQ(f.snapshots.Acquire().version, version);
+}
+
+TEST(BurstOfEventsIsOneRead) {
+    WorkerFixture f;
+    f.source->AddSession(L"Spotify.exe", L"Song A");
+    f.Start();
+    f.WaitForSnapshot([](const MediaSnapshot& s) { return s.title == L"Song A"; });
+    f.Drain();
+
+    // Hold the worker while the events pile up
+    atomic<bool> holding{false}, release{false};
+    f.worker.Post([&](MediaSource&) {
+        holding = true;
+        while (!release) this_thread::yield();
+    });
+    CHECK(WaitFor([&] { return holding.load(); }));
+    int reads = f.source->reads;
+    for (int i = 0; i < 200; i++) {
+        f.source->Fire(L"Spotify.exe", MEDIA_CHANGE_TIMELINE);
+        f.source->Fire(L"Spotify.exe", MEDIA_CHANGE_PLAYBACK);
+    }
+    f.source->SetTrack(L"Spotify.exe", L"Song B", L"");
+    release = true;
+    f.Drain();
+    CHECK_EQ(f.source->reads - reads, 1);
+    CHECK_EQ(f.snapshots.Acquire().title, wstring(L"Song B"));
+}
+
+TEST(FollowsTheCurrentSession) {
+    WorkerFixture f;
+    f.source->AddSession(L"Spotify.exe", L"Song A");
+    f.source->AddSession(L"msedge.exe", L"Video B");
+    f.Start();
+    f.WaitForSnapshot([](const MediaSnapshot& s) { return s.title == L"Song A"; });
+
+    f.source->SetCurrent(L"msedge.exe");
+    const MediaSnapshot& state = f.WaitForSnapshot([](const MediaSnapshot& s) { return s.sessionId == L"msedge.exe"; });
+    CHECK_EQ(state.title, wstring(L"Video B"));
+    CHECK(!state.isSpotify);
+
+    // Closing the current session falls back to one that is still open
+    f.source->RemoveSession(L"msedge.exe");
+    const MediaSnapshot& fallback = f.WaitForSnapshot([](const MediaSnapshot& s) { return s.sessionId == L"Spotify.exe"; });
+    CHECK_EQ(fallback.title, wstring(L"Song A"));
+}
+
+TEST(CoverIsDecodedOncePerTrack) {
+    WorkerFixture f;
+    f.source->AddSession(L"Spotify.exe", L"Song A", L"", EncodeTestCover(64, 64, 0xFFFF0000));
+    f.Start();
+    const MediaSnapshot& state = f.WaitForSnapshot([](const MediaSnapshot& s) { return s.albumArt != nullptr; });
+    CHECK_EQ(state.albumArt->width, TEST_ART_SIZE);
+    CHECK_EQ(state.albumArt->height, TEST_ART_SIZE);
+    CHECK_EQ(state.artPalette.dominant & 0xFFF0F0F0u, 0xFFF00000u);
+
+    f.source->SetTrack(L"Spotify.exe", L"Song B", L"", EncodeTestCover(64, 64, 0xFF0000FF));
+    f.WaitForSnapshot([](const MediaSnapshot& s) { return s.title == L"Song B" && s.albumArt; });
+    int thumbnails = f.source->thumbnailReads;
+
+    // Back to the first track: its cover comes from the cache without reading the thumbnail
+    f.source->SetTrack(L"Spotify.exe", L"Song A", L"", EncodeTestCover(64, 64, 0xFFFF0000));
+    const MediaSnapshot& replay = f.WaitForSnapshot([](const MediaSnapshot& s) { return s.title == L"Song A" && s.albumArt; });
+    CHECK_EQ(f.source->thumbnailReads.load(), thumbnails);
+    CHECK_EQ(replay.artPalette.dominant & 0xFFF0F0F0u, 0xFFF00000u);
+}
+
+// The scene keys the cover on its generation: every new image gets a new one, even one
+// allocated where a freed cover was
+TEST(ArtGenerationFollowsTheCover) {
+    WorkerFixture f;
+    f.source->AddSession(L"Spotify.exe", L"Song A", L"", EncodeTestCover(32, 32, 0xFFFF0000));
+    f.Start();
+    const MediaSnapshot& first = f.WaitForSnapshot([](const MediaSnapshot& s) { return s.albumArt != nullptr; });
+    uint64_t generation = first.artGeneration;
+    CHECK(generation != 0);
+
+    f.source->SetPlaying(L"Spotify.exe", false);
+    f.WaitForSnapshot([](const MediaSnapshot& s) { return !s.isPlaying; });
+    CHECK_EQ(f.snapshots.Current().artGeneration, generation);
+
+    f.worker.SetArtSize(TEST_ART_SIZE * 2);
+    const MediaSnapshot& resized = f.WaitForSnapshot([](const MediaSnapshot& s) { return s.albumArt->width == TEST_ART_SIZE * 2; });
+    CHECK(resized.artGeneration > generation);
+    generation = resized.artGeneration;
+
+    f.source->SetTrack(L"Spotify.exe", L"Song B", L"", EncodeTestCover(32, 32, 0xFF0000FF));
+    const MediaSnapshot& next = f.WaitForSnapshot([](const MediaSnapshot& s) { return s.title == L"Song B"; });
+    CHECK(next.artGeneration > generation);
+}
+
+TEST(MissingCoverIsRetriedOnlyOnPropertyChanges) {
+    WorkerFixture f;
+    f.source->AddSession(L"Spotify.exe", L"Song");
+    f.source->AddSession(L"msedge.exe", L"Video");
+    f.Start();
+    f.WaitForSnapshot([](const MediaSnapshot& s) { return s.title == L"Song"; });
+    f.Drain();
+    int thumbnails = f.source->thumbnailReads;
+
+    // Playback and timeline events leave the missing cover alone
+    for (int i = 0; i < 10; i++) {
+        f.source->SetPlaying(L"Spotify.exe", i % 2 == 0);
+        f.source->SetTimeline(L"Spotify.exe", i, 180.0, i * 1000.0);
+    }
+    f.Drain();
+    CHECK_EQ(f.source->thumbnailReads.load(), thumbnails);
+
+    // The player sets the cover after the title: the next properties event picks it up
+    f.source->SetTrack(L"Spotify.exe", L"Song", L"", EncodeTestCover(32, 32, 0xFF00FF00));
+    const MediaSnapshot& state = f.WaitForSnapshot([](const MediaSnapshot& s) { return s.albumArt != nullptr; });
+    CHECK_EQ(state.title, wstring(L"Song"));
+    CHECK_EQ(f.source->thumbnailReads.load(), thumbnails + 1);
+
+    // Switching to a session still without a cover looks once more, without a read
+    int reads = f.source->reads;
+    f.source->SetCurrent(L"msedge.exe");
+    f.WaitForSnapshot([](const MediaSnapshot& s) { return s.sessionId == L"msedge.exe"; });
+    f.Drain();
+    CHECK_EQ(f.source->thumbnailReads.load(), thumbnails + 2);
+    CHECK_EQ(f.source->reads.load(), reads);
+}
+
+TEST(SourceThatFailsToStartIsRetried) {
+    WorkerFixture f;
+    f.source->startable = false;
+    f.source->AddSession(L"Spotify.exe", L"Song A");
+    f.Start();
+    CHECK(WaitFor([&] { return f.source->starts >= 1; }));
+    f.source->startable = true;
+    const MediaSnapshot& state = f.WaitForSnapshot([](const MediaSnapshot& s) { return s.title == L"Song A"; });
+    CHECK_EQ(state.sessionId, wstring(L"Spotify.exe"));
+    CHECK(f.source->starts >= 2);
+}
+
+TEST(StopReleasesTheSource) {
+    weak_ptr<ScriptedMediaSource> weak;
+    shared_ptr<ScriptedMediaSource> events;
+    {
+        TripleBuffer<MediaSnapshot> snapshots;
+        MediaWorker worker(snapshots);
+        worker.Start(nullptr, 0, 0, TEST_ART_SIZE, 32u << 20, [&]() -> shared_ptr<MediaSource> {
+            auto source = make_shared<ScriptedMediaSource>();
+            source->AddSession(L"Spotify.exe", L"Song A");
+            weak = source;
+            events = source;  // What a handler running on another thread would hold
+            return source;
+        });
+        CHECK(WaitFor([&] { return snapshots.Acquire().title == L"Song A"; }));
+
+        // Events keep arriving while the worker stops; once stopped the source no longer
+        // calls into it
+        atomic<bool> done{false};
+        thread player([&] {
+            while (!done) events->Fire(L"Spotify.exe", MEDIA_CHANGE_TIMELINE);
+        });
+        this_thread::sleep_for(chrono::milliseconds(20));
+        worker.Stop();
+        done = true;
+        player.join();
+        CHECK_EQ(events->stops.load(), 1);
+    }
+    CHECK(!weak.expired());
+    events.reset();
+    CHECK(weak.expired());
+}
@@ -0,0 +1,182 @@
+// The whole panel, drawn through the same UpdateScene/DrawMediaPanel path WM_PAINT takes
+// with the software renderer and canned glyphs, against the reference images in golden/.
+// After a change meant to alter the look, run with MUSIC_WIDGET_UPDATE_GOLDEN=1 to
+// rewrite them, check the result and commit the new images with the change.
+#include "../music.mod.cpp"
+#include "harness.h"
+#include "canned_glyphs.h"
+
+#include <cstdlib>
+
+#define GOLDEN_TOLERANCE    4    // Channel difference still counted as the same pixel
+#define GOLDEN_MISMATCH_PCT 0.1  // Share of differing pixels allowed before failing
+
+// PAM with the pixels as drawn: premultiplied, in RGB_ALPHA order
+static bool WritePam(const string& path, const vector<uint32_t>& pixels, int width, int height) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) return false;
+    fprintf(file, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n", width, height);
+    vector<uint8_t> bytes(pixels.size() * 4);
+    for (size_t i = 0; i < pixels.size(); i++) {
+        bytes[i * 4] = (uint8_t)(pixels[i] >> 16);
+        bytes[i * 4 + 1] = (uint8_t)(pixels[i] >> 8);
+        bytes[i * 4 + 2] = (uint8_t)pixels[i];
+        bytes[i * 4 + 3] = (uint8_t)(pixels[i] >> 24);
+    }
+    bool ok = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    return fclose(file) == 0 && ok;
+}
+
+// Reads only what WritePam writes
+static bool ReadPam(const string& path, vector<uint32_t>& pixels, int& width, int& height) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) return false;
+    int depth = 0, maxval = 0;
+    bool ok = fscanf(file, "P7 WIDTH %d HEIGHT %d DEPTH %d MAXVAL %d TUPLTYPE RGB_ALPHA ENDHDR", &width, &height,
+                     &depth, &maxval) == 4 && depth == 4 && maxval == 255 && fgetc(file) == '\n' &&
+              width > 0 && height > 0;
+    if (ok) {
+        vector<uint8_t> bytes((size_t)width * height * 4);
+        ok = fread(bytes.data(), 1, bytes.size(), file) == bytes.size();
+        pixels.resize((size_t)width * height);
+        for (size_t i = 0; ok && i < pixels.size(); i++) {
+            pixels[i] = (uint32_t)bytes[i * 4 + 3] << 24 | (uint32_t)bytes[i * 4] << 16 |
+                        (uint32_t)bytes[i * 4 + 1] << 8 | bytes[i * 4 + 2];
+        }
+    }
+    fclose(file);
+    return ok;
+}
+
+// Diagonal colour ramp, so resampling the cover shows up in the image
+static ArtImage RampCover(int size) {
+    ArtImage cover;
+    cover.width = cover.height = size;
+    cover.pixels.resize((size_t)size * size);
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            cover.pixels[(size_t)y * size + x] = 0xFF000000u | (uint32_t)(x * 255 / size) << 16 |
+                                                 (uint32_t)(y * 255 / size) << 8 | 0x60;
+        }
+    }
+    return cover;
+}
+
+// A panel that has never been shown, at the default size and theme, on a paused Spotify
+// track 80 seconds into 4 minutes
+struct GoldenPanel {
+    VirtualClock clock;
+    CannedGlyphProvider glyphs;
+    MediaSnapshot state;
+    int width = g_Settings.width;
+    int height = g_Settings.height;
+    vector<uint32_t> pixels;
+
+    GoldenPanel() {
+        clock.now = 10000.0;
+        g_Frames.SetClock(&clock);
+        g_Glyphs = &glyphs;
+        g_Settings.scrubSeekMs = 0;
+        g_LightMode = false;
+        BuildPalette();
+
+        state.version = 1;
+        state.title = L"Golden Frame";
+        state.artist = L"Reference";
+        state.hasMedia = true;
+        state.isSpotify = true;
+        state.sessionId = L"Spotify.exe";
+        state.position = 80.0;
+        state.duration = 240.0;
+        state.positionStamp = clock.now;
+        // Laid out once to learn the cover size, as the worker would
+        UpdateScene(state, width, height);
+        int artSize = g_Layout.geometry.artSize;
+        state.albumArt = make_shared<ArtImage>(ResampleArt(RampCover(64), artSize, artSize));
+        state.artGeneration = 1;
+    }
+
+    ~GoldenPanel() {
+        g_Glyphs = nullptr;
+        g_Frames.SetClock(nullptr);
+    }
+
+    // What WM_PAINT does after a full invalidation
+    void Paint() {
+        UpdateScene(state, width, height);
+        g_Scene.InvalidateAll();
+        pixels.assign((size_t)width * height, 0);
+        SoftwareRenderer renderer(pixels.data(), width, height, width);
+        DrawMediaPanel(renderer, state, width, height);
+    }
+
+    void CheckGolden(const char* name) {
+        string path = string(GOLDEN_DIR) + "/" + name + ".pam";
+        const char* update = getenv("MUSIC_WIDGET_UPDATE_GOLDEN");
+        if (update && *update && strcmp(update, "0") != 0) {
+            CHECK(WritePam(path, pixels, width, height));
+            return;
+        }
+        vector<uint32_t> expected;
+        int expectedWidth = 0, expectedHeight = 0;
+        if (!ReadPam(path, expected, expectedWidth, expectedHeight)) {
+            fprintf(stderr, "  %s: no reference image, run with MUSIC_WIDGET_UPDATE_GOLDEN=1\n", path.c_str());
+            CHECK(false);
+            return;
+        }
+        CHECK_EQ(expectedWidth, width);
+        CHECK_EQ(expectedHeight, height);
+        if (expected.size() != pixels.size()) return;
+
+        int maxDiff = 0;
+        size_t mismatched = 0;
+        for (size_t i = 0; i < pixels.size(); i++) {
+            int pixelDiff = 0;
+            for (int shift = 0; shift < 32; shift += 8) {
+                int d = abs((int)((pixels[i] >> shift) & 0xFF) - (int)((expected[i] >> shift) & 0xFF));
+                if (d > pixelDiff) pixelDiff = d;
+            }
+            if (pixelDiff > maxDiff) maxDiff = pixelDiff;
+            if (pixelDiff > GOLDEN_TOLERANCE) mismatched++;
+        }
+        double mismatchedPct = 100.0 * mismatched / pixels.size();
+        if (mismatchedPct > GOLDEN_MISMATCH_PCT) {
+            // Left in the working directory for a look next to the reference
+            string actual = string(name) + ".actual.pam";
+            WritePam(actual, pixels, width, height);
+            fprintf(stderr, "  %s: %.2f%% of pixels differ, by up to %d; wrote %s\n", name, mismatchedPct, maxDiff,
+                    actual.c_str());
+            CHECK(false);
+        }
+    }
+};
+
+TEST(Rest) {
+    GoldenPanel panel;
+    HandlePointerMove(-1, -1);
+    panel.Paint();
+    panel.CheckGolden("rest");
+}
+
+TEST(HoverOnPlay) {
+    GoldenPanel panel;
+    const PanelGeometry& g = g_Layout.geometry;
+    HandlePointerMove(g.playX + 4, g.controlY);
+    CHECK_EQ(g_HoverState, (int)HIT_PLAY);
+    panel.Paint();
+    panel.CheckGolden("hover");
+    HandlePointerMove(-1, -1);
+}
+
+TEST(DragOnTimeline) {
+    GoldenPanel panel;
+    const PanelGeometry& g = g_Layout.geometry;
+    int x = g.barX + g.barW / 3;
+    g_TimelineDragging = true;
+    g_TimelineDragProgress = g_Layout.TimelineFraction(g.barX);
+    HandlePointerMove(x, g.barY + BAR_HEIGHT / 2);
+    panel.Paint();
+    panel.CheckGolden("drag");
+    g_TimelineDragging = false;
+    HandlePointerMove(-1, -1);
+}
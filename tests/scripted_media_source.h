@@ -0,0 +1,195 @@
+// A MediaSource whose sessions the test sets up. Every change fires the notification
+// GSMTC would send for it, from the calling thread; reads, commands and seeks are
+// counted. Safe to drive from any thread, like the real source.
+#pragma once
+
+class ScriptedMediaSource : public MediaSource {
+public:
+    struct Session {
+        wstring title;
+        wstring artist;
+        bool playing = true;
+        double position = 0.0;
+        double duration = 0.0;
+        double stamp = 0.0;
+        unsigned controls = MEDIA_CONTROL_ALL;
+        vector<uint8_t> cover;
+    };
+
+    atomic<bool> startable{true};     // Start() fails while false
+    atomic<bool> acceptCommands{true};
+    atomic<int> commandDelayMs{0};    // Each command or seek takes this long to answer
+    atomic<int> starts{0};
+    atomic<int> stops{0};
+    atomic<int> reads{0};
+    atomic<int> propertyReads{0};     // Reads that asked for the title and artist
+    atomic<int> thumbnailReads{0};
+    atomic<int> seeks{0};
+
+    void AddSession(const wstring& appId, const wstring& title, const wstring& artist = L"",
+                    vector<uint8_t> cover = vector<uint8_t>()) {
+        {
+            lock_guard<mutex> guard(m_lock);
+            Session& session = m_sessions[appId];
+            session.title = title;
+            session.artist = artist;
+            session.cover = move(cover);
+            if (m_current.empty()) m_current = appId;
+        }
+        Fire(L"", MEDIA_CHANGE_SESSION);
+    }
+
+    void RemoveSession(const wstring& appId) {
+        {
+            lock_guard<mutex> guard(m_lock);
+            m_sessions.erase(appId);
+            if (m_current == appId) m_current = m_sessions.empty() ? wstring() : m_sessions.begin()->first;
+        }
+        Fire(L"", MEDIA_CHANGE_SESSION);
+    }
+
+    void SetCurrent(const wstring& appId) {
+        {
+            lock_guard<mutex> guard(m_lock);
+            m_current = appId;
+        }
+        Fire(L"", MEDIA_CHANGE_SESSION);
+    }
+
+    void SetTrack(const wstring& appId, const wstring& title, const wstring& artist,
+                  vector<uint8_t> cover = vector<uint8_t>()) {
+        {
+            lock_guard<mutex> guard(m_lock);
+            Session& session = m_sessions[appId];
+            session.title = title;
+            session.artist = artist;
+            session.cover = move(cover);
+        }
+        Fire(appId, MEDIA_CHANGE_PROPERTIES);
+    }
+
+    void SetPlaying(const wstring& appId, bool playing) {
+        {
+            lock_guard<mutex> guard(m_lock);
+            m_sessions[appId].playing = playing;
+        }
+        Fire(appId, MEDIA_CHANGE_PLAYBACK);
+    }
+
+    void SetTimeline(const wstring& appId, double position, double duration, double stamp) {
+        {
+            lock_guard<mutex> guard(m_lock);
+            Session& session = m_sessions[appId];
+            session.position = position;
+            session.duration = duration;
+            session.stamp = stamp;
+        }
+        Fire(appId, MEDIA_CHANGE_TIMELINE);
+    }
+
+    // Sends a notification without changing anything, like a player repeating itself
+    void Fire(const wstring& appId, unsigned changes) {
+        function<void(const wstring&, unsigned)> onChanged;
+        {
+            lock_guard<mutex> guard(m_lock);
+            onChanged = m_onChanged;
+        }
+        if (onChanged) onChanged(appId, changes);
+    }
+
+    // Commands the source accepted, in the order they arrived
+    vector<int> Commands() {
+        lock_guard<mutex> guard(m_lock);
+        return m_commands;
+    }
+
+    double LastSeek() {
+        lock_guard<mutex> guard(m_lock);
+        return m_lastSeek;
+    }
+
+    bool Start(function<void(const wstring&, unsigned)> onChanged) override {
+        starts++;
+        if (!startable) return false;
+        lock_guard<mutex> guard(m_lock);
+        m_onChanged = onChanged;
+        return true;
+    }
+
+    void Stop() override {
+        stops++;
+        lock_guard<mutex> guard(m_lock);
+        m_onChanged = nullptr;
+    }
+
+    void ListSessions(vector<wstring>& appIds, wstring& current) override {
+        lock_guard<mutex> guard(m_lock);
+        appIds.clear();
+        for (auto& session : m_sessions) appIds.push_back(session.first);
+        current = m_current;
+    }
+
+    bool Read(const wstring& appId, unsigned changes, MediaReading& out) override {
+        reads++;
+        lock_guard<mutex> guard(m_lock);
+        auto it = m_sessions.find(appId);
+        if (it == m_sessions.end()) {
+            out = MediaReading();
+            return false;
+        }
+        const Session& session = it->second;
+        out.hasSession = true;
+        out.appId = appId;
+        if (changes & (MEDIA_CHANGE_SESSION | MEDIA_CHANGE_PROPERTIES)) {
+            propertyReads++;
+            out.title = session.title;
+            out.artist = session.artist;
+        }
+        if (changes & (MEDIA_CHANGE_SESSION | MEDIA_CHANGE_PLAYBACK)) {
+            out.isPlaying = session.playing;
+            out.controls = session.controls;
+        }
+        out.hasTimeline = wcsstr(appId.c_str(), L"Spotify") != nullptr;
+        if (out.hasTimeline && (changes & (MEDIA_CHANGE_SESSION | MEDIA_CHANGE_TIMELINE | MEDIA_CHANGE_PLAYBACK))) {
+            out.position = session.position;
+            out.duration = session.duration;
+            out.positionStamp = session.stamp;
+        }
+        return true;
+    }
+
+    bool ReadThumbnail(const wstring& appId, vector<uint8_t>& bytes) override {
+        thumbnailReads++;
+        lock_guard<mutex> guard(m_lock);
+        auto it = m_sessions.find(appId);
+        bytes = it == m_sessions.end() ? vector<uint8_t>() : it->second.cover;
+        return !bytes.empty();
+    }
+
+    bool SendCommand(const wstring& appId, int cmd) override {
+        this_thread::sleep_for(chrono::milliseconds(commandDelayMs.load()));
+        if (!acceptCommands) return false;
+        lock_guard<mutex> guard(m_lock);
+        if (!m_sessions.count(appId)) return false;
+        m_commands.push_back(cmd);
+        return true;
+    }
+
+    bool Seek(const wstring& appId, double seconds) override {
+        this_thread::sleep_for(chrono::milliseconds(commandDelayMs.load()));
+        if (!acceptCommands) return false;
+        seeks++;
+        lock_guard<mutex> guard(m_lock);
+        if (!m_sessions.count(appId)) return false;
+        m_lastSeek = seconds;
+        return true;
+    }
+
+private:
+    mutex m_lock;
+    function<void(const wstring&, unsigned)> m_onChanged;
+    map<wstring, Session> m_sessions;
+    wstring m_current;
+    vector<int> m_commands;
+    double m_lastSeek = -1.0;
+};
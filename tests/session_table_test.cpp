@@ -0,0 +1,153 @@
+// SessionTable against fake session lists, and the worker switching between sessions it
+// has already read without reading them again.
+#include "../music.mod.cpp"
+#include "harness.h"
+#include "worker_fixture.h"
+
+static const wstring g_Spotify = L"Spotify.exe";
+static const wstring g_Edge = L"msedge.exe";
+static const wstring g_Teams = L"Teams.exe";
+
+TEST(FollowsWindowsCurrent) {
+    SessionTable table;
+    CHECK(table.Active() == nullptr);
+    CHECK(table.Sync({ g_Spotify, g_Edge }, g_Edge));
+    CHECK_EQ(table.ActiveId(), g_Edge);
+    CHECK(!table.IsPinned());
+    CHECK(table.Sync({ g_Spotify, g_Edge }, g_Spotify));
+    CHECK_EQ(table.ActiveId(), g_Spotify);
+    // Nothing changed
+    CHECK(!table.Sync({ g_Spotify, g_Edge }, g_Spotify));
+}
+
+TEST(FallsBackWhenCurrentIsUnknown) {
+    SessionTable table;
+    // No current session, or one not in the list yet: the first open session by app id
+    // is shown
+    table.Sync({ g_Edge, g_Teams }, L"");
+    CHECK_EQ(table.ActiveId(), g_Teams);
+    table.Sync({ g_Edge, g_Teams }, g_Spotify);
+    CHECK_EQ(table.ActiveId(), g_Teams);
+    CHECK(table.Sync({}, L""));
+    CHECK(table.Active() == nullptr);
+    CHECK_EQ(table.ActiveId(), wstring());
+}
+
+TEST(EntriesSurviveSwitching) {
+    SessionTable table;
+    table.Sync({ g_Spotify, g_Edge }, g_Spotify);
+    SessionEntry* spotify = table.Find(g_Spotify);
+    SessionEntry* edge = table.Find(g_Edge);
+    CHECK(spotify && edge);
+    CHECK_EQ(spotify->state.sessionId, g_Spotify);
+    spotify->state.title = L"Song";
+    spotify->pending = 0;
+    edge->state.title = L"Video";
+    edge->pending = 0;
+
+    // Switching picks the other entry as it is: same object, nothing to read again
+    table.Sync({ g_Spotify, g_Edge }, g_Edge);
+    CHECK(table.Active() == edge);
+    CHECK_EQ(table.Active()->state.title, wstring(L"Video"));
+    table.Sync({ g_Spotify, g_Edge, g_Teams }, g_Spotify);
+    CHECK(table.Active() == spotify);
+    CHECK_EQ(spotify->pending, 0u);
+    CHECK_EQ(edge->pending, 0u);
+    // Only the new session needs reading
+    CHECK_EQ(table.Find(g_Teams)->pending, (unsigned)MEDIA_CHANGE_ALL);
+}
+
+TEST(ClosedSessionsAreDropped) {
+    SessionTable table;
+    table.Sync({ g_Spotify, g_Edge, g_Teams }, g_Teams);
+    CHECK(table.Sync({ g_Spotify, g_Edge }, g_Teams));
+    CHECK(table.Find(g_Teams) == nullptr);
+    CHECK_EQ(table.ActiveId(), g_Spotify);
+    int count = 0;
+    table.ForEach([&](const wstring&, SessionEntry&) { count++; });
+    CHECK_EQ(count, 2);
+}
+
+TEST(CyclePinsInOrderThenFollowsWindows) {
+    SessionTable table;
+    table.Sync({ g_Spotify, g_Teams, g_Edge }, g_Edge);
+    // Ordered by app id: Spotify.exe, Teams.exe, msedge.exe
+    CHECK(table.Cycle());
+    CHECK(table.IsPinned());
+    CHECK_EQ(table.ActiveId(), g_Spotify);
+    CHECK(table.Cycle());
+    CHECK_EQ(table.ActiveId(), g_Teams);
+    // A pinned session stays however Windows switches
+    CHECK(!table.Sync({ g_Spotify, g_Teams, g_Edge }, g_Spotify));
+    CHECK_EQ(table.ActiveId(), g_Teams);
+    CHECK(table.Cycle());
+    CHECK_EQ(table.ActiveId(), g_Edge);
+    // Past the last: back to following Windows
+    CHECK(table.Cycle());
+    CHECK(!table.IsPinned());
+    CHECK_EQ(table.ActiveId(), g_Spotify);
+}
+
+TEST(ClosingThePinnedSessionUnpins) {
+    SessionTable table;
+    table.Sync({ g_Spotify, g_Edge }, g_Spotify);
+    // Pins the one after the active session
+    table.Cycle();
+    CHECK_EQ(table.ActiveId(), g_Edge);
+    CHECK(table.IsPinned());
+    CHECK(table.Sync({ g_Spotify }, g_Spotify));
+    CHECK(!table.IsPinned());
+    CHECK_EQ(table.ActiveId(), g_Spotify);
+}
+
+TEST(PendingChangesAccumulate) {
+    SessionTable table;
+    table.Sync({ g_Spotify, g_Edge }, g_Spotify);
+    table.ForEach([](const wstring&, SessionEntry& entry) { entry.pending = 0; });
+    table.MarkPending(g_Spotify, MEDIA_CHANGE_TIMELINE);
+    table.MarkPending(g_Spotify, MEDIA_CHANGE_PLAYBACK);
+    table.MarkPending(L"Closed.exe", MEDIA_CHANGE_ALL);
+    CHECK_EQ(table.Find(g_Spotify)->pending, (unsigned)(MEDIA_CHANGE_TIMELINE | MEDIA_CHANGE_PLAYBACK));
+    CHECK_EQ(table.Find(g_Edge)->pending, 0u);
+    table.MarkAllPending(MEDIA_CHANGE_PROPERTIES);
+    CHECK_EQ(table.Find(g_Edge)->pending, (unsigned)MEDIA_CHANGE_PROPERTIES);
+    table.Clear();
+    CHECK(table.Active() == nullptr);
+    CHECK(table.Find(g_Spotify) == nullptr);
+}
+
+// Through the worker: once both sessions are read, switching between them publishes the
+// other one's state without a single read or thumbnail fetch
+TEST(WorkerSwitchesWithoutRereading) {
+    WorkerFixture f;
+    f.source->AddSession(g_Spotify, L"Song", L"Artist", EncodeTestCover(32, 32, 0xFF00FF00));
+    f.source->AddSession(g_Edge, L"Video", L"Channel", EncodeTestCover(32, 32, 0xFF0000FF));
+    f.source->SetTimeline(g_Spotify, 42.0, 180.0, 0.0);
+    f.Start();
+    f.WaitForSnapshot([](const MediaSnapshot& s) { return s.title == L"Song" && s.albumArt; });
+    f.Drain();
+    int reads = f.source->reads;
+    int thumbnails = f.source->thumbnailReads;
+
+    for (int i = 0; i < 3; i++) {
+        f.source->SetCurrent(g_Edge);
+        const MediaSnapshot& edge = f.WaitForSnapshot([](const MediaSnapshot& s) { return s.sessionId == L"msedge.exe"; });
+        CHECK_EQ(edge.title, wstring(L"Video"));
+        CHECK(edge.albumArt != nullptr);
+        f.source->SetCurrent(g_Spotify);
+        const MediaSnapshot& spotify = f.WaitForSnapshot([](const MediaSnapshot& s) { return s.sessionId == L"Spotify.exe"; });
+        CHECK_EQ(spotify.title, wstring(L"Song"));
+        CHECK_EQ(spotify.duration, 180.0);
+    }
+
+    // Pinning through the worker is the same swap
+    f.worker.CycleSession();
+    const MediaSnapshot& pinned = f.WaitForSnapshot([](const MediaSnapshot& s) { return s.sessionPinned; });
+    CHECK_EQ(pinned.sessionId, g_Edge);
+    f.worker.CycleSession();
+    const MediaSnapshot& unpinned = f.WaitForSnapshot([](const MediaSnapshot& s) { return !s.sessionPinned; });
+    CHECK_EQ(unpinned.sessionId, g_Spotify);
+    f.Drain();
+    CHECK_EQ(f.source->reads.load(), reads);
+    CHECK_EQ(f.source->thumbnailReads.load(), thumbnails);
+}
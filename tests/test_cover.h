@@ -0,0 +1,31 @@
+// The cover format of the headless builds, which have no image decoder. Include once per
+// executable, right after music.mod.cpp.
+#pragma once
+
+// Covers in the tests are raw: width and height as 32-bit integers, then straight ARGB
+// pixels. DecodeArt takes the place of the GDI+ decoder for them.
+inline vector<uint8_t> EncodeTestCover(int width, int height, const vector<uint32_t>& argb) {
+    vector<uint8_t> bytes(8 + argb.size() * 4);
+    memcpy(&bytes[0], &width, 4);
+    memcpy(&bytes[4], &height, 4);
+    memcpy(bytes.data() + 8, argb.data(), argb.size() * 4);
+    return bytes;
+}
+
+inline vector<uint8_t> EncodeTestCover(int width, int height, uint32_t argb) {
+    return EncodeTestCover(width, height, vector<uint32_t>((size_t)width * height, argb));
+}
+
+bool DecodeArt(const vector<uint8_t>& bytes, ArtImage& out) {
+    if (bytes.size() < 8) return false;
+    int width, height;
+    memcpy(&width, &bytes[0], 4);
+    memcpy(&height, &bytes[4], 4);
+    if (width <= 0 || height <= 0 || bytes.size() != 8 + (size_t)width * height * 4) return false;
+    out.width = width;
+    out.height = height;
+    out.pixels.resize((size_t)width * height);
+    memcpy(out.pixels.data(), &bytes[8], out.pixels.size() * 4);
+    g_Kernels.premultiply(out.pixels.data(), out.pixels.size());
+    return true;
+}
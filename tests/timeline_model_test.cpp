@@ -0,0 +1,181 @@
+// TimelineModel replayed against timelines in the shape GSMTC reports them: a handful of
+// events per track, with the jitter, seeks, pauses and repeats players produce. The bar
+// is sampled every frame between events.
+#include "../music.mod.cpp"
+#include "harness.h"
+
+#define FRAME_MS 16.0
+#define TRACK_SECONDS 215.0
+
+struct TimelineEvent {
+    double arrival;  // Clock ms at which the worker saw it
+    double position;
+    double stamp;    // LastUpdatedTime, as Clock ms
+    bool playing;
+    double rate;
+};
+
+// Feeds the events in order and calls frame(now, shown, model) every FRAME_MS until 'endMs'
+template <typename F>
+static void Replay(const vector<TimelineEvent>& events, double endMs, F frame) {
+    TimelineModel model;
+    size_t next = 0;
+    for (double now = events[0].arrival; now <= endMs; now += FRAME_MS) {
+        while (next < events.size() && events[next].arrival <= now) {
+            const TimelineEvent& e = events[next++];
+            TimelineSample sample;
+            sample.position = e.position;
+            sample.stamp = e.stamp;
+            sample.duration = TRACK_SECONDS;
+            sample.rate = e.rate;
+            sample.playing = e.playing;
+            model.Update(sample, now);
+        }
+        frame(now, model.Position(now), model);
+    }
+}
+
+TEST(ExtrapolatesFromTheStamp) {
+    TimelineSample sample;
+    sample.position = 10.0;
+    sample.stamp = 1000.0;
+    sample.duration = 60.0;
+    sample.playing = true;
+    CHECK_EQ(ExtrapolatePosition(sample, 3000.0), 12.0);
+    // Before the stamp the sample is taken as it is
+    CHECK_EQ(ExtrapolatePosition(sample, 500.0), 10.0);
+    sample.rate = 2.0;
+    CHECK_EQ(ExtrapolatePosition(sample, 3000.0), 14.0);
+    CHECK_EQ(ExtrapolatePosition(sample, 1000000.0), 60.0);
+    sample.playing = false;
+    CHECK_EQ(ExtrapolatePosition(sample, 3000.0), 10.0);
+}
+
+// Events every five seconds or so, each a little off from where the last one predicted
+static const vector<TimelineEvent> g_JitteryPlay = {
+    { 0.0,     0.0,  0.0,     true, 1.0 },
+    { 4020.0,  4.0,  3990.0,  true, 1.0 },
+    { 9100.0,  9.3,  9050.0,  true, 1.0 },
+    { 14010.0, 13.9, 14000.0, true, 1.0 },
+    { 19500.0, 19.5, 19480.0, true, 1.0 },
+    { 19520.0, 19.5, 19480.0, true, 1.0 },  // Repeated
+    { 25030.0, 24.8, 25000.0, true, 1.0 },
+};
+
+TEST(JitterIsSlewedNotJumped) {
+    double last = -1.0;
+    double largestStep = 0.0;
+    double largestError = 0.0;
+    Replay(g_JitteryPlay, 30000.0, [&](double now, double shown, const TimelineModel&) {
+        if (last >= 0.0) {
+            CHECK(shown >= last);  // Never backwards while playing
+            largestStep = max(largestStep, shown - last);
+        }
+        largestError = max(largestError, fabs(shown - now / 1000.0));
+        last = shown;
+    });
+    // At most half again the normal speed while catching up
+    CHECK(largestStep <= FRAME_MS * 1.5 / 1000.0 + 1e-9);
+    CHECK(largestError < 0.5);
+}
+
+TEST(SlewSettlesOnTheSample) {
+    bool settled = false;
+    Replay(g_JitteryPlay, 11000.0, [&](double now, double shown, const TimelineModel& model) {
+        // The event at 9.1 s is 0.24 s ahead of the bar, which catches up over 480 ms
+        if (now >= 9100.0 + 500.0 + FRAME_MS) {
+            CHECK(!model.IsSlewing(now));
+            CHECK_NEAR(shown, 9.3 + (now - 9050.0) / 1000.0, 1e-9);
+            settled = true;
+        } else if (now >= 9100.0 && now < 9500.0) {
+            CHECK(model.IsSlewing(now));
+        }
+    });
+    CHECK(settled);
+}
+
+// A seek to two minutes, a pause a while later, and the resume
+static const vector<TimelineEvent> g_SeekPauseResume = {
+    { 0.0,     0.0,   0.0,     true,  1.0 },
+    { 5000.0,  5.0,   5000.0,  true,  1.0 },
+    { 30010.0, 120.0, 30000.0, true,  1.0 },
+    { 40000.0, 130.0, 40000.0, false, 1.0 },
+    { 50000.0, 130.0, 50000.0, true,  1.0 },
+};
+
+TEST(SeeksSnap) {
+    bool checked = false;
+    Replay(g_SeekPauseResume, 31000.0, [&](double now, double shown, const TimelineModel& model) {
+        if (now >= 30010.0 && !checked) {
+            CHECK(!model.IsSlewing(now));
+            CHECK_NEAR(shown, 120.0 + (now - 30000.0) / 1000.0, 1e-9);
+            checked = true;
+        }
+    });
+    CHECK(checked);
+}
+
+TEST(PauseHoldsAndResumeContinues) {
+    double last = -1.0;
+    Replay(g_SeekPauseResume, 60000.0, [&](double now, double shown, const TimelineModel&) {
+        if (now >= 40000.0 && now < 50000.0) CHECK_NEAR(shown, 130.0, 1e-9);
+        if (now >= 50000.0) {
+            CHECK(shown >= last);
+            CHECK_NEAR(shown, 130.0 + (now - 50000.0) / 1000.0, 1e-9);
+        }
+        last = shown;
+    });
+}
+
+// Some players send the play state change alone, with the timeline left as it was
+TEST(PlayStateWithoutTimelineCarriesOn) {
+    TimelineModel model;
+    TimelineSample sample;
+    sample.position = 10.0;
+    sample.stamp = 0.0;
+    sample.duration = TRACK_SECONDS;
+    sample.playing = true;
+    model.Update(sample, 0.0);
+
+    sample.playing = false;
+    model.Update(sample, 3000.0);
+    CHECK_NEAR(model.Position(3000.0), 13.0, 1e-9);
+    CHECK_NEAR(model.Position(8000.0), 13.0, 1e-9);
+
+    sample.playing = true;
+    model.Update(sample, 8000.0);
+    CHECK_NEAR(model.Position(8000.0), 13.0, 1e-9);
+    CHECK_NEAR(model.Position(10000.0), 15.0, 1e-9);
+}
+
+TEST(RateChangeKeepsThePosition) {
+    TimelineModel model;
+    TimelineSample sample;
+    sample.duration = TRACK_SECONDS;
+    sample.playing = true;
+    model.Update(sample, 0.0);
+    sample.rate = 2.0;
+    model.Update(sample, 4000.0);
+    CHECK_NEAR(model.Position(4000.0), 4.0, 1e-9);
+    CHECK_NEAR(model.Position(6000.0), 8.0, 1e-9);
+}
+
+TEST(ClampsAtTheEnds) {
+    TimelineModel model;
+    CHECK_EQ(model.Position(1000.0), 0.0);
+    TimelineSample sample;
+    sample.position = TRACK_SECONDS - 1.0;
+    sample.duration = TRACK_SECONDS;
+    sample.playing = true;
+    model.Update(sample, 0.0);
+    CHECK_EQ(model.Position(5000.0), TRACK_SECONDS);
+    model.Reset();
+    CHECK_EQ(model.Position(5000.0), 0.0);
+}
+
+TEST(ReplayIsDeterministic) {
+    vector<double> first, second;
+    Replay(g_JitteryPlay, 30000.0, [&](double, double shown, const TimelineModel&) { first.push_back(shown); });
+    Replay(g_JitteryPlay, 30000.0, [&](double, double shown, const TimelineModel&) { second.push_back(shown); });
+    CHECK(first == second);
+}
@@ -0,0 +1,124 @@
+// The trace rings: wrap-around, ordering across threads, dumps taken while the owners
+// keep writing, and rings handed on when short-lived threads exit.
+#include "../music.mod.cpp"
+#include "harness.h"
+
+// Each test tags its events through 'b' so rings left over from earlier tests, and from
+// threads that held the same ring before, are told apart
+static vector<TraceEvent> Tagged(double tag) {
+    vector<TraceEvent> out;
+    for (const TraceEvent& e : CollectTrace()) {
+        if (e.b == tag) out.push_back(e);
+    }
+    return out;
+}
+
+static void Write(double a, double tag) {
+    TraceWrite(TRACE_LEVEL_INFO, TRACE_CAT_MEDIA, TRACE_POLL, TRACE_INSTANT, a, tag);
+}
+
+TEST(WrapKeepsTheNewestRing) {
+    const double tag = 1.0;
+    const int count = TRACE_RING_SIZE * 3 + 5;
+    thread writer([&] {
+        for (int i = 0; i < count; i++) Write(i, tag);
+    });
+    writer.join();
+    // The slot the owner would write next is never trusted, so one less than a ring
+    vector<TraceEvent> events = Tagged(tag);
+    CHECK_EQ(events.size(), (size_t)(TRACE_RING_SIZE - 1));
+    int wrong = 0;
+    for (size_t i = 0; i < events.size(); i++) wrong += events[i].a != (double)(count - TRACE_RING_SIZE + 1 + i);
+    CHECK_EQ(wrong, 0);
+}
+
+TEST(ThreadsInterleaveInTimeOrder) {
+    const double tag = 2.0;
+    // Each thread writes in turn, so the dump has to merge the rings to get 0, 1, 2, ...
+    const int threads = 3, rounds = 50;
+    atomic<int> turn{0};
+    vector<thread> writers;
+    for (int t = 0; t < threads; t++) {
+        writers.emplace_back([&, t] {
+            for (int r = 0; r < rounds; r++) {
+                int mine = r * threads + t;
+                while (turn.load() != mine) this_thread::yield();
+                Write(mine, tag);
+                // The clock may not tick between two writes; wait until it has
+                double written = g_SystemClock.Now();
+                while (g_SystemClock.Now() == written) this_thread::yield();
+                turn++;
+            }
+        });
+    }
+    for (thread& writer : writers) writer.join();
+    vector<TraceEvent> events = Tagged(tag);
+    CHECK_EQ(events.size(), (size_t)(threads * rounds));
+    for (size_t i = 0; i < events.size(); i++) CHECK_EQ(events[i].a, (double)i);
+    // And each names the thread that wrote it
+    CHECK(events[0].threadId != events[1].threadId);
+    CHECK_EQ(events[0].threadId, events[threads].threadId);
+}
+
+// Every dump taken while the owners write shows, per thread, an unbroken run of its
+// latest events: nothing torn, nothing from a slot being overwritten
+TEST(DumpWhileWriting) {
+    const double tag = 3.0;
+    const int threads = 4;
+    atomic<bool> done{false};
+    vector<thread> writers;
+    for (int t = 0; t < threads; t++) {
+        writers.emplace_back([&, t] {
+            for (uint64_t i = 0; !done; i++) TraceWrite(TRACE_LEVEL_INFO, TRACE_CAT_ART, TRACE_DECODE, TRACE_INSTANT, (double)i, tag + t * 0.25);
+        });
+    }
+    int broken = 0, dumps = 0;
+    auto end = chrono::steady_clock::now() + chrono::milliseconds(500);
+    while (chrono::steady_clock::now() < end) {
+        for (int t = 0; t < threads; t++) {
+            vector<TraceEvent> events = Tagged(tag + t * 0.25);
+            CHECK(events.size() <= (size_t)TRACE_RING_SIZE);
+            for (size_t i = 1; i < events.size(); i++) {
+                broken += events[i].a != events[i - 1].a + 1 || events[i].id != TRACE_DECODE ||
+                          events[i].threadId != events[0].threadId;
+            }
+        }
+        dumps++;
+    }
+    wstring text = FormatTrace();
+    done = true;
+    for (thread& writer : writers) writer.join();
+    CHECK(dumps > 10);
+    CHECK_EQ(broken, 0);
+    CHECK(text.find(L" art    decode a=") != wstring::npos);
+}
+
+// Callback threads come and go; each gives its ring back on exit
+TEST(ExitedThreadsReleaseTheirRings) {
+    const double tag = 4.0;
+    uint32_t dropped = g_TraceDropped.load();
+    for (int i = 0; i < TRACE_MAX_THREADS * 4; i++) thread([&] { Write(i, tag); }).join();
+    CHECK_EQ(g_TraceDropped.load(), dropped);
+    vector<TraceEvent> events = Tagged(tag);
+    CHECK_EQ(events.size(), (size_t)(TRACE_MAX_THREADS * 4));
+
+    // With every ring owned, one more thread's events are counted as dropped
+    atomic<int> holding{0};
+    atomic<bool> release{false};
+    vector<thread> holders;
+    for (int i = 0; i < TRACE_MAX_THREADS; i++) {
+        holders.emplace_back([&] {
+            Write(0, 5.0);
+            holding++;
+            while (!release) this_thread::yield();
+        });
+    }
+    CHECK(WaitFor([&] { return holding.load() == TRACE_MAX_THREADS; }));
+    dropped = g_TraceDropped.load();
+    thread([&] { Write(0, 6.0); }).join();
+    CHECK(g_TraceDropped.load() > dropped);
+    release = true;
+    for (thread& holder : holders) holder.join();
+    thread([&] { Write(1, 6.0); }).join();
+    CHECK_EQ(Tagged(6.0).size(), (size_t)1);
+}
@@ -0,0 +1,138 @@
+// TripleBuffer hammered by a writer and a reader at once: every value read must be one
+// that was published whole, never older than the last one read. Built with TSan where
+// available.
+#include "../music.mod.cpp"
+#include "harness.h"
+
+#define STRESS_PUBLISHES 200000
+
+// Large enough that a torn copy cannot go unnoticed
+struct Frame {
+    uint64_t seq = 0;
+    uint64_t words[64] = {};
+};
+
+TEST(LatestValueWins) {
+    TripleBuffer<int> buffer;
+    CHECK_EQ(buffer.Acquire(), 0);
+    buffer.Publish(1);
+    buffer.Publish(2);
+    CHECK_EQ(buffer.Acquire(), 2);
+    // Nothing new: the same slot again
+    const int* slot = &buffer.Acquire();
+    CHECK_EQ(&buffer.Acquire(), slot);
+    buffer.Publish(3);
+    CHECK_EQ(buffer.Current(), 2);
+    CHECK_EQ(buffer.Acquire(), 3);
+}
+
+TEST(ResetDropsUnreadValues) {
+    TripleBuffer<int> buffer;
+    buffer.Publish(1);
+    buffer.Publish(2);
+    buffer.Reset();
+    CHECK_EQ(buffer.Acquire(), 0);
+    CHECK_EQ(buffer.Current(), 0);
+    // And works as new afterwards
+    buffer.Publish(3);
+    CHECK_EQ(buffer.Acquire(), 3);
+    buffer.Acquire();
+    buffer.Reset();
+    CHECK_EQ(buffer.Acquire(), 0);
+}
+
+TEST(ReadsAreNeverTorn) {
+    TripleBuffer<Frame> buffer;
+    thread writer([&] {
+        Frame frame;
+        for (uint64_t seq = 1; seq <= STRESS_PUBLISHES; seq++) {
+            frame.seq = seq;
+            for (uint64_t& word : frame.words) word = seq;
+            buffer.Publish(frame);
+        }
+    });
+    uint64_t last = 0;
+    int torn = 0, backwards = 0;
+    while (last != STRESS_PUBLISHES) {
+        const Frame& frame = buffer.Acquire();
+        for (uint64_t word : frame.words) torn += word != frame.seq;
+        backwards += frame.seq < last;
+        last = frame.seq;
+    }
+    writer.join();
+    CHECK_EQ(torn, 0);
+    CHECK_EQ(backwards, 0);
+}
+
+TEST(SnapshotsAreConsistent) {
+    TripleBuffer<MediaSnapshot> buffer;
+    auto art = make_shared<ArtImage>();
+    art->width = art->height = 4;
+    art->pixels.assign(16, 0xFF102030);
+    thread writer([&] {
+        MediaSnapshot state;
+        for (uint64_t version = 1; version <= STRESS_PUBLISHES / 10; version++) {
+            state.version = version;
+            state.title = L"Title " + to_wstring(version);
+            state.artist = L"Artist " + to_wstring(version);
+            state.position = (double)version;
+            state.hasMedia = true;
+            // Shared between slots, as the worker shares decoded art
+            state.albumArt = version % 2 ? art : nullptr;
+            buffer.Publish(state);
+        }
+    });
+    uint64_t last = 0;
+    int inconsistent = 0;
+    while (last != STRESS_PUBLISHES / 10) {
+        const MediaSnapshot& state = buffer.Acquire();
+        CHECK(state.version >= last);
+        last = state.version;
+        if (!state.version) continue;
+        inconsistent += state.title != L"Title " + to_wstring(state.version);
+        inconsistent += state.artist != L"Artist " + to_wstring(state.version);
+        inconsistent += state.position != (double)state.version;
+        inconsistent += (state.albumArt != nullptr) != (state.version % 2 == 1);
+        if (state.albumArt) inconsistent += state.albumArt->pixels[15] != 0xFF102030;
+    }
+    writer.join();
+    CHECK_EQ(inconsistent, 0);
+}
+
+// A message sent from inside another one reads the outer message's snapshot, which
+// stays put however many times the worker publishes meanwhile
+TEST(NestedMessageKeepsOuterSnapshot) {
+    TripleBuffer<MediaSnapshot> buffer;
+    TripleBuffer<MediaSnapshot>* previous = g_UiSnapshots;
+    g_UiSnapshots = &buffer;
+    MediaSnapshot first;
+    first.version = 1;
+    first.title = L"Outer";
+    buffer.Publish(first);
+
+    g_MessageDepth = 1;
+    const MediaSnapshot& outer = AcquireMediaSnapshot();
+    CHECK_EQ(outer.title, wstring(L"Outer"));
+
+    thread writer([&] {
+        MediaSnapshot state;
+        for (uint64_t version = 2; version <= 10000; version++) {
+            state.version = version;
+            state.title = L"Inner " + to_wstring(version);
+            buffer.Publish(state);
+        }
+    });
+    g_MessageDepth = 2;
+    for (int i = 0; i < 10000; i++) {
+        const MediaSnapshot& inner = AcquireMediaSnapshot();
+        CHECK_EQ(&inner, &outer);
+    }
+    writer.join();
+    CHECK_EQ(outer.title, wstring(L"Outer"));
+
+    // Back at the outer level the next message sees the newest
+    g_MessageDepth = 1;
+    CHECK_EQ(AcquireMediaSnapshot().version, (uint64_t)10000);
+    g_MessageDepth = 0;
+    g_UiSnapshots = previous;
+}
@@ -0,0 +1,39 @@
+// A MediaWorker started on a ScriptedMediaSource, with the waits the worker tests share.
+// Include after harness.h.
+#pragma once
+
+#include "scripted_media_source.h"
+
+#define TEST_ART_SIZE 36
+
+// A worker publishing into its own buffer, fed by a scripted source
+struct WorkerFixture {
+    shared_ptr<ScriptedMediaSource> source = make_shared<ScriptedMediaSource>();
+    TripleBuffer<MediaSnapshot> snapshots;
+    MediaWorker worker{snapshots};
+
+    void Start() {
+        auto s = source;
+        worker.Start(nullptr, 0, 0, TEST_ART_SIZE, 32u << 20, [s]() -> shared_ptr<MediaSource> { return s; });
+    }
+
+    ~WorkerFixture() { worker.Stop(); }
+
+    // Returns once every notification sent before the call has been handled: tasks and
+    // notifications are taken together, so by the time a second task runs the pass that
+    // ran the first one is over
+    void Drain() {
+        for (int i = 0; i < 2; i++) {
+            atomic<bool> ran{false};
+            worker.Post([&ran](MediaSource&) { ran = true; });
+            CHECK(WaitFor([&] { return ran.load(); }));
+        }
+    }
+
+    // The latest snapshot once 'done' holds for it
+    template <typename F>
+    const MediaSnapshot& WaitForSnapshot(F done) {
+        WaitFor([&] { return done(snapshots.Acquire()); });
+        return snapshots.Current();
+    }
+};
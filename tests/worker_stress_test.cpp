@@ -0,0 +1,115 @@
+// The media worker under load: players change sessions and tracks from several threads
+// while commands and settings arrive and the UI side keeps reading snapshots. Built with
+// TSan where available.
+#include "../music.mod.cpp"
+#include "harness.h"
+#include "worker_fixture.h"
+
+#include <random>
+
+#define STRESS_MS 1500
+
+static const wchar_t* g_StressApps[] = { L"Spotify.exe", L"msedge.exe", L"Teams.exe" };
+
+// Titles name their session so a reader can tell a torn snapshot from a stale one
+static wstring StressTitle(const wstring& appId, int n) {
+    return appId + L"#" + to_wstring(n);
+}
+
+TEST(SnapshotsStayConsistentUnderLoad) {
+    WorkerFixture f;
+    for (const wchar_t* app : g_StressApps) f.source->AddSession(app, StressTitle(app, 0), app);
+    f.source->commandDelayMs = 1;
+    f.Start();
+
+    atomic<bool> done{false};
+    vector<thread> threads;
+    for (int t = 0; t < 2; t++) {
+        threads.emplace_back([&, t] {
+            mt19937 random(t + 1);
+            for (int n = 1; !done; n++) {
+                wstring app = g_StressApps[random() % 3];
+                switch (random() % 4) {
+                case 0:
+                    f.source->SetTrack(app, StressTitle(app, n), app,
+                                       random() % 8 ? vector<uint8_t>() : EncodeTestCover(16, 16, 0xFF000000u | random()));
+                    break;
+                case 1: f.source->SetTimeline(app, n % 200, 200.0, 0.0); break;
+                case 2: f.source->SetPlaying(app, random() % 2); break;
+                default: f.source->Fire(app, MEDIA_CHANGE_ALL); break;
+                }
+            }
+        });
+    }
+    threads.emplace_back([&] {
+        mt19937 random(10);
+        for (int n = 1; !done; n++) {
+            wstring app = g_StressApps[random() % 3];
+            if (random() % 4 == 0) {
+                f.source->RemoveSession(app);
+                f.source->AddSession(app, StressTitle(app, n), app);
+            } else {
+                f.source->SetCurrent(app);
+            }
+            this_thread::sleep_for(chrono::microseconds(200));
+        }
+    });
+    threads.emplace_back([&] {
+        mt19937 random(20);
+        while (!done) {
+            uint64_t id = random() % 4 == 3 ? f.worker.Seek(random() % 200) : f.worker.Command(random() % 3);
+            if (random() % 3 == 0) f.worker.CancelCommand(id);
+            if (random() % 16 == 0) f.worker.SetArtSize(24 + random() % 24);
+            this_thread::sleep_for(chrono::microseconds(100));
+        }
+    });
+
+    uint64_t lastVersion = 0;
+    int snapshots = 0;
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(STRESS_MS);
+    while (chrono::steady_clock::now() < deadline) {
+        const MediaSnapshot& state = f.snapshots.Acquire();
+        CHECK(state.version >= lastVersion);
+        if (state.version != lastVersion) snapshots++;
+        lastVersion = state.version;
+        if (state.hasMedia) {
+            CHECK_EQ(state.title.substr(0, state.sessionId.size() + 1), state.sessionId + L"#");
+            CHECK_EQ(state.artist, state.sessionId);
+        }
+        if (state.albumArt) {
+            // Shared with the worker's cache; only ever read
+            volatile uint32_t pixel = state.albumArt->pixels[state.albumArt->pixels.size() - 1];
+            (void)pixel;
+        }
+    }
+    done = true;
+    for (thread& t : threads) t.join();
+    CHECK(snapshots > 10);
+
+    // Once the load stops the snapshot catches up with the source
+    f.source->AddSession(L"Spotify.exe", L"Spotify.exe#final", L"Spotify.exe");
+    f.source->SetCurrent(L"Spotify.exe");
+    const MediaSnapshot& state = f.WaitForSnapshot([](const MediaSnapshot& s) { return s.title == L"Spotify.exe#final"; });
+    CHECK_EQ(state.title, wstring(L"Spotify.exe#final"));
+    CHECK_EQ(state.sessionId, wstring(L"Spotify.exe"));
+}
+
+TEST(StopWhileBusy) {
+    for (int round = 0; round < 20; round++) {
+        WorkerFixture f;
+        f.source->AddSession(L"Spotify.exe", L"Spotify.exe#0", L"Spotify.exe");
+        f.Start();
+        atomic<bool> done{false};
+        thread player([&] {
+            for (int n = 1; !done; n++) f.source->SetTrack(L"Spotify.exe", StressTitle(L"Spotify.exe", n), L"Spotify.exe");
+        });
+        for (int i = 0; i < 5; i++) f.worker.Command(i % 3);
+        this_thread::sleep_for(chrono::milliseconds(round % 5));
+        f.worker.Stop();
+        done = true;
+        player.join();
+        CHECK_EQ(f.source->stops.load(), 1);
+        // Ignored once stopped
+        CHECK_EQ(f.worker.Command(0), (uint64_t)0);
+    }
+}